@@ -0,0 +1,188 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Numa.hpp"
+
+// Bump allocator for the large per file buffers: the int16 block read from the file,
+// the result rows and the like. Memory comes from anonymous mappings in multiples of
+// 2 MiB, backed by explicit huge pages when the system has some reserved, otherwise
+// advised for transparent huge pages, otherwise plain pages. Nothing is freed on its
+// own, reset() makes all of it available again for the next file, so after the first
+// file the same pages are reused without faults. If a file needed several blocks they
+// are merged into one at reset.
+class Arena {
+    public:
+        enum class HugePages { OFF, TRANSPARENT, EXPLICIT };
+
+        static constexpr std::size_t HUGE_PAGE = 2 << 20;
+
+        // With a topology every block is placed on node before it is used
+        Arena(std::size_t blockBytes = 64 << 20, HugePages mode = HugePages::EXPLICIT,
+                const Numa::Topology* topology = nullptr, std::size_t node = 0)
+            : blockBytes { roundUp(std::max<std::size_t>(blockBytes, 1), HUGE_PAGE) }, mode { mode },
+              topology { topology }, node { node } { }
+
+        ~Arena() {
+            release();
+        }
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        // Uninitialised memory for bytes, valid until the next reset
+        void* allocate(std::size_t bytes, std::size_t alignment = 64) {
+            for(; current < blocks.size(); current++, used = 0) {
+                Block& block = blocks[current];
+                std::size_t offset = roundUp(used, alignment);
+                if(offset + bytes <= block.size) {
+                    used = offset + bytes;
+                    return block.data + offset;
+                }
+            }
+            blocks.push_back(map(std::max(blockBytes, roundUp(bytes, HUGE_PAGE))));
+            current = blocks.size() - 1;
+            used = bytes;
+            return blocks.back().data;
+        }
+
+        // Room for count objects of a trivial type, no constructors are run
+        template<class T>
+        T* allocate(std::size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value, "arena objects are never destroyed");
+            return static_cast<T*>(allocate(count * sizeof(T), std::max<std::size_t>(alignof(T), 64)));
+        }
+
+        // Everything allocated so far becomes invalid
+        void reset() {
+            if(blocks.size() > 1) {
+                std::size_t total = 0;
+                for(const Block& block : blocks) {
+                    total += block.size;
+                }
+                release();
+                blocks.push_back(map(total));
+            }
+            current = 0;
+            used = 0;
+        }
+
+        std::size_t getReserved() const {
+            std::size_t total = 0;
+            for(const Block& block : blocks) {
+                total += block.size;
+            }
+            return total;
+        }
+
+        // Bytes of blocks mapped from the explicit huge page pool
+        std::size_t getExplicit() const {
+            std::size_t total = 0;
+            for(const Block& block : blocks) {
+                total += block.explicitPages ? block.size : 0;
+            }
+            return total;
+        }
+
+        // Anonymous memory of the whole process on transparent huge pages
+        static std::size_t transparentBytes() {
+            std::ifstream in("/proc/self/smaps_rollup");
+            std::string key;
+            std::size_t kilobytes;
+            while(in >> key) {
+                if(key == "AnonHugePages:" && in >> kilobytes) {
+                    return kilobytes << 10;
+                }
+            }
+            return 0;
+        }
+
+        static HugePages parseMode(const std::string& name) {
+            if(name == "auto" || name == "explicit") {
+                return HugePages::EXPLICIT;
+            }
+            if(name == "transparent") {
+                return HugePages::TRANSPARENT;
+            }
+            if(name == "off") {
+                return HugePages::OFF;
+            }
+            throw std::runtime_error("Unknown huge page mode " + name + ", expected auto, transparent or off");
+        }
+
+    private:
+        struct Block {
+            char* data;
+            std::size_t size;
+            // what was unmapped, including the alignment slack
+            char* mapping;
+            std::size_t mapped;
+            bool explicitPages;
+        };
+
+        static std::size_t roundUp(std::size_t value, std::size_t multiple) {
+            return (value + multiple - 1) / multiple * multiple;
+        }
+
+        Block map(std::size_t bytes) {
+            Block block { nullptr, bytes, nullptr, 0, false };
+#ifdef MAP_HUGETLB
+            if(mode == HugePages::EXPLICIT) {
+                int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+                flags |= MAP_HUGE_2MB;
+#endif
+                void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+                if(data != MAP_FAILED) {
+                    block = { (char*)data, bytes, (char*)data, bytes, true };
+                }
+            }
+#endif
+            if(block.data == nullptr) {
+                // one huge page more than needed, to align the start for the THP code
+                std::size_t mapped = bytes + (mode == HugePages::OFF ? 0 : HUGE_PAGE);
+                void* data = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(data == MAP_FAILED) {
+                    throw std::runtime_error("Mapping " + std::to_string(bytes >> 20) + " MiB for the arena failed");
+                }
+                block = { (char*)data, bytes, (char*)data, mapped, false };
+                if(mode != HugePages::OFF) {
+                    block.data = (char*)roundUp((uintptr_t)data, HUGE_PAGE);
+#ifdef MADV_HUGEPAGE
+                    madvise(block.data, bytes, MADV_HUGEPAGE);
+#endif
+                }
+            }
+            if(topology != nullptr) {
+                Numa::place(block.data, block.size, *topology, node);
+            }
+            return block;
+        }
+
+        void release() {
+            for(const Block& block : blocks) {
+                munmap(block.mapping, block.mapped);
+            }
+            blocks.clear();
+        }
+
+        std::size_t blockBytes;
+        HugePages mode;
+        const Numa::Topology* topology;
+        std::size_t node;
+        std::vector<Block> blocks;
+        std::size_t current = 0;
+        std::size_t used = 0;
+};
+
+#endif
@@ -31,6 +31,14 @@
 #include <unordered_map>
 #include <iterator>
 #include <algorithm>
+#include <memory>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // disable some warnings on Windows
 #if defined (_MSC_VER)
@@ -79,6 +87,28 @@ public:
      */
     bool load (std::string filePath);
     
+    /** Memory maps a WAV file and parses its chunk headers in place without decoding
+     * any samples. The samples stay in the file until decodeMappedSamples() is called,
+     * or can be accessed without a copy through getSampleView().
+     * @Returns true if the file was successfully mapped
+     */
+    bool map (std::string filePath);
+    
+    /** @Returns true if the samples are held by a mapped file rather than the buffer */
+    bool isMapped() const;
+    
+    /** Decodes all samples of a mapped file into the buffer and releases the mapping.
+     * @Returns true if the samples were decoded
+     */
+    bool decodeMappedSamples();
+    
+    /** Decodes the samples [offset, offset + count) of one channel into dest. On a mapped
+     * file only that window is touched, pages ahead of it are prefetched and pages behind
+     * it are released while the reads advance, so memory stays on the order of the window.
+     * @Returns false if the window lies outside of the file
+     */
+    bool readChannel (int channel, size_t offset, size_t count, T* dest);
+    
     /** Saves an audio file to a given file path.
      * @Returns true if the file was successfully saved
      */
@@ -109,6 +139,29 @@ public:
     /** Prints a summary of the audio file to the console */
     void printSummary() const;
     
+    //=============================================================
+    /** A typed view on the interleaved samples of a mapped WAV file, i.e:
+     *
+     *      view (channel, frameIndex)
+     */
+    template <class S>
+    struct SampleView
+    {
+        const S* data = nullptr;
+        size_t numFrames = 0;
+        int numChannels = 0;
+        
+        bool isValid() const { return data != nullptr; }
+        const S& operator() (int channel, size_t frame) const { return data[frame * numChannels + channel]; }
+    };
+    
+    /** @Returns a zero-copy view on the mapped samples if they are stored as S, which is
+     * int16_t for 16 bit PCM, int32_t for 32 bit PCM and float for 32 bit IEEE float.
+     * Any other combination returns an invalid view.
+     */
+    template <class S>
+    SampleView<S> getSampleView() const;
+    
     //=============================================================
     
     /** Set the audio buffer for this AudioFile by copying samples from another buffer.
@@ -162,8 +215,21 @@ private:
     };
     
     //=============================================================
-    AudioFileFormat determineAudioFileFormat (std::vector<uint8_t>& fileData);
-    bool decodeWaveFile (std::vector<uint8_t>& fileData);
+    struct MappedFile
+    {
+        MappedFile (void* address, size_t length) : data ((const uint8_t*) address), size (length) {}
+        ~MappedFile() { munmap ((void*) data, size); }
+        
+        const uint8_t* data;
+        size_t size;
+    };
+    
+    //=============================================================
+    static std::shared_ptr<MappedFile> mapFile (const std::string& filePath);
+    AudioFileFormat determineAudioFileFormat (const uint8_t* fileData, size_t fileSize);
+    bool decodeWaveFile (std::shared_ptr<MappedFile> file);
+    void decodeWaveChannel (int channel, size_t firstFrame, size_t numFrames, T* dest) const;
+    void releaseMapping();
     bool decodeAiffFile (std::vector<uint8_t>& fileData);
     
     //=============================================================
@@ -178,6 +244,9 @@ private:
     int16_t twoBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness = Endianness::LittleEndian);
     int getIndexOfString (std::vector<uint8_t>& source, std::string s);
     int getIndexOfChunk (std::vector<uint8_t>& source, const std::string& chunkHeaderID, int startIndex, Endianness endianness = Endianness::LittleEndian);
+    static int32_t fourBytesToInt (const uint8_t* source);
+    static int16_t twoBytesToInt (const uint8_t* source);
+    static long getIndexOfChunk (const uint8_t* source, size_t sourceSize, const char* chunkHeaderID, size_t startIndex);
     
     //=============================================================
     T sixteenBitIntToSample (int16_t sample);
@@ -208,6 +277,20 @@ private:
     uint32_t sampleRate;
     int bitDepth;
     bool logErrorsToConsole {true};
+    
+    //=============================================================
+    // the mapped WAV file and where its interleaved samples start
+    std::shared_ptr<MappedFile> mappedFile;
+    const uint8_t* mappedSamples {nullptr};
+    size_t mappedNumFrames {0};
+    int mappedNumChannels {0};
+    int16_t mappedAudioFormat {0};
+    
+    // offset of the last window read from the mapping, the bytes before releasedBytes were
+    // given back and the bytes up to readAheadBytes were prefetched
+    size_t streamedFrame {0};
+    size_t releasedBytes {0};
+    size_t readAheadBytes {0};
 };
 
 
@@ -281,6 +364,9 @@ uint32_t AudioFile<T>::getSampleRate() const
 template <class T>
 int AudioFile<T>::getNumChannels() const
 {
+    if (isMapped())
+        return mappedNumChannels;
+    
     return (int)samples.size();
 }
 
@@ -309,7 +395,9 @@ int AudioFile<T>::getBitDepth() const
 template <class T>
 int AudioFile<T>::getNumSamplesPerChannel() const
 {
-    if (samples.size() > 0)
+    if (isMapped())
+        return (int) mappedNumFrames;
+    else if (samples.size() > 0)
         return (int) samples[0].size();
     else
         return 0;
@@ -349,6 +437,8 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
     
     size_t numSamples = newBuffer[0].size();
     
+    releaseMapping();
+    
     // set the number of channels
     samples.resize (newBuffer.size());
     
@@ -371,6 +461,9 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
 template <class T>
 void AudioFile<T>::setAudioBufferSize (int numChannels, int numSamples)
 {
+    if (isMapped())
+        decodeMappedSamples();
+    
     samples.resize (numChannels);
     setNumSamplesPerChannel (numSamples);
 }
@@ -379,6 +472,9 @@ void AudioFile<T>::setAudioBufferSize (int numChannels, int numSamples)
 template <class T>
 void AudioFile<T>::setNumSamplesPerChannel (int numSamples)
 {
+    if (isMapped())
+        decodeMappedSamples();
+    
     int originalSize = getNumSamplesPerChannel();
     
     for (int i = 0; i < getNumChannels();i++)
@@ -395,6 +491,9 @@ void AudioFile<T>::setNumSamplesPerChannel (int numSamples)
 template <class T>
 void AudioFile<T>::setNumChannels (int numChannels)
 {
+    if (isMapped())
+        decodeMappedSamples();
+    
     int originalNumChannels = getNumChannels();
     int originalNumSamplesPerChannel = getNumSamplesPerChannel();
     
@@ -437,28 +536,27 @@ void AudioFile<T>::shouldLogErrorsToConsole (bool logErrors)
 template <class T>
 bool AudioFile<T>::load (std::string filePath)
 {
-    std::ifstream file (filePath, std::ios::binary);
+    std::shared_ptr<MappedFile> file = mapFile (filePath);
     
     // check the file exists
-    if (! file.good())
+    if (file == nullptr)
     {
         reportError ("ERROR: File doesn't exist or otherwise can't load file\n"  + filePath);
         return false;
     }
     
-    file.unsetf (std::ios::skipws);
-    std::istream_iterator<uint8_t> begin (file), end;
-    std::vector<uint8_t> fileData (begin, end);
+    releaseMapping();
     
     // get audio file format
-    audioFileFormat = determineAudioFileFormat (fileData);
+    audioFileFormat = determineAudioFileFormat (file->data, file->size);
     
     if (audioFileFormat == AudioFileFormat::Wave)
     {
-        return decodeWaveFile (fileData);
+        return decodeWaveFile (file) && decodeMappedSamples();
     }
     else if (audioFileFormat == AudioFileFormat::Aiff)
     {
+        std::vector<uint8_t> fileData (file->data, file->data + file->size);
         return decodeAiffFile (fileData);
     }
     else
@@ -470,23 +568,204 @@ bool AudioFile<T>::load (std::string filePath)
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
+bool AudioFile<T>::map (std::string filePath)
 {
+    std::shared_ptr<MappedFile> file = mapFile (filePath);
+    
+    if (file == nullptr)
+    {
+        reportError ("ERROR: File doesn't exist or otherwise can't map file\n"  + filePath);
+        return false;
+    }
+    
+    releaseMapping();
+    audioFileFormat = determineAudioFileFormat (file->data, file->size);
+    
+    if (audioFileFormat != AudioFileFormat::Wave)
+    {
+        reportError ("ERROR: only .WAV files can be mapped");
+        return false;
+    }
+    
+    return decodeWaveFile (file);
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::isMapped() const
+{
+    return mappedFile != nullptr;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::decodeMappedSamples()
+{
+    if (! isMapped())
+        return false;
+    
+    // size every channel once and convert straight into it
+    AudioBuffer decoded (mappedNumChannels);
+    
+    for (int channel = 0; channel < mappedNumChannels; channel++)
+    {
+        decoded[channel].resize (mappedNumFrames);
+        decodeWaveChannel (channel, 0, mappedNumFrames, decoded[channel].data());
+    }
+    
+    releaseMapping();
+    samples.swap (decoded);
+    return true;
+}
+
+//=============================================================
+template <class T>
+template <class S>
+typename AudioFile<T>::template SampleView<S> AudioFile<T>::getSampleView() const
+{
+    SampleView<S> view;
+    
+    if (! isMapped())
+        return view;
+    
+    bool matchingFormat = false;
+    
+    if (std::is_same<S, int16_t>::value)
+        matchingFormat = mappedAudioFormat == WavAudioFormat::PCM && bitDepth == 16;
+    else if (std::is_same<S, int32_t>::value)
+        matchingFormat = mappedAudioFormat == WavAudioFormat::PCM && bitDepth == 32;
+    else if (std::is_same<S, float>::value)
+        matchingFormat = mappedAudioFormat == WavAudioFormat::IEEEFloat && bitDepth == 32;
+    
+    // WAV samples are little endian and the data chunk is not guaranteed to be aligned
+    bool littleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+    bool aligned = reinterpret_cast<uintptr_t> (mappedSamples) % alignof (S) == 0;
+    
+    if (matchingFormat && littleEndian && aligned)
+    {
+        view.data = reinterpret_cast<const S*> (mappedSamples);
+        view.numFrames = mappedNumFrames;
+        view.numChannels = mappedNumChannels;
+    }
+    
+    return view;
+}
+
+//=============================================================
+template <class T>
+std::shared_ptr<typename AudioFile<T>::MappedFile> AudioFile<T>::mapFile (const std::string& filePath)
+{
+    int fd = open (filePath.c_str(), O_RDONLY);
+    
+    if (fd < 0)
+        return nullptr;
+    
+    struct stat fileStatus;
+    
+    if (fstat (fd, &fileStatus) != 0 || fileStatus.st_size < 12)
+    {
+        close (fd);
+        return nullptr;
+    }
+    
+    void* address = mmap (NULL, fileStatus.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    
+    if (address == MAP_FAILED)
+        return nullptr;
+    
+    // samples are decoded front to back
+    madvise (address, fileStatus.st_size, MADV_SEQUENTIAL);
+    return std::make_shared<MappedFile> (address, (size_t) fileStatus.st_size);
+}
+
+//=============================================================
+template <class T>
+void AudioFile<T>::releaseMapping()
+{
+    mappedFile.reset();
+    mappedSamples = nullptr;
+    mappedNumFrames = 0;
+    mappedNumChannels = 0;
+    mappedAudioFormat = 0;
+    streamedFrame = 0;
+    releasedBytes = 0;
+    readAheadBytes = 0;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::readChannel (int channel, size_t offset, size_t count, T* dest)
+{
+    if (channel < 0 || channel >= getNumChannels() || offset + count > (size_t) getNumSamplesPerChannel())
+        return false;
+    
+    if (! isMapped())
+    {
+        std::copy (samples[channel].begin() + offset, samples[channel].begin() + offset + count, dest);
+        return true;
+    }
+    
+    decodeWaveChannel (channel, offset, count, dest);
+    
+    const size_t pageSize = (size_t) sysconf (_SC_PAGESIZE);
+    const size_t numBytesPerFrame = (bitDepth / 8) * mappedNumChannels;
+    size_t windowStart = (mappedSamples - mappedFile->data) + offset * numBytesPerFrame;
+    size_t windowEnd = windowStart + count * numBytesPerFrame;
+    size_t windowPage = windowStart / pageSize * pageSize;
+    
+    // seeking backwards restarts the read-ahead from the new window
+    if (offset < streamedFrame)
+    {
+        releasedBytes = std::min (releasedBytes, windowPage);
+        readAheadBytes = windowPage;
+    }
+    
+    streamedFrame = offset;
+    
+    // whole pages behind the window are not needed again
+    if (windowPage > releasedBytes)
+    {
+        madvise ((void*) (mappedFile->data + releasedBytes), windowPage - releasedBytes, MADV_DONTNEED);
+        releasedBytes = windowPage;
+    }
+    
+    // and one window ahead of it is fetched while this one is analysed
+    size_t aheadStart = std::max (windowEnd / pageSize * pageSize, readAheadBytes);
+    size_t aheadEnd = std::min ((windowEnd + count * numBytesPerFrame + pageSize - 1) / pageSize * pageSize, mappedFile->size);
+    
+    if (aheadEnd > aheadStart)
+    {
+        madvise ((void*) (mappedFile->data + aheadStart), aheadEnd - aheadStart, MADV_WILLNEED);
+        readAheadBytes = aheadEnd;
+    }
+    
+    return true;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::decodeWaveFile (std::shared_ptr<MappedFile> file)
+{
+    const uint8_t* fileData = file->data;
+    size_t fileSize = file->size;
+    
     // -----------------------------------------------------------
     // HEADER CHUNK
-    std::string headerChunkID (fileData.begin(), fileData.begin() + 4);
-    //int32_t fileSizeInBytes = fourBytesToInt (fileData, 4) + 8;
-    std::string format (fileData.begin() + 8, fileData.begin() + 12);
+    std::string headerChunkID ((const char*) fileData, 4);
+    //int32_t fileSizeInBytes = fourBytesToInt (fileData + 4) + 8;
+    std::string format ((const char*) fileData + 8, 4);
     
     // -----------------------------------------------------------
     // try and find the start points of key chunks
-    int indexOfDataChunk = getIndexOfChunk (fileData, "data", 12);
-    int indexOfFormatChunk = getIndexOfChunk (fileData, "fmt ", 12);
-    int indexOfXMLChunk = getIndexOfChunk (fileData, "iXML", 12);
+    long indexOfDataChunk = getIndexOfChunk (fileData, fileSize, "data", 12);
+    long indexOfFormatChunk = getIndexOfChunk (fileData, fileSize, "fmt ", 12);
+    long indexOfXMLChunk = getIndexOfChunk (fileData, fileSize, "iXML", 12);
     
     // if we can't find the data or format chunks, or the IDs/formats don't seem to be as expected
     // then it is unlikely we'll able to read this file, so abort
-    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || headerChunkID != "RIFF" || format != "WAVE")
+    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || headerChunkID != "RIFF" || format != "WAVE"
+        || (size_t) indexOfFormatChunk + 24 > fileSize)
     {
         reportError ("ERROR: this doesn't seem to be a valid .WAV file");
         return false;
@@ -494,15 +773,14 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
     
     // -----------------------------------------------------------
     // FORMAT CHUNK
-    int f = indexOfFormatChunk;
-    std::string formatChunkID (fileData.begin() + f, fileData.begin() + f + 4);
-    //int32_t formatChunkSize = fourBytesToInt (fileData, f + 4);
-    int16_t audioFormat = twoBytesToInt (fileData, f + 8);
-    int16_t numChannels = twoBytesToInt (fileData, f + 10);
-    sampleRate = (uint32_t) fourBytesToInt (fileData, f + 12);
-    int32_t numBytesPerSecond = fourBytesToInt (fileData, f + 16);
-    int16_t numBytesPerBlock = twoBytesToInt (fileData, f + 20);
-    bitDepth = (int) twoBytesToInt (fileData, f + 22);
+    const uint8_t* f = fileData + indexOfFormatChunk;
+    //int32_t formatChunkSize = fourBytesToInt (f + 4);
+    int16_t audioFormat = twoBytesToInt (f + 8);
+    int16_t numChannels = twoBytesToInt (f + 10);
+    sampleRate = (uint32_t) fourBytesToInt (f + 12);
+    int32_t numBytesPerSecond = fourBytesToInt (f + 16);
+    int16_t numBytesPerBlock = twoBytesToInt (f + 20);
+    bitDepth = (int) twoBytesToInt (f + 22);
     
     int numBytesPerSample = bitDepth / 8;
     
@@ -536,74 +814,104 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
     
     // -----------------------------------------------------------
     // DATA CHUNK
-    int d = indexOfDataChunk;
-    std::string dataChunkID (fileData.begin() + d, fileData.begin() + d + 4);
-    int32_t dataChunkSize = fourBytesToInt (fileData, d + 4);
+    size_t samplesStartIndex = indexOfDataChunk + 8;
+    size_t dataChunkSize = (uint32_t) fourBytesToInt (fileData + indexOfDataChunk + 4);
     
-    int numSamples = dataChunkSize / (numChannels * bitDepth / 8);
-    int samplesStartIndex = indexOfDataChunk + 8;
+    // never read past the mapping, even if the file was truncated while being written
+    if (dataChunkSize > fileSize - samplesStartIndex)
+        dataChunkSize = fileSize - samplesStartIndex;
     
     clearAudioBuffer();
     samples.resize (numChannels);
     
-    for (int i = 0; i < numSamples; i++)
-    {
-        for (int channel = 0; channel < numChannels; channel++)
-        {
-            int sampleIndex = samplesStartIndex + (numBytesPerBlock * i) + channel * numBytesPerSample;
-            
-            if (bitDepth == 8)
-            {
-                T sample = singleByteToSample (fileData[sampleIndex]);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex);
-                T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex + 2] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex];
-                
-                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
-
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt = fourBytesToInt (fileData, sampleIndex);
-                T sample;
-                
-                if (audioFormat == WavAudioFormat::IEEEFloat)
-                    sample = (T)reinterpret_cast<float&> (sampleAsInt);
-                else // assume PCM
-                    sample = (T) sampleAsInt / static_cast<float> (std::numeric_limits<std::int32_t>::max());
-                
-                samples[channel].push_back (sample);
-            }
-            else
-            {
-                assert (false);
-            }
-        }
-    }
+    mappedFile = file;
+    mappedSamples = fileData + samplesStartIndex;
+    mappedNumFrames = dataChunkSize / numBytesPerBlock;
+    mappedNumChannels = numChannels;
+    mappedAudioFormat = audioFormat;
 
     // -----------------------------------------------------------
     // iXML CHUNK
     if (indexOfXMLChunk != -1)
     {
-        int32_t chunkSize = fourBytesToInt (fileData, indexOfXMLChunk + 4);
-        iXMLChunk = std::string ((const char*) &fileData[indexOfXMLChunk + 8], chunkSize);
+        size_t chunkSize = (uint32_t) fourBytesToInt (fileData + indexOfXMLChunk + 4);
+        chunkSize = std::min (chunkSize, fileSize - (indexOfXMLChunk + 8));
+        iXMLChunk = std::string ((const char*) fileData + indexOfXMLChunk + 8, chunkSize);
     }
 
     return true;
 }
 
+//=============================================================
+template <class T>
+void AudioFile<T>::decodeWaveChannel (int channel, size_t firstFrame, size_t numFrames, T* dest) const
+{
+    const size_t numBytesPerSample = bitDepth / 8;
+    const size_t stride = numBytesPerSample * mappedNumChannels;
+    const uint8_t* source = mappedSamples + firstFrame * stride + channel * numBytesPerSample;
+    
+    // the byte assembly below compiles to plain loads, so with a compile time stride for
+    // mono files these loops vectorise
+    auto convert = [&] (auto sampleSize, auto decodeSample)
+    {
+        if (mappedNumChannels == 1)
+        {
+            for (size_t i = 0; i < numFrames; i++)
+                dest[i] = decodeSample (source + i * decltype (sampleSize)::value);
+        }
+        else
+        {
+            for (size_t i = 0; i < numFrames; i++)
+                dest[i] = decodeSample (source + i * stride);
+        }
+    };
+    
+    if (bitDepth == 8)
+    {
+        convert (std::integral_constant<size_t, 1>(), [] (const uint8_t* p)
+        {
+            return static_cast<T> (p[0] - 128) / static_cast<T> (128.);
+        });
+    }
+    else if (bitDepth == 16)
+    {
+        convert (std::integral_constant<size_t, 2>(), [] (const uint8_t* p)
+        {
+            return static_cast<T> (twoBytesToInt (p)) / static_cast<T> (32768.);
+        });
+    }
+    else if (bitDepth == 24)
+    {
+        // shifting the 24 bits to the top and back extends the sign
+        convert (std::integral_constant<size_t, 3>(), [] (const uint8_t* p)
+        {
+            int32_t sampleAsInt = (int32_t) (((uint32_t) p[2] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[0] << 8)) >> 8;
+            return (T)sampleAsInt / (T)8388608.;
+        });
+    }
+    else if (bitDepth == 32 && mappedAudioFormat == WavAudioFormat::IEEEFloat)
+    {
+        convert (std::integral_constant<size_t, 4>(), [] (const uint8_t* p)
+        {
+            int32_t sampleAsInt = fourBytesToInt (p);
+            float sample;
+            memcpy (&sample, &sampleAsInt, sizeof (float));
+            return (T)sample;
+        });
+    }
+    else if (bitDepth == 32)
+    {
+        convert (std::integral_constant<size_t, 4>(), [] (const uint8_t* p)
+        {
+            return (T) fourBytesToInt (p) / static_cast<float> (std::numeric_limits<std::int32_t>::max());
+        });
+    }
+    else
+    {
+        assert (false);
+    }
+}
+
 //=============================================================
 template <class T>
 bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
@@ -784,6 +1092,9 @@ void AudioFile<T>::addSampleRateToAiffData (std::vector<uint8_t>& fileData, uint
 template <class T>
 bool AudioFile<T>::save (std::string filePath, AudioFileFormat format)
 {
+    if (isMapped() && ! decodeMappedSamples())
+        return false;
+    
     if (format == AudioFileFormat::Wave)
     {
         return saveToWaveFile (filePath);
@@ -1108,9 +1419,12 @@ void AudioFile<T>::clearAudioBuffer()
 
 //=============================================================
 template <class T>
-AudioFileFormat AudioFile<T>::determineAudioFileFormat (std::vector<uint8_t>& fileData)
+AudioFileFormat AudioFile<T>::determineAudioFileFormat (const uint8_t* fileData, size_t fileSize)
 {
-    std::string header (fileData.begin(), fileData.begin() + 4);
+    if (fileSize < 4)
+        return AudioFileFormat::Error;
+    
+    std::string header ((const char*) fileData, 4);
     
     if (header == "RIFF")
         return AudioFileFormat::Wave;
@@ -1148,6 +1462,20 @@ int16_t AudioFile<T>::twoBytesToInt (std::vector<uint8_t>& source, int startInde
     return result;
 }
 
+//=============================================================
+template <class T>
+int32_t AudioFile<T>::fourBytesToInt (const uint8_t* source)
+{
+    return (int32_t) ((uint32_t) source[0] | ((uint32_t) source[1] << 8) | ((uint32_t) source[2] << 16) | ((uint32_t) source[3] << 24));
+}
+
+//=============================================================
+template <class T>
+int16_t AudioFile<T>::twoBytesToInt (const uint8_t* source)
+{
+    return (int16_t) (source[0] | (source[1] << 8));
+}
+
 //=============================================================
 template <class T>
 int AudioFile<T>::getIndexOfString (std::vector<uint8_t>& source, std::string stringToSearchFor)
@@ -1196,6 +1524,26 @@ int AudioFile<T>::getIndexOfChunk (std::vector<uint8_t>& source, const std::stri
     return -1;
 }
 
+//=============================================================
+template <class T>
+long AudioFile<T>::getIndexOfChunk (const uint8_t* source, size_t sourceSize, const char* chunkHeaderID, size_t startIndex)
+{
+    constexpr size_t dataLen = 4;
+    size_t i = startIndex;
+    
+    // walk the chunk headers in place, every chunk is an ID followed by its size
+    while (i + 2 * dataLen <= sourceSize)
+    {
+        if (memcmp (source + i, chunkHeaderID, dataLen) == 0)
+            return (long) i;
+        
+        size_t chunkSize = (uint32_t) fourBytesToInt (source + i + dataLen);
+        i += 2 * dataLen + chunkSize;
+    }
+    
+    return -1;
+}
+
 //=============================================================
 template <class T>
 T AudioFile<T>::sixteenBitIntToSample (int16_t sample)
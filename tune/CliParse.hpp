@@ -0,0 +1,104 @@
+#ifndef CLIPARSE_HPP
+#define CLIPARSE_HPP
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+
+// Arguments shared by the command line tools (tune, track, sweep, accuracy, movie).
+
+// "all" or a comma separated list of indices and inclusive ranges such as 0-47,100,
+// sorted and without duplicates. Indices from count on are dropped, so the result may
+// be empty; callers that need a selection check for that.
+inline std::vector<std::size_t> parseIndices(const std::string& spec, std::size_t count) {
+    std::vector<std::size_t> indices;
+    if(spec == "all") {
+        for(std::size_t i = 0; i < count; i++) {
+            indices.push_back(i);
+        }
+        return indices;
+    }
+    std::stringstream stream(spec);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        std::size_t dash = item.find('-');
+        std::size_t first = std::stoul(item.substr(0, dash));
+        std::size_t last = dash == std::string::npos ? first : std::stoul(item.substr(dash + 1));
+        for(std::size_t i = first; i <= last && i < count; i++) {
+            indices.push_back(i);
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    return indices;
+}
+
+// Comma separated values and start:stop:count ranges with both ends included
+inline std::vector<double> parseValues(const std::string& spec) {
+    std::vector<double> values;
+    std::stringstream stream(spec);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        std::size_t colon = item.find(':');
+        if(colon == std::string::npos) {
+            values.push_back(std::stod(item));
+            continue;
+        }
+        std::size_t second = item.find(':', colon + 1);
+        if(second == std::string::npos) {
+            throw std::runtime_error("range " + item + " needs start:stop:count");
+        }
+        double start = std::stod(item.substr(0, colon));
+        double stop = std::stod(item.substr(colon + 1, second - colon - 1));
+        std::size_t count = std::stoul(item.substr(second + 1));
+        for(std::size_t i = 0; i < count; i++) {
+            values.push_back(count == 1 ? start : start + (stop - start) * i / (count - 1));
+        }
+    }
+    return values;
+}
+
+// Name of file number index from an --output pattern such as scan_%02zu.h5. The pattern is
+// user input and never goes to printf as a whole: it must hold exactly one integer
+// conversion (flags, width and precision, any length modifier, then d, i, u, o, x or
+// X), which is formatted on its own. %% stands for a percent sign. Call it once with
+// index 0 to reject a bad pattern before any work is done.
+inline std::string outputName(const std::string& pattern, std::size_t index) {
+    auto invalid = [&]() {
+        return std::runtime_error("output pattern " + pattern + " needs exactly one integer conversion such as %02zu");
+    };
+    std::string name;
+    bool converted = false;
+    for(std::size_t i = 0; i < pattern.size(); i++) {
+        if(pattern[i] != '%') {
+            name += pattern[i];
+            continue;
+        }
+        if(i + 1 < pattern.size() && pattern[i + 1] == '%') {
+            name += '%';
+            i++;
+            continue;
+        }
+        std::size_t length = pattern.find_first_not_of("-+ #0123456789.", i + 1);
+        std::size_t conversion = length == std::string::npos ? length : pattern.find_first_not_of("hljztq", length);
+        if(converted || conversion == std::string::npos || std::string("diuoxX").find(pattern[conversion]) == std::string::npos) {
+            throw invalid();
+        }
+        // the length modifier is replaced by the one of the argument
+        std::string spec = pattern.substr(i, length - i) + "ll" + pattern[conversion];
+        char formatted[64];
+        snprintf(formatted, sizeof(formatted), spec.c_str(), (unsigned long long)index);
+        name += formatted;
+        converted = true;
+        i = conversion;
+    }
+    if(!converted) {
+        throw invalid();
+    }
+    return name;
+}
+
+#endif
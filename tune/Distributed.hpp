@@ -0,0 +1,132 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#include <mpi.h>
+
+// MPI helpers for spreading independent work units over ranks. Rank 0 is the master
+// and only hands out units: every other rank asks for the next unit when it is done
+// with the last one, so ranks that get small units simply ask more often. Results stay
+// with the ranks until the end and are then gathered to the master in one collective.
+namespace Distributed {
+
+    const int REQUEST = 1;
+    const int WORK = 2;
+
+    // MPI_Init and MPI_Finalize for the lifetime of the object
+    class Session {
+        public:
+            Session(int& argc, char**& argv) {
+                MPI_Init(&argc, &argv);
+                MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+                MPI_Comm_size(MPI_COMM_WORLD, &size);
+            }
+
+            ~Session() {
+                MPI_Finalize();
+            }
+
+            Session(const Session&) = delete;
+            Session& operator=(const Session&) = delete;
+
+            int getRank() const {
+                return rank;
+            }
+
+            int getSize() const {
+                return size;
+            }
+
+            bool isMaster() const {
+                return rank == 0;
+            }
+
+        private:
+            int rank = 0;
+            int size = 1;
+    };
+
+    // Master side of the queue: answers requests with the units in the given order,
+    // then with -1 until every worker has been told to stop
+    inline void serve(const std::vector<int64_t>& units, int workers) {
+        std::size_t next = 0;
+        int stopped = 0;
+        while(stopped < workers) {
+            MPI_Status status;
+            MPI_Recv(nullptr, 0, MPI_BYTE, MPI_ANY_SOURCE, REQUEST, MPI_COMM_WORLD, &status);
+            int64_t unit = next < units.size() ? units[next++] : -1;
+            if(unit < 0) {
+                stopped++;
+            }
+            MPI_Send(&unit, 1, MPI_INT64_T, status.MPI_SOURCE, WORK, MPI_COMM_WORLD);
+        }
+    }
+
+    // Worker side: the next unit, or -1 when there is none left
+    inline int64_t request() {
+        int64_t unit;
+        MPI_Send(nullptr, 0, MPI_BYTE, 0, REQUEST, MPI_COMM_WORLD);
+        MPI_Recv(&unit, 1, MPI_INT64_T, 0, WORK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        return unit;
+    }
+
+    // Concatenates the records of all ranks in rank order on the master, other ranks
+    // get an empty vector. Records are sent as raw bytes with counts in records, so a
+    // rank can hold up to 2^31 of them.
+    template<class T>
+    std::vector<T> gather(const std::vector<T>& local) {
+        static_assert(std::is_trivially_copyable<T>::value, "gathered records must be trivially copyable");
+        int rank, size;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &size);
+        if(local.size() > INT32_MAX) {
+            throw std::runtime_error("Too many records to gather from one rank");
+        }
+
+        int count = (int)local.size();
+        std::vector<int> counts(size), offsets(size);
+        MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+        std::size_t total = 0;
+        for(int r = 0; r < size; r++) {
+            if(total > INT32_MAX) {
+                throw std::runtime_error("Too many records to gather");
+            }
+            offsets[r] = (int)total;
+            total += counts[r];
+        }
+
+        MPI_Datatype record;
+        MPI_Type_contiguous(sizeof(T), MPI_BYTE, &record);
+        MPI_Type_commit(&record);
+        std::vector<T> all(rank == 0 ? total : 0);
+        MPI_Gatherv(local.data(), count, record, all.data(), counts.data(), offsets.data(), record, 0, MPI_COMM_WORLD);
+        MPI_Type_free(&record);
+        return all;
+    }
+
+    // True on all ranks if ok is true on all ranks
+    inline bool agree(bool ok) {
+        int mine = ok, all;
+        MPI_Allreduce(&mine, &all, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+        return all != 0;
+    }
+
+    // Element wise sum or maximum of the values of all ranks, on the master
+    inline void sum(std::vector<uint64_t>& values) {
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : values.data(), values.data(), values.size(), MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
+
+    inline void maximum(std::vector<uint8_t>& values) {
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : values.data(), values.data(), values.size(), MPI_UINT8_T, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+}
+
+#endif
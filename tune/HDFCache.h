@@ -0,0 +1,289 @@
+#ifndef INCLUDE_HDFCACHE_H_
+
+#define INCLUDE_HDFCACHE_H_
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <sstream>
+#include <type_traits>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HDFLib.h"
+
+namespace HDFLib {
+
+//Sidecar cache of a decoded ADTObsBox file, stored bunch-major so that every
+//bunch is one contiguous column of turns that can be handed out straight from
+//the mapping. The cache is keyed by the absolute source path, its size and its
+//modification time and is rebuilt whenever any of them changes.
+template<class T>
+class BunchCache {
+	static_assert(std::is_same<T, int16_t>::value || std::is_same<T, float>::value,
+			"BunchCache only stores int16_t or float");
+public:
+	BunchCache(const std::string& filename, const std::string& cacheDir = "") {
+		_source = std::filesystem::absolute(filename).lexically_normal().string();
+		std::filesystem::path dir = cacheDir.empty() ? std::filesystem::path(_source).parent_path() : std::filesystem::path(cacheDir);
+		std::ostringstream name;
+		name << std::filesystem::path(_source).filename().string() << "." << std::hex << _hashPath(_source) << (std::is_same<T, float>::value ? ".f32" : ".i16") << ".bmc";
+		_filename = (dir / name.str()).string();
+	}
+
+	~BunchCache() {
+		close();
+	}
+
+	BunchCache(const BunchCache&) = delete;
+	BunchCache& operator=(const BunchCache&) = delete;
+
+	//maps the cache if it exists and matches the source, returns false if it has to be built
+	bool open() {
+		close();
+		struct stat source;
+		if (stat(_source.c_str(), &source) != 0) {
+			std::ostringstream temp;
+			temp << "source file " << _source << " does not exist";
+			throw std::runtime_error(temp.str());
+		}
+		int fd = ::open(_filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat cache;
+		if (fstat(fd, &cache) != 0 || static_cast<std::size_t>(cache.st_size) < sizeof(Header)) {
+			::close(fd);
+			return false;
+		}
+		void* ptr = mmap(NULL, cache.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (ptr == MAP_FAILED) {
+			return false;
+		}
+		const Header* header = reinterpret_cast<const Header*>(ptr);
+		const char* path = reinterpret_cast<const char*>(ptr) + sizeof(Header);
+		bool valid = std::memcmp(header->magic, MAGIC, sizeof(header->magic)) == 0 &&
+			header->version == VERSION &&
+			header->elementSize == sizeof(T) &&
+			header->sourceSize == static_cast<uint64_t>(source.st_size) &&
+			header->sourceMtime == _mtime(source) &&
+			sizeof(Header) + header->pathLength <= header->dataOffset &&
+			header->dataOffset + header->turns * header->bunches * sizeof(T) == static_cast<uint64_t>(cache.st_size) &&
+			_source.compare(0, std::string::npos, path, header->pathLength) == 0;
+		if (!valid) {
+			munmap(ptr, cache.st_size);
+			return false;
+		}
+		_map = ptr;
+		_mapSize = cache.st_size;
+		_turns = header->turns;
+		_bunches = header->bunches;
+		// the fields are only NUL terminated when shorter than their width
+		_plane = std::string(header->plane, strnlen(header->plane, sizeof(header->plane)));
+		_beam = std::string(header->beam, strnlen(header->beam, sizeof(header->beam)));
+		_data = reinterpret_cast<const T*>(reinterpret_cast<const char*>(ptr) + header->dataOffset);
+		madvise(_map, _mapSize, MADV_WILLNEED);
+		return true;
+	}
+
+	//decodes the source once through HDFFile and writes the sidecar next to it
+	void build() {
+		close();
+		struct stat source;
+		if (stat(_source.c_str(), &source) != 0) {
+			std::ostringstream temp;
+			temp << "source file " << _source << " does not exist";
+			throw std::runtime_error(temp.str());
+		}
+
+		HDFFile file(_source);
+		file.open();
+		std::size_t turns = file.getRows();
+		std::size_t bunches = file.getColumns();
+
+		Header header;
+		std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+		header.version = VERSION;
+		header.elementSize = sizeof(T);
+		header.sourceSize = source.st_size;
+		header.sourceMtime = _mtime(source);
+		header.turns = turns;
+		header.bunches = bunches;
+		header.pathLength = _source.size();
+		header.dataOffset = _alignUp(sizeof(Header) + _source.size(), PAGE);
+		std::strncpy(header.plane, file.getPlane().c_str(), sizeof(header.plane) - 1);
+		std::strncpy(header.beam, file.getBeam().c_str(), sizeof(header.beam) - 1);
+		std::size_t size = header.dataOffset + turns * bunches * sizeof(T);
+
+		//write to a temporary and rename so readers never see a half written cache
+		std::string tempname = _filename + ".tmp" + std::to_string(getpid());
+		int fd = ::open(tempname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			std::ostringstream temp;
+			temp << "creation of cache file " << tempname << " failed";
+			throw std::runtime_error(temp.str());
+		}
+		if (ftruncate(fd, size) != 0) {
+			::close(fd);
+			unlink(tempname.c_str());
+			std::ostringstream temp;
+			temp << "Allocating " << size << " bytes for cache file " << tempname << " failed";
+			throw std::runtime_error(temp.str());
+		}
+		void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (ptr == MAP_FAILED) {
+			unlink(tempname.c_str());
+			throw std::runtime_error("Mapping cache file for writing failed");
+		}
+
+		char* base = reinterpret_cast<char*>(ptr);
+		std::memcpy(base, &header, sizeof(Header));
+		std::memcpy(base + sizeof(Header), _source.data(), _source.size());
+		T* data = reinterpret_cast<T*>(base + header.dataOffset);
+		try {
+			//columns follow the chunk layout of the file so every chunk is decoded exactly once
+			for (std::size_t bunch = 0; bunch < bunches; bunch++) {
+				std::unique_ptr<int16_t> column = file.getColumnData(bunch);
+				T* out = data + bunch * turns;
+				for (std::size_t turn = 0; turn < turns; turn++) {
+					out[turn] = static_cast<T>(column.get()[turn]);
+				}
+			}
+		}
+		catch (...) {
+			munmap(ptr, size);
+			unlink(tempname.c_str());
+			throw;
+		}
+		msync(ptr, size, MS_SYNC);
+		munmap(ptr, size);
+		file.close();
+
+		if (rename(tempname.c_str(), _filename.c_str()) != 0) {
+			unlink(tempname.c_str());
+			std::ostringstream temp;
+			temp << "Renaming cache file to " << _filename << " failed";
+			throw std::runtime_error(temp.str());
+		}
+		if (!open()) {
+			throw std::runtime_error("Cache file invalid directly after building it");
+		}
+	}
+
+	//opens the cache, building it first if it is missing or stale
+	void openOrBuild() {
+		if (!open()) {
+			build();
+		}
+	}
+
+	void close() {
+		if (_map != NULL) {
+			munmap(_map, _mapSize);
+		}
+		_map = NULL;
+		_data = NULL;
+		_mapSize = 0;
+	}
+
+	bool isOpen() const {
+		return _map != NULL;
+	}
+
+	//zero copy view of all turns of one bunch
+	const T* getBunch(std::size_t bunch) const {
+		if (!isOpen()) {
+			throw std::runtime_error("Cache not open while trying to read bunch");
+		}
+		if (bunch >= _bunches) {
+			throw std::runtime_error("Bunch index out of range");
+		}
+		return _data + bunch * _turns;
+	}
+
+	const T* operator[](std::size_t bunch) const {
+		return getBunch(bunch);
+	}
+
+	std::size_t getTurns() const {
+		return _turns;
+	}
+
+	std::size_t getBunches() const {
+		return _bunches;
+	}
+
+	std::string getPlane() const {
+		return _plane;
+	}
+
+	std::string getBeam() const {
+		return _beam;
+	}
+
+	std::string getCacheFilename() const {
+		return _filename;
+	}
+
+	std::string getSourceFilename() const {
+		return _source;
+	}
+
+private:
+	static constexpr char MAGIC[8] = { 'A', 'D', 'T', 'B', 'M', 'C', 0, 0 };
+	static constexpr uint32_t VERSION = 1;
+	static constexpr std::size_t PAGE = 4096;
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t elementSize;
+		uint64_t sourceSize;
+		int64_t sourceMtime;
+		uint64_t turns;
+		uint64_t bunches;
+		uint64_t pathLength;
+		uint64_t dataOffset;
+		char plane[16] = {};
+		char beam[8] = {};
+	};
+
+	static int64_t _mtime(const struct stat& st) {
+		return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+	}
+
+	static std::size_t _alignUp(std::size_t value, std::size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	//FNV-1a, only used to keep sidecars of equally named files apart
+	static uint64_t _hashPath(const std::string& path) {
+		uint64_t hash = 14695981039346656037ull;
+		for (unsigned char c : path) {
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	std::string _source;
+	std::string _filename;
+	std::string _plane;
+	std::string _beam;
+	void* _map = NULL;
+	std::size_t _mapSize = 0;
+	const T* _data = NULL;
+	std::size_t _turns = 0;
+	std::size_t _bunches = 0;
+};
+
+}
+
+#endif
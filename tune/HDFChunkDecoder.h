@@ -0,0 +1,203 @@
+#ifndef INCLUDE_HDFCHUNKDECODER_H_
+
+#define INCLUDE_HDFCHUNKDECODER_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <sstream>
+
+#include <zlib.h>
+
+#include "hdf5.h"
+
+namespace HDFLib {
+
+//Decoders for the filters HDFFile datasets are written with, so that raw chunks
+//fetched with H5Dread_chunk can be decoded outside of the HDF5 library. The
+//byte layouts mirror H5Zscaleoffset.c, H5Zshuffle.c and H5Zdeflate.c.
+
+//scale-offset parameters stored in the dataset creation property list by set_local
+struct ScaleOffsetParams {
+	std::size_t nelmts = 0;
+	bool fillDefined = false;
+	int16_t fill = 0;
+};
+
+struct ChunkFilter {
+	H5Z_filter_t id;
+	ScaleOffsetParams scaleOffset;
+};
+
+//filter pipeline of a dataset, supported is false if any filter can not be decoded here
+struct ChunkPipeline {
+	std::vector<ChunkFilter> filters;
+	bool supported = true;
+};
+
+inline ChunkPipeline readChunkPipeline(hid_t plist_id) {
+	ChunkPipeline pipeline;
+	int nfilters = H5Pget_nfilters(plist_id);
+	if (nfilters < 0) {
+		throw std::runtime_error("Getting number of filters failed");
+	}
+	for (int i = 0; i < nfilters; i++) {
+		unsigned int flags;
+		std::size_t cd_nelmts = 32;
+		unsigned int cd_values[32];
+		unsigned int filter_config;
+		char name[256];
+		H5Z_filter_t id = H5Pget_filter2(plist_id, i, &flags, &cd_nelmts, cd_values, sizeof(name), name, &filter_config);
+		if (id < 0) {
+			std::ostringstream temp;
+			temp << "Getting filter " << i << " failed";
+			throw std::runtime_error(temp.str());
+		}
+		ChunkFilter filter;
+		filter.id = id;
+		if (id == H5Z_FILTER_SCALEOFFSET) {
+			//only the integer, 2 byte, little endian variant is written by HDFFile
+			if (cd_nelmts < 9 || cd_values[3] != 0 || cd_values[4] != sizeof(int16_t) || cd_values[6] != 0) {
+				pipeline.supported = false;
+			}
+			else {
+				filter.scaleOffset.nelmts = cd_values[2];
+				filter.scaleOffset.fillDefined = cd_values[7] == 1;
+				filter.scaleOffset.fill = static_cast<int16_t>(cd_values[8] & 0xffff);
+			}
+		}
+		else if (id != H5Z_FILTER_SHUFFLE && id != H5Z_FILTER_DEFLATE) {
+			pipeline.supported = false;
+		}
+		pipeline.filters.push_back(filter);
+	}
+	return pipeline;
+}
+
+inline void decodeScaleOffset(const uint8_t* in, std::size_t size, const ScaleOffsetParams& params, std::vector<uint8_t>& output) {
+	const std::size_t headerSize = 21;
+	if (size < headerSize) {
+		throw std::runtime_error("Scale-offset chunk smaller than its header");
+	}
+	uint32_t minbits = 0;
+	for (unsigned i = 0; i < 4; i++) {
+		minbits |= static_cast<uint32_t>(in[i]) << (i * 8);
+	}
+	unsigned minvalSize = in[4] < sizeof(uint64_t) ? in[4] : sizeof(uint64_t);
+	uint64_t minval = 0;
+	for (unsigned i = 0; i < minvalSize; i++) {
+		minval |= static_cast<uint64_t>(in[5 + i]) << (i * 8);
+	}
+
+	std::size_t nelmts = params.nelmts;
+	output.resize(nelmts * sizeof(int16_t));
+	int16_t* out = reinterpret_cast<int16_t*>(output.data());
+	const uint8_t* packed = in + headerSize;
+	std::size_t packedSize = size - headerSize;
+
+	//full precision chunks are stored verbatim and not offset
+	if (minbits == 8 * sizeof(int16_t)) {
+		if (packedSize < nelmts * sizeof(int16_t)) {
+			throw std::runtime_error("Scale-offset chunk truncated");
+		}
+		std::memcpy(out, packed, nelmts * sizeof(int16_t));
+		return;
+	}
+	if (minbits > 8 * sizeof(int16_t)) {
+		throw std::runtime_error("Invalid minbits in scale-offset chunk");
+	}
+	if (packedSize < (nelmts * minbits + 7) / 8) {
+		throw std::runtime_error("Scale-offset chunk truncated");
+	}
+
+	const uint16_t fillCode = static_cast<uint16_t>((1u << minbits) - 1);
+	const uint16_t offset = static_cast<uint16_t>(minval);
+	//the codes form one big endian bit stream, minbits per element
+	uint64_t acc = 0;
+	unsigned bits = 0;
+	for (std::size_t i = 0; i < nelmts; i++) {
+		while (bits < minbits) {
+			acc = (acc << 8) | *packed++;
+			bits += 8;
+		}
+		bits -= minbits;
+		uint16_t code = static_cast<uint16_t>((acc >> bits) & fillCode);
+		if (params.fillDefined && code == fillCode) {
+			out[i] = params.fill;
+		}
+		else {
+			out[i] = static_cast<int16_t>(static_cast<uint16_t>(code + offset));
+		}
+	}
+}
+
+inline void decodeShuffle(const uint8_t* in, std::size_t size, std::size_t elementSize, std::vector<uint8_t>& output) {
+	output.resize(size);
+	std::size_t n = size / elementSize;
+	for (std::size_t b = 0; b < elementSize; b++) {
+		const uint8_t* src = in + b * n;
+		for (std::size_t i = 0; i < n; i++) {
+			output[i * elementSize + b] = src[i];
+		}
+	}
+	//trailing bytes that do not make up a full element are not shuffled
+	std::memcpy(output.data() + n * elementSize, in + n * elementSize, size - n * elementSize);
+}
+
+inline void decodeDeflate(const uint8_t* in, std::size_t size, std::size_t expected, std::vector<uint8_t>& output) {
+	z_stream stream;
+	std::memset(&stream, 0, sizeof(stream));
+	if (inflateInit(&stream) != Z_OK) {
+		throw std::runtime_error("inflateInit failed");
+	}
+	output.resize(expected > 0 ? expected : size * 2);
+	stream.next_in = const_cast<Bytef*>(in);
+	stream.avail_in = size;
+	int status;
+	do {
+		if (stream.total_out == output.size()) {
+			output.resize(output.size() * 2);
+		}
+		stream.next_out = output.data() + stream.total_out;
+		stream.avail_out = output.size() - stream.total_out;
+		status = inflate(&stream, Z_NO_FLUSH);
+	} while (status == Z_OK);
+	output.resize(stream.total_out);
+	inflateEnd(&stream);
+	if (status != Z_STREAM_END) {
+		throw std::runtime_error("Inflating chunk failed");
+	}
+}
+
+//runs the pipeline backwards over one raw chunk, filters flagged in filterMask were skipped when it was written
+inline void decodeChunk(const ChunkPipeline& pipeline, uint32_t filterMask, std::vector<uint8_t>& chunk, std::vector<uint8_t>& scratch, std::size_t chunkBytes) {
+	for (std::size_t i = pipeline.filters.size(); i-- > 0;) {
+		if (filterMask & (1u << i)) {
+			continue;
+		}
+		const ChunkFilter& filter = pipeline.filters[i];
+		switch (filter.id) {
+		case H5Z_FILTER_SCALEOFFSET:
+			decodeScaleOffset(chunk.data(), chunk.size(), filter.scaleOffset, scratch);
+			break;
+		case H5Z_FILTER_SHUFFLE:
+			decodeShuffle(chunk.data(), chunk.size(), sizeof(int16_t), scratch);
+			break;
+		case H5Z_FILTER_DEFLATE:
+			decodeDeflate(chunk.data(), chunk.size(), i == 0 ? chunkBytes : 0, scratch);
+			break;
+		default:
+			throw std::runtime_error("Unsupported filter in chunk pipeline");
+		}
+		chunk.swap(scratch);
+	}
+	if (chunk.size() != chunkBytes) {
+		throw std::runtime_error("Decoded chunk has the wrong size");
+	}
+}
+
+}
+
+#endif
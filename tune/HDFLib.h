@@ -11,9 +11,18 @@
 #include <filesystem>
 #include <tuple>
 #include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <algorithm>
 
 
 #include "hdf5.h"
+#include "HDFChunkDecoder.h"
+#include "HDFStats.h"
 
 namespace HDFLib {
 
@@ -36,8 +45,14 @@ public:
 		_exists = std::filesystem::exists( _filename );
 	}
 
+	//errors of an explicit close() go to the caller, a destructor can only report them
 	~HDFFile() {
-		close();
+		try {
+			close();
+		}
+		catch (const std::exception& e) {
+			std::cerr << "HDFFile: closing " << _filename << " failed: " << e.what() << std::endl;
+		}
 	}
 
 	void open(int flags=0) {
@@ -78,22 +93,61 @@ public:
 
 	}
 
+	//MB/s of raw data over all writes since the file was opened
 	float getWriteSpeed(){
-		if(_time_to_write_data==0){
-			return 0.0f;
-		}
-		else{
+		_waitForFlush();
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		return static_cast<float>(_stats.writeSpeed());
+	}
+
+	float getReadSpeed(){
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		return static_cast<float>(_stats.readSpeed());
+	}
 
-			float megabytes=static_cast<float>( _turns*_bunches*sizeof(int16_t))/1000000.0f;
-			float time_in_s=static_cast<float>(_time_to_write_data)/1000000000.0f;
-			return megabytes/time_in_s;
+	HDFStats getStats(){
+		_waitForFlush();
+		HDFStats stats;
+		{
+			std::lock_guard<std::mutex> lock(_stats_mutex);
+			stats = _stats;
+		}
+		if (_open) {
+			stats.storageBytes = H5Dget_storage_size(_dataset_id);
+			stats.compressionRatio = getCompressionRatio();
 		}
+		return stats;
+	}
+
+	std::string getStatsJSON(){
+		return getStats().toJSON();
+	}
+
+	void resetStats(){
+		_waitForFlush();
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats = HDFStats();
+		_chunk_cache_model.clear();
 	}
 
 	void close() {
 		if (!_open) {
 			return;
 		}
+		//the handles are released even when the last rows could not be written
+		std::exception_ptr streamError;
+		if (_streaming && !_exists) {
+			try {
+				_closeStream();
+			}
+			catch (...) {
+				streamError = std::current_exception();
+				if (_stream_memspace_id >= 0) {
+					H5Sclose(_stream_memspace_id);
+					_stream_memspace_id = -1;
+				}
+			}
+		}
 		//close all attributes
 		for (auto it : _attributes) {
 			if (getAttribute(it.second) < 0) {
@@ -178,6 +232,9 @@ public:
 		}
 		H5garbage_collect();
 		_open = false;
+		if (streamError) {
+			std::rethrow_exception(streamError);
+		}
 	}
 
 	void setPlane(const std::string& plane) {
@@ -241,7 +298,14 @@ public:
 	}
 
 	void setCompressionChunks(const std::size_t& chunkSize){
-		if(chunkSize>_turns){
+		if(_open){
+			throw std::runtime_error("Can't change compression chunks on a open file");
+		}
+		//a streamed file has no length yet, the chunk size is also the write batch
+		if(_streaming){
+			_cdims[0] = chunkSize;
+		}
+		else if(chunkSize>_turns){
 			_cdims[0]=_turns;
 		}
 		else{
@@ -253,6 +317,74 @@ public:
 		return _cdims[0];
 	}
 
+	//Streaming mode creates the turn dimension unlimited and appends turns with
+	//appendRowData. Turns are batched into one chunk row before they are written,
+	//the file is switched to SWMR writing so whatever was flushed stays readable
+	//if the writer dies. Attribute datasets are sized per turn and not written.
+	void setStreaming(bool enabled){
+		if(_exists){
+			throw std::runtime_error("Can't stream into a existing file");
+		}
+		if(_open){
+			throw std::runtime_error("Can't change streaming on a open file");
+		}
+		_streaming=enabled;
+		if(_streaming){
+			_attributes_enabled=false;
+		}
+	}
+
+	bool getStreaming(){
+		return _streaming;
+	}
+
+	//write full chunk rows on a background thread while the next one is filled
+	void setAsyncFlush(bool enabled){
+		if(_open){
+			throw std::runtime_error("Can't change asyncFlush on a open file");
+		}
+		_async_flush=enabled;
+	}
+
+	void appendRowData(const int16_t* rowdata) {
+		appendRows(rowdata, 1);
+	}
+
+	//appends count turns of _bunches values each
+	void appendRows(const int16_t* rows, std::size_t count) {
+		if (!_open || !_streaming || _exists) {
+			throw std::runtime_error("File not open for streaming while trying to append rows");
+		}
+		while (count > 0) {
+			std::size_t n = std::min<std::size_t>(count, _cdims[0] - _buffered_turns);
+			std::memcpy(_stream_buffer.data() + _buffered_turns * _bunches, rows, n * _bunches * sizeof(int16_t));
+			_buffered_turns += n;
+			rows += n * _bunches;
+			count -= n;
+			if (_buffered_turns == _cdims[0]) {
+				_flushStreamBuffer();
+			}
+		}
+	}
+
+	//writes buffered turns now, a partial chunk row is rewritten when it fills up
+	void flush() {
+		if (!_open || !_streaming || _exists) {
+			return;
+		}
+		if (_buffered_turns > 0) {
+			_flushStreamBuffer();
+		}
+		_waitForFlush();
+		H5Fflush(_file_id, H5F_SCOPE_GLOBAL);
+	}
+
+	//turns written to the file so far, excluding turns still in the buffer
+	std::size_t getStreamedTurns(){
+		_waitForFlush();
+		return _streamed_turns;
+	}
+
 	void setBunches(const std::size_t& bunches) {
 		if (_exists) {
 			throw std::runtime_error("Can't change bunches on a existing file");
@@ -292,7 +424,7 @@ public:
 			temp << "Allocating " << size << " bytes for data failed";
 			throw std::runtime_error(temp.str());
 		}
-		_status = H5Dread(_dataset_id, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, temp_ptr);
+		_status = _readData(H5S_ALL, H5S_ALL, temp_ptr, 0, _turns, 0, _bunches);
 		if (_status < 0)
 		{
 			free(temp_ptr);
@@ -303,15 +435,180 @@ public:
 		return std::unique_ptr<int16_t>(reinterpret_cast<int16_t*> (temp_ptr) );
 	}
 
+	//same layout as getData, but chunks are fetched raw with H5Dread_chunk and
+	//decoded on threads instead of inside the single threaded filter pipeline
+	std::unique_ptr<int16_t> getDataParallel(unsigned threads = 0) {
+		return getBlockParallel(0, _turns, 0, _bunches, threads);
+	}
+
+	//turns x bunches block starting at (turn, bunch), row major like getData
+	std::unique_ptr<int16_t> getBlockParallel(std::size_t turn, std::size_t turns, std::size_t bunch, std::size_t bunches, unsigned threads = 0) {
+		_checkBlock(turn, turns, bunch, bunches);
+		hsize_t cdims[2];
+		ChunkPipeline pipeline;
+		if (!_parallelReadable(cdims, pipeline)) {
+			//unknown layout or filter, let the library decode it
+			if (turn == 0 && turns == _turns && bunch == 0 && bunches == _bunches) {
+				return getData();
+			}
+			return _getStride(turns, bunches, turn, bunch);
+		}
+
+		int16_t* temp_ptr = reinterpret_cast<int16_t*>(malloc(turns * bunches * sizeof(int16_t)));
+		if (temp_ptr == NULL) {
+			throw std::runtime_error("Allocating memory in getBlockParallel failed");
+		}
+		std::unique_ptr<int16_t> data(temp_ptr);
+		_readChunks(cdims, pipeline, turn, turns, bunch, bunches, temp_ptr, threads);
+		return data;
+	}
+
+	//same as getBlockParallel into memory of the caller, e.g. memory placed on the
+	//NUMA node of the threads that use the block
+	void readBlockParallel(std::size_t turn, std::size_t turns, std::size_t bunch, std::size_t bunches, int16_t* out, unsigned threads = 0) {
+		_checkBlock(turn, turns, bunch, bunches);
+		hsize_t cdims[2];
+		ChunkPipeline pipeline;
+		if (!_parallelReadable(cdims, pipeline)) {
+			std::unique_ptr<int16_t> block = _getStride(turns, bunches, turn, bunch);
+			std::copy_n(block.get(), turns * bunches, out);
+			return;
+		}
+		_readChunks(cdims, pipeline, turn, turns, bunch, bunches, out, threads);
+	}
+
+private:
+	void _checkBlock(std::size_t turn, std::size_t turns, std::size_t bunch, std::size_t bunches) {
+		if (!_open) {
+			throw std::runtime_error("File not open while trying to read data");
+		}
+		if (turn + turns > _turns || bunch + bunches > _bunches) {
+			throw std::runtime_error("Block out of range in getBlockParallel");
+		}
+	}
+
+	//chunked with filters decodeChunk knows
+	bool _parallelReadable(hsize_t* cdims, ChunkPipeline& pipeline) {
+		bool chunked = H5Pget_layout(_plist_id) == H5D_CHUNKED && H5Pget_chunk(_plist_id, 2, cdims) == 2;
+		if (chunked) {
+			pipeline = readChunkPipeline(_plist_id);
+		}
+		return chunked && pipeline.supported;
+	}
+
+	//fetches the raw chunks overlapping the block and decodes them on threads into temp_ptr
+	void _readChunks(const hsize_t* cdims, const ChunkPipeline& pipeline, std::size_t turn, std::size_t turns,
+			std::size_t bunch, std::size_t bunches, int16_t* temp_ptr, unsigned threads) {
+		hsize_t firstChunk[2] = { turn / cdims[0], bunch / cdims[1] };
+		hsize_t chunkCount[2] = { (turn + turns + cdims[0] - 1) / cdims[0] - firstChunk[0], (bunch + bunches + cdims[1] - 1) / cdims[1] - firstChunk[1] };
+		std::size_t nchunks = chunkCount[0] * chunkCount[1];
+		std::size_t chunkBytes = cdims[0] * cdims[1] * sizeof(int16_t);
+		int16_t fill = 0;
+		if (H5Pget_fill_value(_plist_id, H5T_NATIVE_SHORT, &fill) < 0) {
+			throw std::runtime_error("Getting fill value failed");
+		}
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		threads = std::min<std::size_t>(threads, nchunks);
+
+		std::atomic<std::size_t> next(0);
+		std::mutex hdfMutex;
+		std::exception_ptr error;
+		std::mutex errorMutex;
+		auto worker = [&]() {
+			std::vector<uint8_t> chunk, scratch;
+			try {
+				for (std::size_t i = next++; i < nchunks; i = next++) {
+					hsize_t offset[2] = { (firstChunk[0] + i / chunkCount[1]) * cdims[0], (firstChunk[1] + i % chunkCount[1]) * cdims[1] };
+					uint32_t filterMask = 0;
+					hsize_t storageSize = 0;
+					bool allocated;
+					{
+						//the library is only ever entered by one thread at a time
+						std::lock_guard<std::mutex> lock(hdfMutex);
+						//fails for chunks that were never written, H5Dget_chunk_info_by_coord
+						//would tell them apart but walks the whole chunk index on every call
+						H5E_BEGIN_TRY {
+							allocated = H5Dget_chunk_storage_size(_dataset_id, offset, &storageSize) >= 0 && storageSize > 0;
+						} H5E_END_TRY;
+						if (!allocated) {
+							//the error stack is per thread in threadsafe builds, records left on it when
+							//the worker exits keep their ids alive and the library can not close at exit
+							H5Eclear2(H5E_DEFAULT);
+						}
+						if (allocated) {
+							chunk.resize(storageSize);
+							std::size_t start_time=getCurrentTime();
+							herr_t status = H5Dread_chunk(_dataset_id, H5P_DEFAULT, offset, &filterMask, chunk.data());
+							std::lock_guard<std::mutex> statsLock(_stats_mutex);
+							_stats.readTime += getCurrentTime()-start_time;
+							if (status < 0) {
+								throw std::runtime_error("Reading raw chunk failed");
+							}
+							_stats.rawChunkReads++;
+							_stats.storageBytesRead += storageSize;
+						}
+					}
+					if (!allocated) {
+						//never written, read back as the fill value
+						chunk.resize(chunkBytes);
+						std::fill_n(reinterpret_cast<int16_t*>(chunk.data()), chunkBytes / sizeof(int16_t), fill);
+					}
+					else {
+						decodeChunk(pipeline, filterMask, chunk, scratch, chunkBytes);
+					}
+
+					const int16_t* src = reinterpret_cast<const int16_t*>(chunk.data());
+					std::size_t t0 = std::max<std::size_t>(offset[0], turn);
+					std::size_t t1 = std::min<std::size_t>(offset[0] + cdims[0], turn + turns);
+					std::size_t b0 = std::max<std::size_t>(offset[1], bunch);
+					std::size_t b1 = std::min<std::size_t>(offset[1] + cdims[1], bunch + bunches);
+					for (std::size_t t = t0; t < t1; t++) {
+						const int16_t* row = src + (t - offset[0]) * cdims[1] - offset[1];
+						int16_t* out = temp_ptr + (t - turn) * bunches - bunch;
+						for (std::size_t b = b0; b < b1; b++) {
+							out[b] = row[b];
+						}
+					}
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+				next = nchunks;
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (unsigned i = 1; i < threads; i++) {
+			workers.emplace_back(worker);
+		}
+		worker();
+		for (auto& w : workers) {
+			w.join();
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.rawBytesRead += turns * bunches * sizeof(int16_t);
+	}
+
+public:
+
 
 
 	bool setData(const int16_t* data) {
 		if (!_open) {
 			throw std::runtime_error("File not open while trying to read data");
 		}
-		std::size_t start_time=getCurrentTime();
-		_status = H5Dwrite(_dataset_id, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
-		_time_to_write_data=getCurrentTime()-start_time;
+		if (_streaming) {
+			throw std::runtime_error("setData is not available in streaming mode, use appendRows");
+		}
+		_status = _writeData(H5S_ALL, H5S_ALL, data, 0, _turns, 0, _bunches);
 		if (_status < 0)
 		{
 			std::ostringstream temp;
@@ -991,6 +1288,72 @@ private:
 		return nanoseconds.count();
 	}
 
+	//all reads and writes of the data set go through these to keep _stats current.
+	//offset/extent describe the touched block, elements how many values are transferred
+	herr_t _readData(hid_t memspace, hid_t filespace, void* buf, hsize_t offset0, hsize_t extent0, hsize_t offset1, hsize_t extent1, hsize_t elements = 0) {
+		_modelChunkAccess(offset0, extent0, offset1, extent1, true);
+		std::size_t start_time=getCurrentTime();
+		herr_t status = H5Dread(_dataset_id, H5T_NATIVE_SHORT, memspace, filespace, H5P_DEFAULT, buf);
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.readTime += getCurrentTime()-start_time;
+		_stats.readCalls++;
+		if (status >= 0) {
+			_stats.rawBytesRead += (elements > 0 ? elements : extent0 * extent1) * sizeof(int16_t);
+		}
+		return status;
+	}
+
+	herr_t _writeData(hid_t memspace, hid_t filespace, const void* buf, hsize_t offset0, hsize_t extent0, hsize_t offset1, hsize_t extent1, hsize_t elements = 0) {
+		_modelChunkAccess(offset0, extent0, offset1, extent1, false);
+		std::size_t start_time=getCurrentTime();
+		herr_t status = H5Dwrite(_dataset_id, H5T_NATIVE_SHORT, memspace, filespace, H5P_DEFAULT, buf);
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.writeTime += getCurrentTime()-start_time;
+		_stats.writeCalls++;
+		if (status >= 0) {
+			_stats.rawBytesWritten += (elements > 0 ? elements : extent0 * extent1) * sizeof(int16_t);
+		}
+		return status;
+	}
+
+	//replays the chunks touched by an access against the chunk cache model. Read
+	//misses are charged the average stored chunk size as bytes read from disk
+	void _modelChunkAccess(hsize_t offset0, hsize_t extent0, hsize_t offset1, hsize_t extent1, bool read) {
+		if (extent0 == 0 || extent1 == 0 || _cdims[0] == 0 || _cdims[1] == 0) {
+			return;
+		}
+		float ratio = read ? getCompressionRatio() : 0.0f;
+		hsize_t columns = (_bunches + _cdims[1] - 1) / _cdims[1];
+		std::size_t misses = 0;
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		for (hsize_t c0 = offset0 / _cdims[0]; c0 <= (offset0 + extent0 - 1) / _cdims[0]; c0++) {
+			for (hsize_t c1 = offset1 / _cdims[1]; c1 <= (offset1 + extent1 - 1) / _cdims[1]; c1++) {
+				if (_chunk_cache_model.access(c0 * columns + c1)) {
+					_stats.chunkCacheHits++;
+				}
+				else {
+					_stats.chunkCacheMisses++;
+					misses++;
+				}
+			}
+		}
+		if (read && misses > 0) {
+			_stats.storageBytesRead += static_cast<std::size_t>(misses * _cdims[0] * _cdims[1] * sizeof(int16_t) * ratio);
+		}
+	}
+
+	void _configureChunkCacheModel() {
+		std::size_t slots = 0, bytes = 0;
+		double w0 = 0;
+		hid_t dapl = H5Dget_access_plist(_dataset_id);
+		if (dapl >= 0) {
+			H5Pget_chunk_cache(dapl, &slots, &bytes, &w0);
+			H5Pclose(dapl);
+		}
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_chunk_cache_model.configure(bytes, slots, _cdims[0] * _cdims[1] * sizeof(int16_t));
+	}
+
 
 	//			attribute_id, dim, type
 	typedef std::tuple <hid_t, hsize_t, hid_t> Attribute;
@@ -1029,11 +1392,15 @@ std::unique_ptr<int16_t> _getStride(hsize_t count0, hsize_t count1, hsize_t offs
 	}
 
 	_status = H5Sselect_hyperslab (_dataspace_id_data, H5S_SELECT_SET, offset, stride, count, block);
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.hyperslabCalls++;
+	}
 	if (_status < 0) {
 		throw std::runtime_error("Selecting hyperslab in getRowData failed");
 
 	}
-	_status = H5Dread (_dataset_id, H5T_NATIVE_SHORT, memspace_id, _dataspace_id_data, H5P_DEFAULT, temp_ptr);
+	_status = _readData(memspace_id, _dataspace_id_data, temp_ptr, offset0, (count0 - 1) * stride0 + block0, offset1, (count1 - 1) * stride1 + block1, count0 * count1 * block0 * block1);
 	if (_status < 0) {
 		throw std::runtime_error("Reading data in getRowData failed");
 	}
@@ -1058,11 +1425,15 @@ void _setStride(const int16_t* data,hsize_t count0, hsize_t count1, hsize_t offs
 	}
 
 	_status = H5Sselect_hyperslab (_dataspace_id_data, H5S_SELECT_SET, offset, stride, count, block);
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.hyperslabCalls++;
+	}
 	if (_status < 0) {
 		throw std::runtime_error("Selecting hyperslab in getRowData failed");
 
 	}
-	_status = H5Dwrite (_dataset_id, H5T_NATIVE_SHORT, memspace_id, _dataspace_id_data, H5P_DEFAULT, data);
+	_status = _writeData(memspace_id, _dataspace_id_data, data, offset0, (count0 - 1) * stride0 + block0, offset1, (count1 - 1) * stride1 + block1, count0 * count1 * block0 * block1);
 	if (_status < 0) {
 		throw std::runtime_error("Reading data in getRowData failed");
 	}
@@ -1096,6 +1467,10 @@ std::unique_ptr<uint32_t> _readAttributeArray(const std::string& attr) {
 	}
 
 	_status = H5Dread(getAttribute(_attributes[attr]), getType(_attributes[attr]), H5S_ALL, H5S_ALL, H5P_DEFAULT, temp_ptr);
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.attributeBytesRead += size;
+	}
 	if (_status < 0) {
 		free(temp_ptr);
 		std::ostringstream temp;
@@ -1126,6 +1501,10 @@ bool _writeAttributeArray(const std::string& attr, const void* data) {
 
 	//std::size_t size = getDim(_attributes[attr]) * H5Tget_size( getType(_attributes[attr]));
 	_status = H5Dwrite(getAttribute(_attributes[attr]), getType(_attributes[attr]),H5S_ALL, H5S_ALL, H5P_DEFAULT,  data);
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.attributeBytesWritten += getDim(_attributes[attr]) * H5Tget_size( getType(_attributes[attr]));
+	}
 	if (_status < 0) {
 		std::ostringstream temp;
 		temp << "Writing attribute " << attr << " failed";
@@ -1160,6 +1539,10 @@ std::string _readAttributeString(const std::string& attr) {
 	}
 
 	_status = H5Dread(getAttribute(_attributes[attr]), getType(_attributes[attr]), H5S_ALL, H5S_ALL, H5P_DEFAULT, temp_ptr);
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.attributeBytesRead += size;
+	}
 	std::string test(reinterpret_cast<const char*> (temp_ptr) );
 	free(temp_ptr);
 	if (_status < 0) {
@@ -1241,9 +1624,9 @@ void _setBeam(const std::string& beam) {
 	_loc = _group + "/" + _plane;
 }
 
-void _setTurns(const std::size_t& turns) {
+void _setTurns(const std::size_t& turns, bool requirePowerOf2=true) {
 
-	if (!powerOf2(turns)) {
+	if (requirePowerOf2 && !powerOf2(turns)) {
 		throw std::runtime_error("Turns must be a power of 2");
 	}
 	_turns = turns;
@@ -1502,8 +1885,13 @@ void openHDF() {
 		temp << "Failed to get dimensions from dataset /" << group_name << "/" << dataset_name;
 		throw std::runtime_error(temp.str());
 	}
-	_setTurns(dims[0]);
+	//streamed files end wherever the acquisition stopped
+	_setTurns(dims[0], false);
 	_setBunches(dims[1]);
+	if (H5Pget_layout(_plist_id) == H5D_CHUNKED) {
+		H5Pget_chunk(_plist_id, 2, _cdims);
+	}
+	_configureChunkCacheModel();
 	_initialiseAttributeMap();
 
 	if(_attributes_enabled){
@@ -1617,7 +2005,13 @@ void createHDF() {
 	}
 	#if  H5_VERS_MINOR == 12
 		//---------------------use the latest file format---------------------------
-		_status=H5Pset_libver_bounds(_file_access_plist_id, H5F_LIBVER_V18, H5F_LIBVER_V18);
+		//SWMR needs the 1.10 format
+		if(_streaming){
+			_status=H5Pset_libver_bounds(_file_access_plist_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+		}
+		else{
+			_status=H5Pset_libver_bounds(_file_access_plist_id, H5F_LIBVER_V18, H5F_LIBVER_V18);
+		}
 	#else
 		_status=H5Pset_libver_bounds(_file_access_plist_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
 	#endif
@@ -1648,7 +2042,14 @@ void createHDF() {
 	}
 
 	//---------------------------create dataspace---------------------------------
-	_dataspace_id_data = H5Screate_simple(2, _dims, NULL);
+	if(_streaming){
+		hsize_t dims[2] = { 0, _bunches };
+		hsize_t maxdims[2] = { H5S_UNLIMITED, _bunches };
+		_dataspace_id_data = H5Screate_simple(2, dims, maxdims);
+	}
+	else{
+		_dataspace_id_data = H5Screate_simple(2, _dims, NULL);
+	}
 	if (_dataspace_id_data < 0)
 	{
 		std::ostringstream temp;
@@ -1699,6 +2100,8 @@ void createHDF() {
 		throw std::runtime_error(temp.str());
 	}
 
+	_configureChunkCacheModel();
+
 	//----------------------create attributes------------------------------------
 
 	_initialiseAttributeMap();
@@ -1756,6 +2159,115 @@ void createHDF() {
 		H5Pclose(plist_id_attr);
 		H5Sclose(_dataspace_id_attr);
 	}
+
+	if(_streaming){
+		_stream_buffer.resize(_cdims[0] * _bunches);
+		if(_async_flush){
+			_flush_buffer.resize(_cdims[0] * _bunches);
+		}
+		_buffered_turns = 0;
+		_streamed_turns = 0;
+		_status = H5Fstart_swmr_write(_file_id);
+		if (_status < 0)
+		{
+			std::ostringstream temp;
+			temp << "H5Fstart_swmr_write failed";
+			throw std::runtime_error(temp.str());
+		}
+	}
+}
+
+void _flushStreamBuffer() {
+	std::size_t turns = _buffered_turns;
+	bool fullRow = turns == _cdims[0];
+	_waitForFlush();
+	if (_async_flush && fullRow) {
+		_stream_buffer.swap(_flush_buffer);
+		_buffered_turns = 0;
+		_pending_flush = std::async(std::launch::async, [this, turns]() {
+			_writeTurns(_flush_buffer.data(), turns);
+		});
+		return;
+	}
+	_writeTurns(_stream_buffer.data(), turns);
+	if (fullRow) {
+		_buffered_turns = 0;
+	}
+}
+
+void _waitForFlush() {
+	if (_pending_flush.valid()) {
+		_pending_flush.get();
+	}
+}
+
+//writes turns buffered rows at the end of the written part of the dataset.
+//A partial chunk row stays in the buffer and is written again once it fills up
+void _writeTurns(const int16_t* rows, std::size_t turns) {
+	hsize_t extent[2] = { _streamed_turns + turns, _bunches };
+	_status = H5Dset_extent(_dataset_id, extent);
+	if (_status < 0) {
+		throw std::runtime_error("Extending dataset failed");
+	}
+	H5Sclose(_dataspace_id_data);
+	_dataspace_id_data = H5Dget_space(_dataset_id);
+	if (_dataspace_id_data < 0) {
+		throw std::runtime_error("Getting dataspace of extended dataset failed");
+	}
+
+	hsize_t count[2] = { turns, _bunches };
+	hsize_t offset[2] = { _streamed_turns, 0 };
+	if (_stream_memspace_id < 0 || _stream_memspace_turns != turns) {
+		if (_stream_memspace_id >= 0) {
+			H5Sclose(_stream_memspace_id);
+		}
+		_stream_memspace_id = H5Screate_simple(2, count, NULL);
+		_stream_memspace_turns = turns;
+		if (_stream_memspace_id < 0) {
+			throw std::runtime_error("Creating memspace while streaming failed");
+		}
+	}
+	_status = H5Sselect_hyperslab(_dataspace_id_data, H5S_SELECT_SET, offset, NULL, count, NULL);
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_stats.hyperslabCalls++;
+	}
+	if (_status < 0) {
+		throw std::runtime_error("Selecting hyperslab while streaming failed");
+	}
+	_status = _writeData(_stream_memspace_id, _dataspace_id_data, rows, offset[0], turns, 0, _bunches);
+	if (_status < 0) {
+		throw std::runtime_error("Writing rows while streaming failed");
+	}
+	//make the new extent and chunks visible on disk before accepting more data
+	_status = H5Dflush(_dataset_id);
+	if (_status < 0) {
+		throw std::runtime_error("Flushing dataset while streaming failed");
+	}
+	if (turns == _cdims[0]) {
+		_streamed_turns += turns;
+	}
+}
+
+void _closeStream() {
+	_waitForFlush();
+	if (_buffered_turns > 0) {
+		_writeTurns(_stream_buffer.data(), _buffered_turns);
+		_streamed_turns += _buffered_turns;
+		_buffered_turns = 0;
+	}
+	if (_stream_memspace_id >= 0) {
+		H5Sclose(_stream_memspace_id);
+		_stream_memspace_id = -1;
+	}
+	_turns = _streamed_turns;
+	_dims[0] = _turns;
+	_status = H5Fflush(_file_id, H5F_SCOPE_GLOBAL);
+	if (_status < 0) {
+		throw std::runtime_error("Flushing file while closing stream failed");
+	}
+	_stream_buffer = std::vector<int16_t>();
+	_flush_buffer = std::vector<int16_t>();
 }
 	const std::string _filename;
 	bool _open = false;
@@ -1789,8 +2301,21 @@ void createHDF() {
 
 	std::map<std::string, Attribute> _attributes;
 
-	//diagnostics
-	std::size_t _time_to_write_data;
+	//streaming
+	bool _streaming = false;
+	bool _async_flush = false;
+	std::vector<int16_t> _stream_buffer;
+	std::vector<int16_t> _flush_buffer;
+	std::size_t _buffered_turns = 0;
+	std::size_t _streamed_turns = 0;
+	hid_t _stream_memspace_id = -1;
+	hsize_t _stream_memspace_turns = 0;
+	std::future<void> _pending_flush;
+
+	//diagnostics, updated by the async flush thread too and only touched under _stats_mutex
+	HDFStats _stats;
+	ChunkCacheModel _chunk_cache_model;
+	std::mutex _stats_mutex;
 
 
 
@@ -0,0 +1,610 @@
+#ifndef INCLUDE_HDFREADERPOOL_H_
+
+#define INCLUDE_HDFREADERPOOL_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdexcept>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "HDFLib.h"
+
+namespace HDFLib {
+
+class HDFPooledFile;
+
+//Pool of forked reader processes. Each process has its own copy of the HDF5
+//library, so files are decoded in parallel even though the library itself
+//serialises (or must not be entered) from several threads of one process.
+//
+//Requests and results are exchanged through one anonymous shared mapping: a
+//ring of slot indices guarded by a process shared mutex and semaphore, and a
+//fixed number of slots that each hold one request, its result and a data area.
+//Analysis threads may share one pool; construct it before starting threads
+//since the workers are forked from the constructor.
+class HDFReaderPool {
+public:
+	HDFReaderPool(unsigned workers = 0, std::size_t slotBytes = 4 << 20, unsigned slots = 0) {
+		if (workers == 0) {
+			workers = std::max(1u, std::thread::hardware_concurrency());
+		}
+		if (slots == 0) {
+			slots = 2 * workers;
+		}
+		_slotBytes = slotBytes;
+		_nslots = slots;
+
+		_ringSize = slots + workers;
+		//slots start on cache lines so the semaphores and data never share one
+		_controlBytes = _alignUp(sizeof(Control) + _ringSize * sizeof(uint32_t), 64);
+		_slotStride = _alignUp(sizeof(Slot) + _slotBytes, 64);
+		_mapSize = _controlBytes + static_cast<std::size_t>(_nslots) * _slotStride;
+		_map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (_map == MAP_FAILED) {
+			std::ostringstream temp;
+			temp << "Mapping " << _mapSize << " bytes of shared memory for the reader pool failed";
+			throw std::runtime_error(temp.str());
+		}
+
+		Control* control = _control();
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&control->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+		sem_init(&control->items, 1, 0);
+		control->head = 0;
+		control->tail = 0;
+		for (unsigned i = 0; i < _nslots; i++) {
+			sem_init(&_slot(i)->done, 1, 0);
+			_free.push_back(i);
+		}
+
+		for (unsigned i = 0; i < workers; i++) {
+			pid_t pid = fork();
+			if (pid < 0) {
+				_shutdown();
+				throw std::runtime_error("Forking reader process failed");
+			}
+			if (pid == 0) {
+				_workerLoop();
+				_exit(0);
+			}
+			_workers.push_back(pid);
+		}
+	}
+
+	~HDFReaderPool() {
+		_shutdown();
+	}
+
+	HDFReaderPool(const HDFReaderPool&) = delete;
+	HDFReaderPool& operator=(const HDFReaderPool&) = delete;
+
+	HDFPooledFile open(const std::string& filename);
+
+	std::size_t getSlotBytes() const {
+		return _slotBytes;
+	}
+
+	unsigned getWorkers() const {
+		return _workers.size();
+	}
+
+	struct Info {
+		std::size_t turns;
+		std::size_t bunches;
+		std::string plane;
+		std::string beam;
+	};
+
+	Info readInfo(const std::string& filename) {
+		unsigned slot = _acquireSlot();
+		_fillRequest(slot, INFO, filename, 0, 0, 0, 0);
+		_submit(slot);
+		try {
+			_wait(slot);
+		}
+		catch (...) {
+			_releaseSlot(slot);
+			throw;
+		}
+		Result& result = _slot(slot)->result;
+		Info info = { result.turns, result.bunches, result.plane, result.beam };
+		_releaseSlot(slot);
+		return info;
+	}
+
+	//reads a turns x bunches block, row major, into out. The block is split
+	//into bunch ranges that fit a slot and those are kept in flight together
+	void readBlock(const std::string& filename, std::size_t turn, std::size_t turns, std::size_t bunch, std::size_t bunches, int16_t* out) {
+		std::size_t rowBytes = turns * sizeof(int16_t);
+		if (rowBytes > _slotBytes) {
+			std::ostringstream temp;
+			temp << "A single bunch of " << turns << " turns does not fit in a " << _slotBytes << " byte slot";
+			throw std::runtime_error(temp.str());
+		}
+		std::size_t perRequest = _slotBytes / rowBytes;
+
+		struct Pending {
+			unsigned slot;
+			std::size_t bunch;
+			std::size_t bunches;
+		};
+		std::deque<Pending> pending;
+		auto collect = [&]() {
+			Pending p = pending.front();
+			pending.pop_front();
+			try {
+				_wait(p.slot);
+			}
+			catch (...) {
+				_releaseSlot(p.slot);
+				throw;
+			}
+			//the worker returns the block bunch-major, scatter it into rows
+			const int16_t* data = _data(p.slot);
+			for (std::size_t b = 0; b < p.bunches; b++) {
+				const int16_t* column = data + b * turns;
+				int16_t* dst = out + (p.bunch - bunch) + b;
+				for (std::size_t t = 0; t < turns; t++) {
+					dst[t * bunches] = column[t];
+				}
+			}
+			_releaseSlot(p.slot);
+		};
+
+		try {
+			for (std::size_t b = bunch; b < bunch + bunches; b += perRequest) {
+				std::size_t n = std::min(perRequest, bunch + bunches - b);
+				unsigned slot;
+				//never block on a slot while holding finished ones of our own
+				while (!_tryAcquireSlot(slot)) {
+					if (pending.empty()) {
+						slot = _acquireSlot();
+						break;
+					}
+					collect();
+				}
+				_fillRequest(slot, BLOCK, filename, turn, turns, b, n);
+				_submit(slot);
+				pending.push_back({ slot, b, n });
+			}
+			while (!pending.empty()) {
+				collect();
+			}
+		}
+		catch (...) {
+			for (auto& p : pending) {
+				_waitQuietly(p.slot);
+				_releaseSlot(p.slot);
+			}
+			throw;
+		}
+	}
+
+	//reads all turns of one bunch straight into out
+	void readColumn(const std::string& filename, std::size_t turns, std::size_t bunch, int16_t* out) {
+		if (turns * sizeof(int16_t) > _slotBytes) {
+			throw std::runtime_error("Column does not fit in a reader pool slot");
+		}
+		unsigned slot = _acquireSlot();
+		_fillRequest(slot, BLOCK, filename, 0, turns, bunch, 1);
+		_submit(slot);
+		try {
+			_wait(slot);
+		}
+		catch (...) {
+			_releaseSlot(slot);
+			throw;
+		}
+		std::memcpy(out, _data(slot), turns * sizeof(int16_t));
+		_releaseSlot(slot);
+	}
+
+private:
+	enum Kind : uint32_t {
+		INFO,
+		BLOCK
+	};
+
+	static const uint32_t SHUTDOWN_SLOT = 0xffffffff;
+
+	struct Request {
+		Kind kind;
+		char filename[4096];
+		std::size_t turn;
+		std::size_t turns;
+		std::size_t bunch;
+		std::size_t bunches;
+	};
+
+	struct Result {
+		bool ok;
+		char message[256];
+		std::size_t turns;
+		std::size_t bunches;
+		char plane[16];
+		char beam[8];
+	};
+
+	struct Slot {
+		sem_t done;
+		//reader that took the request, 0 while it waits in the ring. Only touched under the ring lock
+		pid_t owner;
+		Request request;
+		Result result;
+	};
+
+	//the ring size is no power of two, so head and tail must never wrap: at 64 bit they do not
+	struct Control {
+		pthread_mutex_t lock;
+		sem_t items;
+		uint64_t head;
+		uint64_t tail;
+	};
+
+	static std::size_t _alignUp(std::size_t value, std::size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	Control* _control() {
+		return reinterpret_cast<Control*>(_map);
+	}
+
+	uint32_t* _ring() {
+		return reinterpret_cast<uint32_t*>(reinterpret_cast<char*>(_map) + sizeof(Control));
+	}
+
+	Slot* _slot(unsigned i) {
+		return reinterpret_cast<Slot*>(reinterpret_cast<char*>(_map) + _controlBytes + i * _slotStride);
+	}
+
+	int16_t* _data(unsigned i) {
+		return reinterpret_cast<int16_t*>(reinterpret_cast<char*>(_slot(i)) + sizeof(Slot));
+	}
+
+	void _lock() {
+		int status = pthread_mutex_lock(&_control()->lock);
+		if (status == EOWNERDEAD) {
+			//a reader died while holding the ring, the indices are only touched under the lock
+			pthread_mutex_consistent(&_control()->lock);
+		}
+	}
+
+	void _unlock() {
+		pthread_mutex_unlock(&_control()->lock);
+	}
+
+	void _push(uint32_t value) {
+		Control* control = _control();
+		_lock();
+		_ring()[control->tail % _ringSize] = value;
+		control->tail++;
+		_unlock();
+		sem_post(&control->items);
+	}
+
+	uint32_t _pop() {
+		Control* control = _control();
+		while (sem_wait(&control->items) != 0) {
+			if (errno != EINTR) {
+				return SHUTDOWN_SLOT;
+			}
+		}
+		_lock();
+		uint32_t value = _ring()[control->head % _ringSize];
+		if (value != SHUTDOWN_SLOT) {
+			_slot(value)->owner = getpid();
+		}
+		control->head++;
+		_unlock();
+		return value;
+	}
+
+	unsigned _acquireSlot() {
+		std::unique_lock<std::mutex> lock(_freeMutex);
+		_freeCondition.wait(lock, [this]() { return !_free.empty(); });
+		unsigned slot = _free.back();
+		_free.pop_back();
+		return slot;
+	}
+
+	bool _tryAcquireSlot(unsigned& slot) {
+		std::lock_guard<std::mutex> lock(_freeMutex);
+		if (_free.empty()) {
+			return false;
+		}
+		slot = _free.back();
+		_free.pop_back();
+		return true;
+	}
+
+	void _releaseSlot(unsigned slot) {
+		{
+			std::lock_guard<std::mutex> lock(_freeMutex);
+			_free.push_back(slot);
+		}
+		_freeCondition.notify_one();
+	}
+
+	void _fillRequest(unsigned slot, Kind kind, const std::string& filename, std::size_t turn, std::size_t turns, std::size_t bunch, std::size_t bunches) {
+		Request& request = _slot(slot)->request;
+		if (filename.size() >= sizeof(request.filename)) {
+			_releaseSlot(slot);
+			throw std::runtime_error("File name too long for the reader pool");
+		}
+		request.kind = kind;
+		std::strcpy(request.filename, filename.c_str());
+		request.turn = turn;
+		request.turns = turns;
+		request.bunch = bunch;
+		request.bunches = bunches;
+	}
+
+	void _submit(unsigned slot) {
+		_lock();
+		_slot(slot)->owner = 0;
+		_unlock();
+		_push(slot);
+	}
+
+	//waits for a worker to finish the slot, throws if it failed, the worker serving it
+	//died or all workers are gone.
+	//The slot stays owned by the caller either way
+	void _wait(unsigned slot) {
+		_waitQuietly(slot);
+		Result& result = _slot(slot)->result;
+		if (!result.ok) {
+			std::ostringstream temp;
+			temp << "Reader process failed: " << result.message;
+			throw std::runtime_error(temp.str());
+		}
+	}
+
+	void _waitQuietly(unsigned slot) {
+		sem_t* done = &_slot(slot)->done;
+		while (true) {
+			timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += 1;
+			if (sem_timedwait(done, &deadline) == 0) {
+				return;
+			}
+			const char* reason = errno == ETIMEDOUT ? _lostReason(slot) : NULL;
+			if (reason != NULL) {
+				Result& result = _slot(slot)->result;
+				result.ok = false;
+				std::strcpy(result.message, reason);
+				return;
+			}
+		}
+	}
+
+	//reaps exited workers and tells why the slot will never be done, NULL while it still may be
+	const char* _lostReason(unsigned slot) {
+		std::lock_guard<std::mutex> lock(_exitedMutex);
+		bool alive = false;
+		for (pid_t pid : _workers) {
+			if (_hasExited(pid)) {
+				continue;
+			}
+			if (waitpid(pid, NULL, WNOHANG) == 0) {
+				alive = true;
+			}
+			else {
+				_exited.push_back(pid);
+			}
+		}
+		_lock();
+		pid_t owner = _slot(slot)->owner;
+		_unlock();
+		if (owner != 0 && _hasExited(owner)) {
+			return "the reader process serving the request exited";
+		}
+		if (!alive) {
+			return "all reader processes exited";
+		}
+		return NULL;
+	}
+
+	bool _hasExited(pid_t pid) const {
+		return std::find(_exited.begin(), _exited.end(), pid) != _exited.end();
+	}
+
+	void _workerLoop() {
+		std::unique_ptr<HDFFile> file;
+		std::string current;
+		while (true) {
+			uint32_t index = _pop();
+			if (index == SHUTDOWN_SLOT) {
+				return;
+			}
+			Slot* slot = _slot(index);
+			Request& request = slot->request;
+			Result& result = slot->result;
+			result.ok = true;
+			result.message[0] = 0;
+			try {
+				//keep the last file open, requests for one file tend to come in runs
+				if (!file || current != request.filename) {
+					file.reset();
+					current = request.filename;
+					file.reset(new HDFFile(current));
+					file->open();
+				}
+				result.turns = file->getRows();
+				result.bunches = file->getColumns();
+				std::strncpy(result.plane, file->getPlane().c_str(), sizeof(result.plane) - 1);
+				result.plane[sizeof(result.plane) - 1] = 0;
+				std::strncpy(result.beam, file->getBeam().c_str(), sizeof(result.beam) - 1);
+				result.beam[sizeof(result.beam) - 1] = 0;
+				if (request.kind == BLOCK) {
+					std::unique_ptr<int16_t> block = file->getBlockParallel(request.turn, request.turns, request.bunch, request.bunches, 1);
+					int16_t* out = _data(index);
+					for (std::size_t t = 0; t < request.turns; t++) {
+						for (std::size_t b = 0; b < request.bunches; b++) {
+							out[b * request.turns + t] = block.get()[t * request.bunches + b];
+						}
+					}
+				}
+			}
+			catch (std::exception& e) {
+				file.reset();
+				current.clear();
+				result.ok = false;
+				std::strncpy(result.message, e.what(), sizeof(result.message) - 1);
+				result.message[sizeof(result.message) - 1] = 0;
+			}
+			sem_post(&slot->done);
+		}
+	}
+
+	void _shutdown() {
+		if (_map == NULL || _map == MAP_FAILED) {
+			return;
+		}
+		for (std::size_t i = 0; i < _workers.size(); i++) {
+			_push(SHUTDOWN_SLOT);
+		}
+		for (pid_t pid : _workers) {
+			//reaped pids may already belong to someone else
+			if (!_hasExited(pid)) {
+				waitpid(pid, NULL, 0);
+			}
+		}
+		_workers.clear();
+		_exited.clear();
+		sem_destroy(&_control()->items);
+		pthread_mutex_destroy(&_control()->lock);
+		for (unsigned i = 0; i < _nslots; i++) {
+			sem_destroy(&_slot(i)->done);
+		}
+		munmap(_map, _mapSize);
+		_map = NULL;
+	}
+
+	void* _map = NULL;
+	std::size_t _mapSize = 0;
+	std::size_t _controlBytes = 0;
+	std::size_t _slotStride = 0;
+	std::size_t _slotBytes = 0;
+	unsigned _nslots = 0;
+	uint32_t _ringSize = 0;
+	std::vector<pid_t> _workers;
+	std::mutex _exitedMutex;
+	std::vector<pid_t> _exited;
+
+	std::mutex _freeMutex;
+	std::condition_variable _freeCondition;
+	std::vector<unsigned> _free;
+};
+
+//Read side of HDFFile served by a HDFReaderPool, safe to use from several
+//analysis threads at once
+class HDFPooledFile {
+public:
+	HDFPooledFile(HDFReaderPool& pool, const std::string& filename) : _pool(pool), _filename(filename) {
+		HDFReaderPool::Info info = _pool.readInfo(_filename);
+		_turns = info.turns;
+		_bunches = info.bunches;
+		_plane = info.plane;
+		_beam = info.beam;
+	}
+
+	std::size_t getRows() {
+		return _transpose ? _bunches : _turns;
+	}
+
+	std::size_t getColumns() {
+		return _transpose ? _turns : _bunches;
+	}
+
+	std::string getPlane() {
+		return _plane;
+	}
+
+	std::string getBeam() {
+		return _beam;
+	}
+
+	void setTranspose(bool value) {
+		_transpose = value;
+	}
+
+	std::unique_ptr<int16_t> getData() {
+		std::unique_ptr<int16_t> data(_allocate(_turns * _bunches));
+		_pool.readBlock(_filename, 0, _turns, 0, _bunches, data.get());
+		return data;
+	}
+
+	std::unique_ptr<int16_t> getRowData(std::size_t index) {
+		std::unique_ptr<int16_t> data(_allocate(_bunches));
+		_pool.readBlock(_filename, index, 1, 0, _bunches, data.get());
+		return data;
+	}
+
+	std::unique_ptr<int16_t> getColumnData(std::size_t index) {
+		std::unique_ptr<int16_t> data(_allocate(_turns));
+		_pool.readColumn(_filename, _turns, index, data.get());
+		return data;
+	}
+
+	//reads one bunch into a caller owned buffer of getRows() turns
+	void readColumnData(std::size_t index, int16_t* out) {
+		_pool.readColumn(_filename, _turns, index, out);
+	}
+
+	std::unique_ptr<int16_t> operator[](int index) {
+		if (_transpose) {
+			return getColumnData(index);
+		}
+		else {
+			return getRowData(index);
+		}
+	}
+
+private:
+	int16_t* _allocate(std::size_t elements) {
+		int16_t* temp_ptr = reinterpret_cast<int16_t*>(malloc(elements * sizeof(int16_t)));
+		if (temp_ptr == NULL) {
+			std::ostringstream temp;
+			temp << "Allocating " << elements * sizeof(int16_t) << " bytes for data failed";
+			throw std::runtime_error(temp.str());
+		}
+		return temp_ptr;
+	}
+
+	HDFReaderPool& _pool;
+	std::string _filename;
+	std::size_t _turns = 0;
+	std::size_t _bunches = 0;
+	std::string _plane;
+	std::string _beam;
+	bool _transpose = false;
+};
+
+inline HDFPooledFile HDFReaderPool::open(const std::string& filename) {
+	return HDFPooledFile(*this, filename);
+}
+
+}
+
+#endif
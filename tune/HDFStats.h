@@ -0,0 +1,117 @@
+#ifndef INCLUDE_HDFSTATS_H_
+
+#define INCLUDE_HDFSTATS_H_
+
+#include <string>
+#include <sstream>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+
+namespace HDFLib {
+
+//I/O counters of one HDFFile. Raw bytes are the decoded int16 payload, storage
+//bytes are what the data set occupies on disk. Times are in nanoseconds spent
+//inside H5Dread/H5Dread_chunk and H5Dwrite.
+struct HDFStats {
+	std::size_t rawBytesRead = 0;
+	std::size_t rawBytesWritten = 0;
+	std::size_t storageBytesRead = 0;
+	std::size_t storageBytes = 0;
+	std::size_t attributeBytesRead = 0;
+	std::size_t attributeBytesWritten = 0;
+
+	std::size_t readTime = 0;
+	std::size_t writeTime = 0;
+	std::size_t readCalls = 0;
+	std::size_t writeCalls = 0;
+	std::size_t rawChunkReads = 0;
+	std::size_t hyperslabCalls = 0;
+
+	//estimated from an LRU model of the raw data chunk cache, see ChunkCacheModel
+	std::size_t chunkCacheHits = 0;
+	std::size_t chunkCacheMisses = 0;
+
+	//on disk size relative to the raw size of the data set
+	double compressionRatio = 0.0;
+
+	//MB/s of raw data while inside the library
+	double readSpeed() const {
+		return readTime == 0 ? 0.0 : (rawBytesRead / 1e6) / (readTime / 1e9);
+	}
+
+	double writeSpeed() const {
+		return writeTime == 0 ? 0.0 : (rawBytesWritten / 1e6) / (writeTime / 1e9);
+	}
+
+	std::string toJSON() const {
+		std::ostringstream out;
+		out << "{"
+			<< "\"rawBytesRead\":" << rawBytesRead << ","
+			<< "\"rawBytesWritten\":" << rawBytesWritten << ","
+			<< "\"storageBytesRead\":" << storageBytesRead << ","
+			<< "\"storageBytes\":" << storageBytes << ","
+			<< "\"attributeBytesRead\":" << attributeBytesRead << ","
+			<< "\"attributeBytesWritten\":" << attributeBytesWritten << ","
+			<< "\"readTimeNs\":" << readTime << ","
+			<< "\"writeTimeNs\":" << writeTime << ","
+			<< "\"readCalls\":" << readCalls << ","
+			<< "\"writeCalls\":" << writeCalls << ","
+			<< "\"rawChunkReads\":" << rawChunkReads << ","
+			<< "\"hyperslabCalls\":" << hyperslabCalls << ","
+			<< "\"chunkCacheHits\":" << chunkCacheHits << ","
+			<< "\"chunkCacheMisses\":" << chunkCacheMisses << ","
+			<< "\"compressionRatio\":" << compressionRatio << ","
+			<< "\"readSpeedMBps\":" << readSpeed() << ","
+			<< "\"writeSpeedMBps\":" << writeSpeed()
+			<< "}";
+		return out.str();
+	}
+};
+
+//HDF5 does not expose hit counts of its raw data chunk cache, so accesses are
+//replayed against an LRU of the same byte budget. Chunks larger than the
+//budget bypass the cache in the library and always count as misses.
+class ChunkCacheModel {
+public:
+	void configure(std::size_t cacheBytes, std::size_t slots, std::size_t chunkBytes) {
+		_capacity = chunkBytes == 0 || chunkBytes > cacheBytes ? 0 : cacheBytes / chunkBytes;
+		if (slots < _capacity) {
+			_capacity = slots;
+		}
+		clear();
+	}
+
+	void clear() {
+		_lru.clear();
+		_index.clear();
+	}
+
+	//returns true on a hit
+	bool access(uint64_t chunk) {
+		auto it = _index.find(chunk);
+		if (it != _index.end()) {
+			_lru.splice(_lru.begin(), _lru, it->second);
+			return true;
+		}
+		if (_capacity == 0) {
+			return false;
+		}
+		if (_lru.size() == _capacity) {
+			_index.erase(_lru.back());
+			_lru.pop_back();
+		}
+		_lru.push_front(chunk);
+		_index[chunk] = _lru.begin();
+		return false;
+	}
+
+private:
+	std::size_t _capacity = 0;
+	std::list<uint64_t> _lru;
+	std::unordered_map<uint64_t, std::list<uint64_t>::iterator> _index;
+};
+
+}
+
+#endif
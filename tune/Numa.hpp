@@ -0,0 +1,209 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef USE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+// NUMA placement of analysis buffers and threads. The nodes and their CPUs come from
+// /sys, threads are pinned to all CPUs of a node rather than single cores. Memory is
+// bound to its node with libnuma when built with -DUSE_NUMA (make NUMA=1), otherwise
+// it is first touched by a thread pinned to the node, which the kernel's default
+// policy honours as long as the node has free memory.
+namespace Numa {
+
+    // "0-3,8,10-11" as in cpulist files
+    inline std::vector<int> parseList(const std::string& text) {
+        std::vector<int> values;
+        std::stringstream stream(text);
+        std::string item;
+        while(std::getline(stream, item, ',')) {
+            if(item.empty() || item == "\n") {
+                continue;
+            }
+            std::size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for(int i = first; i <= last; i++) {
+                values.push_back(i);
+            }
+        }
+        return values;
+    }
+
+    class Topology {
+        public:
+            // CPUs of every node, node i is the i-th non empty list
+            Topology(const std::vector<std::vector<int>>& cpus) {
+                for(const std::vector<int>& list : cpus) {
+                    if(!list.empty()) {
+                        this->cpus.push_back(list);
+                    }
+                }
+                if(this->cpus.empty()) {
+                    throw std::runtime_error("NUMA topology without CPUs");
+                }
+            }
+
+            // The nodes with CPUs this process may run on, one node if /sys tells nothing
+            static Topology detect() {
+                cpu_set_t allowed;
+                CPU_ZERO(&allowed);
+                if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+                    for(unsigned c = 0; c < std::thread::hardware_concurrency() && c < CPU_SETSIZE; c++) {
+                        CPU_SET(c, &allowed);
+                    }
+                }
+
+                std::vector<std::pair<int, std::vector<int>>> nodes;
+                std::error_code error;
+                for(const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+                    std::string name = entry.path().filename().string();
+                    if(name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+                            name.find_first_not_of("0123456789", 4) != std::string::npos) {
+                        continue;
+                    }
+                    std::ifstream in(entry.path() / "cpulist");
+                    std::string text;
+                    std::getline(in, text);
+                    std::vector<int> list;
+                    for(int c : parseList(text)) {
+                        if(c < CPU_SETSIZE && CPU_ISSET(c, &allowed)) {
+                            list.push_back(c);
+                        }
+                    }
+                    nodes.push_back({ std::stoi(name.substr(4)), list });
+                }
+                std::sort(nodes.begin(), nodes.end());
+
+                std::vector<int> ids;
+                std::vector<std::vector<int>> cpus;
+                for(const auto& node : nodes) {
+                    if(!node.second.empty()) {
+                        ids.push_back(node.first);
+                        cpus.push_back(node.second);
+                    }
+                }
+                if(cpus.empty()) {
+                    std::vector<int> all;
+                    for(int c = 0; c < CPU_SETSIZE; c++) {
+                        if(CPU_ISSET(c, &allowed)) {
+                            all.push_back(c);
+                        }
+                    }
+                    cpus.push_back(all);
+                    ids = { 0 };
+                }
+                Topology topology(cpus);
+                topology.ids = ids;
+                return topology;
+            }
+
+            std::size_t getNodes() const {
+                return cpus.size();
+            }
+
+            // Operating system number of node
+            int getId(std::size_t node) const {
+                return node < ids.size() ? ids[node] : (int)node;
+            }
+
+            // Node with operating system number id, getNodes() if there is none
+            std::size_t find(int id) const {
+                for(std::size_t node = 0; node < cpus.size(); node++) {
+                    if(getId(node) == id) {
+                        return node;
+                    }
+                }
+                return cpus.size();
+            }
+
+            const std::vector<int>& getCpus(std::size_t node) const {
+                return cpus.at(node);
+            }
+
+            // Node of worker w of workers, workers are spread over the nodes in
+            // proportion to their CPUs and neighbouring workers share a node
+            std::size_t nodeOf(unsigned w, unsigned workers) const {
+                std::size_t total = 0;
+                for(const std::vector<int>& list : cpus) {
+                    total += list.size();
+                }
+                std::size_t before = 0;
+                for(std::size_t node = 0; node < cpus.size(); node++) {
+                    before += cpus[node].size();
+                    if((std::size_t)w * total < before * workers) {
+                        return node;
+                    }
+                }
+                return cpus.size() - 1;
+            }
+
+            // Restricts the calling thread to the CPUs of node
+            bool pin(std::size_t node) const {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for(int c : cpus.at(node)) {
+                    CPU_SET(c, &set);
+                }
+                return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+            }
+
+        private:
+            std::vector<int> ids;
+            std::vector<std::vector<int>> cpus;
+    };
+
+
+    // Places the pages of [data, data + bytes) on node, before anything touches them.
+    // Bound with libnuma if available, otherwise first touched from the node.
+    inline void place(void* data, std::size_t bytes, const Topology& topology, std::size_t node) {
+        if(bytes == 0) {
+            return;
+        }
+#ifdef USE_NUMA
+        if(numa_available() >= 0) {
+            numa_tonode_memory(data, bytes, topology.getId(node));
+            return;
+        }
+#endif
+        std::size_t page = std::max<long>(sysconf(_SC_PAGESIZE), 4096);
+        std::thread toucher([&]() {
+            topology.pin(node);
+            for(std::size_t offset = 0; offset < bytes; offset += page) {
+                static_cast<volatile char*>(data)[offset] = 0;
+            }
+        });
+        toucher.join();
+    }
+
+    // Operating system node the page at data lives on, -1 if not known. Only
+    // meaningful once the page has been touched.
+    inline int placement(const void* data) {
+#ifdef USE_NUMA
+        int status = -1;
+        void* page = const_cast<void*>(data);
+        if(data != nullptr && numa_move_pages(0, 1, &page, nullptr, &status, 0) == 0 && status >= 0) {
+            return status;
+        }
+#endif
+        return -1;
+    }
+}
+
+#endif
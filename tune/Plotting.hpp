@@ -53,23 +53,47 @@ g++ -g -std=c++1z glfw_ship.cpp -lskia -ldl -lpthread -ljpeg -lfreetype -lz -lpn
 
 eventually, you will want color-correct spaces, and there are 5 places below (Ctrl+F "enable correct color spaces"), where you should replace/uncomment lines to enable this.
 warning: color-correct spaces don't work in VMWare, because mesa doesn't support it.
+
+Headless nodes: define OFFSCREEN before including this file (or build with -DOFFSCREEN) to
+get a CPU raster surface instead of the GLFW window. GL, GLFW and libGL are then not needed:
+g++ -std=c++17 -DOFFSCREEN movie.cpp -lskia -ldl -lpthread -ljpeg -lfreetype -lz -lpng -lfontconfig -lwebp -lwebpmux -lwebpdemux -Iskia -Lskia/out/Static/
+Every thread draws on its own surface, see RenderFrames at the end of the file.
 */
-#define SK_GL 1
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#ifndef OFFSCREEN
+#define SK_GL 1
 #include <GLES3/gl3.h>
 #include "GLFW/glfw3.h"
 #include "include/gpu/GrBackendSurface.h"
 #include "include/gpu/GrDirectContext.h"
+#include "include/gpu/gl/GrGLInterface.h"
+#else
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include "include/core/SkImageEncoder.h"
+#include "include/core/SkStream.h"
+#include "CliParse.hpp"
+#endif
 #include "include/core/SkTextBlob.h"
 
-#include "include/gpu/gl/GrGLInterface.h"
 #include "include/core/SkCanvas.h"
+#include "include/core/SkImage.h"
 #include "include/core/SkColorSpace.h"
 #include "include/core/SkSurface.h"
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifndef OFFSCREEN
 //uncomment the two lines below to enable correct color spaces
 //#define GL_FRAMEBUFFER_SRGB 0x8DB9
 //#define GL_SRGB8_ALPHA8 0x8C43
@@ -77,12 +101,14 @@ warning: color-correct spaces don't work in VMWare, because mesa doesn't support
 #define GR_GL_BGRA8                          0x93A1
 
 sk_sp<GrDirectContext> dContext;
-sk_sp<SkSurface> dSurface;
-SkCanvas* dCanvas;
 GLFWwindow* window;
+#endif
+// the offscreen backend renders frames on several threads, each with its own surface
+thread_local sk_sp<SkSurface> dSurface;
+thread_local SkCanvas* dCanvas;
 
 
-double firstFrequency = -1;
+thread_local double firstFrequency = -1;
 const bool usefirstFrequency = true;
 int counter = 0;
 double avgError = 0, currentAvgError = 0;
@@ -99,6 +125,7 @@ double binToFrequency(int bin, int nfft, int sampleRate) {
     return fRes * bin; 
 }
 
+#ifndef OFFSCREEN
 void error_callback(int error, const char* description) {
 	fputs(description, stderr);
 }
@@ -170,22 +197,66 @@ void cleanup_skia() {
 	//dSurface.delete();
 	//delete dContext;
 }
+#endif
 
 const int kWidth = 1200;
 const int kHeight = 640;
 
 
+// Laid out text of recently drawn labels, so labels that did not change since the
+// last frame are not shaped again. Small and searched linearly, the oldest entry
+// is replaced when full.
+struct TextCache {
+    struct Entry {
+        std::string text;
+        float size = 0;
+        sk_sp<SkTextBlob> blob;
+        uint64_t used = 0;
+    };
+    static constexpr std::size_t CAPACITY = 32;
+    std::vector<Entry> entries;
+    uint64_t clock = 0;
+
+    const sk_sp<SkTextBlob>& get(const char* text, const SkFont& font) {
+        clock++;
+        Entry* oldest = nullptr;
+        for (Entry& entry : entries) {
+            if (entry.size == font.getSize() && entry.text == text) {
+                entry.used = clock;
+                return entry.blob;
+            }
+            if (oldest == nullptr || entry.used < oldest->used) {
+                oldest = &entry;
+            }
+        }
+        if (entries.size() < CAPACITY) {
+            entries.emplace_back();
+            oldest = &entries.back();
+        }
+        oldest->text = text;
+        oldest->size = font.getSize();
+        oldest->blob = SkTextBlob::MakeFromText(text, strlen(text), font, SkTextEncoding::kUTF8);
+        oldest->used = clock;
+        return oldest->blob;
+    }
+};
+thread_local TextCache dTextCache;
+
 void DrawString(const char* text, SkFont& font, SkPaint& paint, int x, int y) {
-    auto blob = SkTextBlob::MakeFromText(text, strlen(text), font, SkTextEncoding::kUTF8);
-    dCanvas->drawTextBlob(blob, x, y, paint);
+    dCanvas->drawTextBlob(dTextCache.get(text, font), x, y, paint);
 }
 
 void ClearCanvas() {
     dCanvas->clear( { 1.0, 1.0, 1.0, 1.0 });
+#ifndef OFFSCREEN
     glfwPollEvents();
+#endif
 }
 
-void DrawPoints(std::vector<double> data, double realFrequency, int nfft, int sampleRate, SkColor4f col) {
+// Draws the bins within 100 Hz of realFrequency. Every pixel column gets one vertical
+// stroke from the smallest to the largest bin that falls into it, so the cost of the
+// draw only depends on the plot width and all bins go out in one drawPoints call.
+void DrawPoints(const double* data, std::size_t size, double realFrequency, int nfft, int sampleRate, SkColor4f col) {
     SkPaint paint;
 
     dCanvas->save();
@@ -198,17 +269,13 @@ void DrawPoints(std::vector<double> data, double realFrequency, int nfft, int sa
     int maxIndex = -1;
     double maxValue = -1000;
     double avg = 0;
-    for(int i = 0; i < data.size(); i++) {
+    for(std::size_t i = 0; i < size; i++) {
         avg += data[i];
         if(data[i] > maxValue) {
             maxValue = data[i];
             maxIndex = i;
         }
     }
-    
-    // Sizing of graph
-    int size = data.size();
-    
 
     if (firstFrequency == -1) {
         firstFrequency = maxIndex;
@@ -220,7 +287,7 @@ void DrawPoints(std::vector<double> data, double realFrequency, int nfft, int sa
     double uf = realFrequency + frange;
 
     int lower = std::max(frequencyToBin(lf, nfft, sampleRate), 0);
-    int upper = std::min(frequencyToBin(uf, nfft, sampleRate), size - 1);
+    int upper = std::min(frequencyToBin(uf, nfft, sampleRate), (int)size - 1);
     int nPoints = upper - lower;
 
     double width = kWidth / 2.;
@@ -235,42 +302,63 @@ void DrawPoints(std::vector<double> data, double realFrequency, int nfft, int sa
     int s = 4;
     int ms = 6;
     dCanvas->translate(-kWidth/4, 0);
+
+    // min/max envelope per pixel column, a column with a single bin becomes a
+    // zero length stroke that the square cap turns into a box of size s
+    thread_local std::vector<SkPoint> strokes;
+    strokes.clear();
+    int column = INT_MIN;
+    float top = 0, bottom = 0;
     for(int i = 0; i < nPoints; i++) {
-        int idx = i + lower; 
+        int idx = i + lower;
         double f = binToFrequency(idx, nfft, sampleRate);
-        double pos = (f - lf) / (uf - lf);  
-
-        double h = -data[idx] * height;
-
-
-        if (idx == maxIndex) {
-            paint.setColor4f({ 0, 1, 0, 1.0 });
-            float x1 = pos*width - ms/2.;
-            float y1 = h + ms/2.;
-            float x2 = pos*width + ms/2.;
-            float y2 = h - ms/2.;
-
-            dCanvas->drawRect( { x1, y1, x2, y2 }, paint);
+        int x = (int)std::lround((f - lf) / (uf - lf) * width);
+        float h = -data[idx] * height;
+        if (x != column) {
+            if (column != INT_MIN) {
+                strokes.push_back(SkPoint::Make(column, top));
+                strokes.push_back(SkPoint::Make(column, bottom));
+            }
+            column = x;
+            top = bottom = h;
         }
+        top = std::min(top, h);
+        bottom = std::max(bottom, h);
+    }
+    if (column != INT_MIN) {
+        strokes.push_back(SkPoint::Make(column, top));
+        strokes.push_back(SkPoint::Make(column, bottom));
+    }
 
-        paint.setColor4f(col);
-
-        float x1 = pos*width - s/2;
-        float y1 = h + s/2;
-        float x2 = pos*width + s/2;
-        float y2 = h - s/2;
-        dCanvas->drawRect( { x1, y1, x2, y2 }, paint);
-    }   
+    paint.setColor4f(col);
+    paint.setStyle(SkPaint::kStroke_Style);
+    paint.setStrokeWidth(s);
+    paint.setStrokeCap(SkPaint::kSquare_Cap);
+    dCanvas->drawPoints(SkCanvas::kLines_PointMode, strokes.size(), strokes.data(), paint);
+
+    if (maxIndex >= lower && maxIndex < upper) {
+        double pos = (binToFrequency(maxIndex, nfft, sampleRate) - lf) / (uf - lf);
+        float x = std::lround(pos * width);
+        float h = -data[maxIndex] * height;
+        SkPaint marker;
+        marker.setColor4f({ 0, 1, 0, 1.0 });
+        dCanvas->drawRect( { x - ms/2.f, h - ms/2.f, x + ms/2.f, h + ms/2.f }, marker);
+
+        // only changes when the peak moves to another bin
+        char label[64];
+        snprintf(label, sizeof(label), "%.2f Hz", frequencyResolution * maxIndex);
+        SkFont font;
+        font.setSize(12);
+        SkPaint textPaint;
+        DrawString(label, font, textPaint, x + ms, h - ms);
+    }
 
     dCanvas->translate(kWidth/4, 0);
 
     paint.setColor4f({1.0, 0.0, 0.0, 0.5 }); 
-    paint.setStyle(SkPaint::kStroke_Style);
-    SkPath path;
-    path.moveTo(0, 0);
-    path.lineTo(0, -150);
     paint.setStrokeWidth(1);
-    dCanvas->drawPath(path, paint);
+    paint.setStrokeCap(SkPaint::kButt_Cap);
+    dCanvas->drawLine(0, 0, 0, -150, paint);
 
     /*
     // Draw text stuff
@@ -312,6 +400,181 @@ void DrawPoints(std::vector<double> data, double realFrequency, int nfft, int sa
 
 }
 
+void DrawPoints(const std::vector<double>& data, double realFrequency, int nfft, int sampleRate, SkColor4f col) {
+    DrawPoints(data.data(), data.size(), realFrequency, nfft, sampleRate, col);
+}
+
+
+// History of the spectra of one signal around its tune, as an image of one row per
+// analysis frame. The rows form a ring: a new spectrum overwrites the oldest row and
+// only moves the write position, so adding a row costs one row of pixels no matter
+// how long the history is. Drawing splits the image at the write position into two
+// blits. Rows are added from the analysis thread and drawn from the render thread,
+// which keeps its own copy of the image on a surface of its canvas and only uploads
+// the rows added since the last draw.
+class Waterfall {
+public:
+    // rows spectra are kept, each resampled to columns pixels between lowFrequency and
+    // highFrequency (Hz)
+    Waterfall(int rows, int columns, double lowFrequency, double highFrequency)
+        : rows { rows }, columns { columns }, lowFrequency { lowFrequency }, highFrequency { highFrequency },
+          pixels(rows * columns, 0xFF000000), tunes(rows, 0.0) {
+        // black, blue, red, yellow, white on a log scale
+        const float stops[5][3] = { { 0, 0, 0 }, { 0, 0, 0.6f }, { 0.8f, 0, 0.2f }, { 1, 0.8f, 0 }, { 1, 1, 1 } };
+        for (int i = 0; i < 256; i++) {
+            float t = i / 255.f * 4;
+            int k = std::min((int)t, 3);
+            float a = t - k;
+            uint32_t rgb[3];
+            for (int c = 0; c < 3; c++) {
+                rgb[c] = (uint32_t)std::lround(255 * (stops[k][c] * (1 - a) + stops[k + 1][c] * a));
+            }
+            // RGBA byte order in memory
+            palette[i] = 0xFF000000 | rgb[2] << 16 | rgb[1] << 8 | rgb[0];
+        }
+    }
+
+    // spectrum holds magnitudes of bins binWidth Hz apart, tune is the NAFF tune in Hz
+    void addRow(const double* spectrum, std::size_t size, double binWidth, double tune) {
+        // colour scale follows the largest magnitude, decaying so it can recover
+        thread_local std::vector<float> levels;
+        levels.resize(columns);
+        double columnWidth = (highFrequency - lowFrequency) / columns;
+        double rowMax = 0;
+        for (int c = 0; c < columns; c++) {
+            // largest bin of the column, or the nearest one when bins are wider than pixels
+            double start = std::max(0.0, lowFrequency + c * columnWidth) / binWidth;
+            std::size_t first = std::ceil(start);
+            std::size_t last = std::ceil(std::max(0.0, lowFrequency + (c + 1) * columnWidth) / binWidth);
+            if (first >= last) {
+                first = std::lround(start + 0.5 * columnWidth / binWidth);
+                last = first + 1;
+            }
+            double level = 0;
+            for (std::size_t b = first; b < last && b < size; b++) {
+                level = std::max(level, spectrum[b]);
+            }
+            levels[c] = level;
+            rowMax = std::max(rowMax, level);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        scale = std::max(rowMax, scale * 0.99);
+        uint32_t* row = pixels.data() + (std::size_t)head * columns;
+        // 60 dB from black to white
+        double norm = scale > 0 ? 1.0 / scale : 0.0;
+        for (int c = 0; c < columns; c++) {
+            double db = 20 * std::log10(std::max(levels[c] * norm, 1e-3));
+            row[c] = palette[std::min(255, std::max(0, (int)((db + 60) / 60 * 255)))];
+        }
+        tunes[head] = tune;
+        head = (head + 1) % rows;
+        filled = std::min(filled + 1, rows);
+        added++;
+    }
+
+    // Oldest row at the top, newest at the bottom, tune trace on top of the image
+    // Always called from the same thread with canvases of the same kind
+    void draw(SkCanvas* canvas, float x, float y, float w, float h) {
+        thread_local std::vector<SkPoint> trace;
+        SkImageInfo info = SkImageInfo::Make(columns, rows, kRGBA_8888_SkColorType, kOpaque_SkAlphaType);
+        if (surface == nullptr) {
+            // on the GPU for a GPU canvas, so only new rows are sent to the texture
+            surface = canvas->makeSurface(info);
+            if (surface == nullptr) {
+                surface = SkSurface::MakeRaster(info);
+            }
+            if (surface == nullptr) {
+                return;
+            }
+            staged.resize(pixels.size());
+            uploaded = 0;
+        }
+        int newest, count, fresh;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (filled == 0) {
+                return;
+            }
+            newest = head;
+            count = filled;
+            // rows added since the last draw, staged so the upload happens unlocked
+            fresh = (int)std::min<uint64_t>(added - uploaded, filled);
+            for (int i = 0; i < fresh; i++) {
+                int row = (newest - fresh + i + rows) % rows;
+                std::memcpy(staged.data() + (std::size_t)row * columns, pixels.data() + (std::size_t)row * columns,
+                    columns * sizeof(uint32_t));
+            }
+            uploaded = added;
+            trace.clear();
+            for (int i = 0; i < count; i++) {
+                double tune = tunes[(newest - count + i + rows) % rows];
+                float px = x + (tune - lowFrequency) / (highFrequency - lowFrequency) * w;
+                trace.push_back(SkPoint::Make(std::min(std::max(px, x), x + w), y + (i + 0.5f) * h / rows));
+            }
+        }
+
+        // the fresh rows end at newest and wrap around at most once
+        int first = (newest - fresh + rows) % rows;
+        int tail = std::min(fresh, rows - first);
+        if (tail > 0) {
+            uploadRows(first, tail);
+        }
+        if (fresh > tail) {
+            uploadRows(0, fresh - tail);
+        }
+        // released at the end of the draw, so the next upload does not copy the surface
+        sk_sp<SkImage> image = surface->makeImageSnapshot();
+
+        // rows [newest, rows) are older than rows [0, newest)
+        float rowHeight = h / rows;
+        int older = std::min(count, rows - newest);
+        float top = y;
+        if (count == rows && older > 0) {
+            canvas->drawImageRect(image, SkRect::MakeXYWH(0, newest, columns, older),
+                SkRect::MakeXYWH(x, top, w, older * rowHeight), nullptr);
+            top += older * rowHeight;
+        }
+        int newer = count == rows ? newest : count;
+        if (newer > 0) {
+            canvas->drawImageRect(image, SkRect::MakeXYWH(0, newest - newer, columns, newer),
+                SkRect::MakeXYWH(x, top, w, newer * rowHeight), nullptr);
+        }
+
+        SkPaint paint;
+        paint.setColor4f({ 0.0, 1.0, 0.0, 1.0 });
+        paint.setStyle(SkPaint::kStroke_Style);
+        paint.setStrokeWidth(1.5);
+        paint.setAntiAlias(true);
+        canvas->drawPoints(SkCanvas::kPolygon_PointMode, trace.size(), trace.data(), paint);
+    }
+
+private:
+    void uploadRows(int first, int count) {
+        SkImageInfo info = SkImageInfo::Make(columns, count, kRGBA_8888_SkColorType, kOpaque_SkAlphaType);
+        surface->writePixels(SkPixmap(info, staged.data() + (std::size_t)first * columns, columns * sizeof(uint32_t)), 0, first);
+    }
+
+    int rows;
+    int columns;
+    double lowFrequency;
+    double highFrequency;
+    std::vector<uint32_t> pixels;
+    std::vector<double> tunes;
+    uint32_t palette[256];
+    double scale = 0;
+    int head = 0;
+    int filled = 0;
+    // rows ever added, and how many of them the surface has seen
+    uint64_t added = 0;
+    uint64_t uploaded = 0;
+    std::mutex mutex;
+    // render thread only
+    sk_sp<SkSurface> surface;
+    std::vector<uint32_t> staged;
+};
+
+#ifndef OFFSCREEN
 bool FlushCanvas() {
     dContext->flush();
     glfwSwapBuffers(window);
@@ -356,4 +619,121 @@ int InitWindow(void) {
 	// Draw to the surface via its SkCanvas.
 	dCanvas = dSurface->getCanvas(); // We don't manage this pointer's lifetime.
     return 0;
-}
\ No newline at end of file
+}
+#else
+// Raster surface of the calling thread, RGBA so raw frames can go straight to a video
+// encoder (ffmpeg -f rawvideo -pix_fmt rgba -s 1200x640 -i -)
+bool InitOffscreen(int w = kWidth, int h = kHeight) {
+    SkImageInfo info = SkImageInfo::Make(w, h, kRGBA_8888_SkColorType, kPremul_SkAlphaType);
+    dSurface = SkSurface::MakeRaster(info);
+    if (dSurface == nullptr) {
+        std::cerr << "Raster surface not created" << std::endl;
+        return false;
+    }
+    dCanvas = dSurface->getCanvas();
+    return true;
+}
+
+// Nothing to present on a raster surface, the frame is read with ReadCanvas
+bool FlushCanvas() {
+    return true;
+}
+
+bool ReadCanvas(SkPixmap& pixmap) {
+    return dSurface != nullptr && dSurface->peekPixels(&pixmap);
+}
+
+
+// Destination of rendered frames, write is called from the rendering threads for
+// every frame. A frame that failed to render comes with an empty pixmap, it is not
+// written but must not hold up the frames after it.
+class FrameOutput {
+public:
+    virtual ~FrameOutput() { }
+    virtual bool write(std::size_t frame, const SkPixmap& pixmap) = 0;
+};
+
+// One PNG per frame, the file name is a pattern of the frame index such as
+// "frames/%06zu.png" (see outputName). Frames are encoded independently on the
+// rendering threads.
+class PNGFrames : public FrameOutput {
+public:
+    PNGFrames(const std::string& pattern): pattern { pattern } {
+        // throws on a bad pattern before the first frame is rendered
+        outputName(pattern, 0);
+    }
+
+    bool write(std::size_t frame, const SkPixmap& pixmap) override {
+        if (pixmap.addr() == nullptr) {
+            return false;
+        }
+        SkFILEWStream stream(outputName(pattern, frame).c_str());
+        return stream.isValid() && SkEncodeImage(&stream, pixmap, SkEncodedImageFormat::kPNG, 100);
+    }
+
+private:
+    std::string pattern;
+};
+
+// All frames back to back as raw pixels in frame order, e.g. into a pipe to ffmpeg.
+// A thread that finishes a frame early waits until the frames before it are written.
+class RawFrames : public FrameOutput {
+public:
+    RawFrames(FILE* out): out { out } { }
+
+    bool write(std::size_t frame, const SkPixmap& pixmap) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        turn.wait(lock, [&]() { return next == frame; });
+        // an empty frame only gives the turn to the next one
+        bool ok = pixmap.addr() != nullptr;
+        for (int y = 0; y < pixmap.height(); y++) {
+            ok = ok && fwrite(pixmap.addr(0, y), pixmap.info().minRowBytes(), 1, out) == 1;
+        }
+        next++;
+        turn.notify_all();
+        return ok;
+    }
+
+private:
+    FILE* out;
+    std::size_t next = 0;
+    std::mutex mutex;
+    std::condition_variable turn;
+};
+
+// Renders frames [0, count) on the given number of threads. draw(frame) is called on
+// a worker thread with that thread's canvas and uses the usual ClearCanvas/DrawPoints,
+// frames are handed out one at a time so uneven frames balance out. Returns false if
+// a surface could not be created or a frame could not be written.
+bool RenderFrames(std::size_t count, unsigned threads, const std::function<void(std::size_t)>& draw,
+        FrameOutput& output, int w = kWidth, int h = kHeight) {
+    std::atomic<std::size_t> nextFrame { 0 };
+    std::atomic<bool> ok { true };
+    auto worker = [&]() {
+        bool ready = InitOffscreen(w, h);
+        for (std::size_t frame = nextFrame++; frame < count; frame = nextFrame++) {
+            SkPixmap pixmap;
+            if (ready && ok) {
+                draw(frame);
+                FlushCanvas();
+                ReadCanvas(pixmap);
+            }
+            // failed frames are still passed on (empty) so ordered outputs do not stall
+            if (!output.write(frame, pixmap)) {
+                ok = false;
+            }
+        }
+        dCanvas = nullptr;
+        dSurface.reset();
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+    return ok;
+}
+#endif
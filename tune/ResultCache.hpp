@@ -0,0 +1,303 @@
+#ifndef RESULTCACHE_HPP
+#define RESULTCACHE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "algos/TuneEstimator.hpp"
+
+// On disk cache of tune results, so unchanged inputs are never opened or analysed
+// again. Entries are addressed by a 128 bit hash of everything that determines them:
+// the identity of the input file (its content, or its path, size and modification
+// time), the analysis settings and the bunch. Every entry is one file in a two
+// level directory tree named after the hash. Hits refresh the modification time of
+// the entry, and when the cache grows beyond its size bound the least recently used
+// entries are deleted.
+class ResultCache {
+    public:
+        enum class Identity {
+            STAT,
+            CONTENT
+        };
+
+        struct Key {
+            uint64_t high = 0;
+            uint64_t low = 0;
+        };
+
+        // What is known about an input file without opening it
+        struct FileInfo {
+            char plane[16] = {};
+            uint64_t turns = 0;
+            uint64_t bunches = 0;
+        };
+
+        ResultCache(const std::string& directory, std::size_t maxBytes, Identity identity = Identity::STAT)
+            : directory { directory }, maxBytes { maxBytes }, identity { identity } {
+            std::filesystem::create_directories(directory);
+            for(const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+                if(entry.is_regular_file()) {
+                    totalBytes += entry.file_size();
+                }
+            }
+            if(totalBytes > maxBytes) {
+                evict();
+            }
+        }
+
+        // Key of one input file under one analysis setup, settings is a description of
+        // everything else that changes the results (estimator, parameters, window, hop)
+        Key fileKey(const std::string& filename, const std::string& settings) const {
+            std::string id;
+            if(identity == Identity::CONTENT) {
+                Key content = hashFile(filename);
+                id = "content:" + hex(content);
+            }
+            else {
+                struct stat st;
+                if(stat(filename.c_str(), &st) != 0) {
+                    throw std::runtime_error("Can not stat " + filename);
+                }
+                id = "stat:" + std::filesystem::absolute(filename).lexically_normal().string() + ":" +
+                    std::to_string(st.st_size) + ":" +
+                    std::to_string((int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+            }
+            id += "|" + settings;
+            return hash(id.data(), id.size());
+        }
+
+        bool getInfo(const Key& file, FileInfo& info) {
+            std::vector<uint8_t> payload;
+            if(!load(entryKey(file, INFO), payload) || payload.size() != sizeof(FileInfo)) {
+                return false;
+            }
+            std::memcpy(&info, payload.data(), sizeof(FileInfo));
+            return true;
+        }
+
+        void putInfo(const Key& file, const FileInfo& info) {
+            store(entryKey(file, INFO), &info, sizeof(info));
+        }
+
+        bool getResults(const Key& file, uint64_t bunch, std::vector<TuneResult>& results) {
+            std::vector<uint8_t> payload;
+            if(!load(entryKey(file, bunch), payload) || payload.size() % sizeof(TuneResult) != 0) {
+                return false;
+            }
+            results.resize(payload.size() / sizeof(TuneResult));
+            std::memcpy(results.data(), payload.data(), payload.size());
+            return true;
+        }
+
+        void putResults(const Key& file, uint64_t bunch, const std::vector<TuneResult>& results) {
+            putResults(file, bunch, results.data(), results.size());
+        }
+
+        void putResults(const Key& file, uint64_t bunch, const TuneResult* results, std::size_t count) {
+            store(entryKey(file, bunch), results, count * sizeof(TuneResult));
+        }
+
+        std::size_t getHits() const {
+            return hits;
+        }
+
+        std::size_t getMisses() const {
+            return misses;
+        }
+
+        std::size_t getBytes() const {
+            return totalBytes;
+        }
+
+        static std::string hex(const Key& key) {
+            char text[33];
+            snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)key.high, (unsigned long long)key.low);
+            return text;
+        }
+
+        // Two differently seeded 64 bit hashes over 8 byte words, not cryptographic
+        static Key hash(const void* data, std::size_t size) {
+            return { hash64(data, size, 0x243f6a8885a308d3ull), hash64(data, size, 0x13198a2e03707344ull) };
+        }
+
+    private:
+        static constexpr char MAGIC[8] = { 'T', 'U', 'N', 'E', 'C', 'A', 'C', 'H' };
+        static constexpr uint64_t INFO = ~0ull;
+
+        struct Header {
+            char magic[8];
+            uint64_t high;
+            uint64_t low;
+            uint64_t size;
+        };
+
+        static uint64_t mix(uint64_t x) {
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdull;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ull;
+            return x ^ (x >> 33);
+        }
+
+        static uint64_t hash64(const void* data, std::size_t size, uint64_t seed) {
+            const uint8_t* bytes = (const uint8_t*)data;
+            uint64_t h = mix(seed ^ size);
+            std::size_t i = 0;
+            for(; i + 8 <= size; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, bytes + i, 8);
+                h = mix(h ^ (word * 0x9e3779b97f4a7c15ull)) + seed;
+            }
+            uint64_t tail = 0;
+            std::memcpy(&tail, bytes + i, size - i);
+            return mix(h ^ tail ^ (size << 56));
+        }
+
+        static Key hashFile(const std::string& filename) {
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if(fd < 0) {
+                throw std::runtime_error("Can not open " + filename);
+            }
+            struct stat st;
+            if(fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error("Can not stat " + filename);
+            }
+            if(st.st_size == 0) {
+                ::close(fd);
+                return hash(nullptr, 0);
+            }
+            void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(ptr == MAP_FAILED) {
+                throw std::runtime_error("Mapping " + filename + " failed");
+            }
+            madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+            Key key = hash(ptr, st.st_size);
+            munmap(ptr, st.st_size);
+            return key;
+        }
+
+        static Key entryKey(const Key& file, uint64_t item) {
+            uint64_t words[3] = { file.high, file.low, item };
+            return hash(words, sizeof(words));
+        }
+
+        std::filesystem::path entryPath(const Key& key) const {
+            std::string name = hex(key);
+            return std::filesystem::path(directory) / name.substr(0, 2) / name.substr(2);
+        }
+
+        bool load(const Key& key, std::vector<uint8_t>& payload) {
+            std::filesystem::path path = entryPath(key);
+            FILE* in = fopen(path.c_str(), "rb");
+            if(in == nullptr) {
+                misses++;
+                return false;
+            }
+            // the payload size is checked against the entry before anything is allocated
+            // for it, a damaged or foreign entry is a miss
+            Header header;
+            struct stat st;
+            bool valid = fread(&header, sizeof(header), 1, in) == 1 &&
+                std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                header.high == key.high && header.low == key.low &&
+                fstat(fileno(in), &st) == 0 && (uint64_t)st.st_size >= sizeof(header) &&
+                header.size == (uint64_t)st.st_size - sizeof(header);
+            if(valid) {
+                payload.resize(header.size);
+                valid = header.size == 0 || fread(payload.data(), header.size, 1, in) == 1;
+            }
+            fclose(in);
+            if(!valid) {
+                misses++;
+                return false;
+            }
+            // the modification time is the last use for the LRU eviction
+            utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+            hits++;
+            return true;
+        }
+
+        void store(const Key& key, const void* payload, std::size_t size) {
+            std::filesystem::path path = entryPath(key);
+            std::filesystem::create_directories(path.parent_path());
+            // write to a temporary and rename so concurrent readers never see half an entry
+            std::string tempname = path.string() + ".tmp" + std::to_string(getpid());
+            FILE* out = fopen(tempname.c_str(), "wb");
+            if(out == nullptr) {
+                throw std::runtime_error("Can not write cache entry " + tempname);
+            }
+            Header header;
+            std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.high = key.high;
+            header.low = key.low;
+            header.size = size;
+            bool ok = fwrite(&header, sizeof(header), 1, out) == 1 && (size == 0 || fwrite(payload, size, 1, out) == 1);
+            ok = fclose(out) == 0 && ok;
+            std::error_code error;
+            std::size_t previous = std::filesystem::exists(path, error) ? std::filesystem::file_size(path, error) : 0;
+            if(!ok || rename(tempname.c_str(), path.c_str()) != 0) {
+                unlink(tempname.c_str());
+                throw std::runtime_error("Writing cache entry " + path.string() + " failed");
+            }
+            totalBytes += sizeof(header) + size - std::min(previous, totalBytes);
+            if(totalBytes > maxBytes) {
+                evict();
+            }
+        }
+
+        // Deletes the least recently used entries until the cache is below 90% of its bound
+        void evict() {
+            struct Entry {
+                std::filesystem::path path;
+                std::size_t size;
+                int64_t used;
+            };
+            std::vector<Entry> entries;
+            std::size_t total = 0;
+            for(const auto& item : std::filesystem::recursive_directory_iterator(directory)) {
+                struct stat st;
+                if(!item.is_regular_file() || stat(item.path().c_str(), &st) != 0) {
+                    continue;
+                }
+                entries.push_back({ item.path(), (std::size_t)st.st_size, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec });
+                total += st.st_size;
+            }
+            std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+                return a.used < b.used;
+            });
+            std::size_t target = maxBytes / 10 * 9;
+            for(const Entry& entry : entries) {
+                if(total <= target) {
+                    break;
+                }
+                std::error_code error;
+                if(std::filesystem::remove(entry.path, error)) {
+                    total -= entry.size;
+                }
+            }
+            totalBytes = total;
+        }
+
+        std::string directory;
+        std::size_t maxBytes;
+        Identity identity;
+        std::size_t totalBytes = 0;
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+};
+
+#endif
@@ -0,0 +1,571 @@
+#ifndef RESULTSSTORE_HPP
+#define RESULTSSTORE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "algos/TuneEstimator.hpp"
+
+// Columnar store for per bunch tune time series.
+//
+// Rows (file id, bunch, window start, tune, amplitude, phase, significance) are
+// collected into blocks. Every column of a block is encoded on its own, integer
+// columns as zigzag varints of the difference to the previous row, floating point
+// columns XORed with the previous row and byte shuffled, and then deflated. At
+// close a footer with the file table, the block table and an index of row runs
+// sorted by (fill, bunch) is appended, so the reader can map the file and only
+// decode the blocks a query touches.
+//
+//   header | block 0 | block 1 | ... | footer | footer offset, magic
+
+namespace ResultsStore {
+
+    const char MAGIC[8] = { 'T', 'U', 'N', 'E', 'R', 'E', 'S', 0 };
+    const uint32_t VERSION = 1;
+    const std::size_t COLUMNS = 7;
+
+    // Fill number from the ADTObsBox file name, e.g. 07355_64k_B1H_... is fill 7355
+    inline uint32_t parseFill(const std::string& path) {
+        std::string name = std::filesystem::path(path).filename().string();
+        uint32_t fill = 0;
+        for(std::size_t i = 0; i < name.size() && std::isdigit((unsigned char)name[i]); i++) {
+            fill = fill * 10 + (name[i] - '0');
+        }
+        return fill;
+    }
+
+    // All rows of a block or a query, one vector per column
+    struct Columns {
+        std::vector<uint32_t> file;
+        std::vector<uint32_t> bunch;
+        std::vector<uint64_t> start;
+        std::vector<double> tune;
+        std::vector<double> amplitude;
+        std::vector<double> phase;
+        std::vector<double> significance;
+
+        std::size_t size() const {
+            return tune.size();
+        }
+
+        void clear() {
+            file.clear();
+            bunch.clear();
+            start.clear();
+            tune.clear();
+            amplitude.clear();
+            phase.clear();
+            significance.clear();
+        }
+
+        void append(const Columns& other, std::size_t first, std::size_t count) {
+            file.insert(file.end(), other.file.begin() + first, other.file.begin() + first + count);
+            bunch.insert(bunch.end(), other.bunch.begin() + first, other.bunch.begin() + first + count);
+            start.insert(start.end(), other.start.begin() + first, other.start.begin() + first + count);
+            tune.insert(tune.end(), other.tune.begin() + first, other.tune.begin() + first + count);
+            amplitude.insert(amplitude.end(), other.amplitude.begin() + first, other.amplitude.begin() + first + count);
+            phase.insert(phase.end(), other.phase.begin() + first, other.phase.begin() + first + count);
+            significance.insert(significance.end(), other.significance.begin() + first, other.significance.begin() + first + count);
+        }
+    };
+
+    struct FileEntry {
+        std::string path;
+        uint32_t fill;
+    };
+
+    // A run of consecutive rows that share fill and bunch
+    struct IndexEntry {
+        uint32_t fill;
+        uint32_t bunch;
+        uint64_t firstRow;
+        uint64_t rows;
+    };
+
+    struct BlockEntry {
+        uint64_t firstRow;
+        uint64_t rows;
+        uint64_t offset[COLUMNS];
+        uint64_t size[COLUMNS];
+    };
+
+    // ---- column codecs ----
+
+    inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+        while(value >= 0x80) {
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+    }
+
+    inline uint64_t getVarint(const uint8_t*& in, const uint8_t* end) {
+        uint64_t value = 0;
+        for(unsigned shift = 0; in < end && shift < 64; shift += 7) {
+            uint8_t byte = *in++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if(!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Truncated varint in results store");
+    }
+
+    template<class T>
+    void encodeDelta(const std::vector<T>& values, std::vector<uint8_t>& out) {
+        int64_t previous = 0;
+        for(T value : values) {
+            int64_t delta = (int64_t)value - previous;
+            putVarint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+            previous = (int64_t)value;
+        }
+    }
+
+    template<class T>
+    void decodeDelta(const std::vector<uint8_t>& in, std::size_t rows, std::vector<T>& values) {
+        const uint8_t* p = in.data();
+        const uint8_t* end = p + in.size();
+        int64_t previous = 0;
+        // every varint takes at least one byte
+        if(in.size() < rows) {
+            throw std::runtime_error("Truncated integer column in results store");
+        }
+        values.resize(rows);
+        for(std::size_t i = 0; i < rows; i++) {
+            uint64_t zigzag = getVarint(p, end);
+            previous += (int64_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            values[i] = (T)previous;
+        }
+    }
+
+    // Neighbouring windows of one bunch give close values, so the XOR with the
+    // previous row leaves the sign, exponent and top mantissa bytes mostly zero and
+    // shuffling groups those bytes together for deflate.
+    inline void encodeDouble(const std::vector<double>& values, std::vector<uint8_t>& out) {
+        std::size_t n = values.size();
+        out.resize(n * sizeof(uint64_t));
+        uint64_t previous = 0;
+        for(std::size_t i = 0; i < n; i++) {
+            uint64_t bits;
+            std::memcpy(&bits, &values[i], sizeof(bits));
+            uint64_t x = bits ^ previous;
+            previous = bits;
+            for(std::size_t b = 0; b < sizeof(uint64_t); b++) {
+                out[b * n + i] = (uint8_t)(x >> (8 * b));
+            }
+        }
+    }
+
+    inline void decodeDouble(const std::vector<uint8_t>& in, std::size_t rows, std::vector<double>& values) {
+        if(in.size() != rows * sizeof(uint64_t)) {
+            throw std::runtime_error("Corrupt floating point column in results store");
+        }
+        values.resize(rows);
+        uint64_t previous = 0;
+        for(std::size_t i = 0; i < rows; i++) {
+            uint64_t x = 0;
+            for(std::size_t b = 0; b < sizeof(uint64_t); b++) {
+                x |= (uint64_t)in[b * rows + i] << (8 * b);
+            }
+            previous ^= x;
+            std::memcpy(&values[i], &previous, sizeof(previous));
+        }
+    }
+
+    inline void deflateColumn(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int level) {
+        uLongf size = compressBound(in.size());
+        out.resize(size);
+        if(compress2(out.data(), &size, in.data(), in.size(), level) != Z_OK) {
+            throw std::runtime_error("Compressing results column failed");
+        }
+        out.resize(size);
+    }
+
+    // deflate expands a stream at most 1032 times
+    const uint64_t MAX_DEFLATE_RATIO = 1032;
+
+    // maxSize bounds the raw size stored in front of the deflated stream, which comes
+    // from the file, before anything is allocated for it
+    inline void inflateColumn(const uint8_t* in, std::size_t size, std::size_t maxSize, std::vector<uint8_t>& out) {
+        if(size < sizeof(uint64_t)) {
+            throw std::runtime_error("Corrupt column in results store");
+        }
+        uint64_t rawSize;
+        std::memcpy(&rawSize, in, sizeof(rawSize));
+        if(rawSize > maxSize || rawSize / MAX_DEFLATE_RATIO > size - sizeof(rawSize)) {
+            throw std::runtime_error("Corrupt column size in results store");
+        }
+        out.resize(rawSize);
+        uLongf outSize = rawSize;
+        if(uncompress(out.data(), &outSize, in + sizeof(rawSize), size - sizeof(rawSize)) != Z_OK || outSize != rawSize) {
+            throw std::runtime_error("Inflating results column failed");
+        }
+    }
+
+
+    class Writer {
+        public:
+            Writer(const std::string& filename, std::size_t blockRows = 1 << 16, int level = 6)
+                : filename { filename }, blockRows { blockRows }, level { level } {
+                out = fopen(filename.c_str(), "wb");
+                if(out == nullptr) {
+                    throw std::runtime_error("Can not open results store " + filename + " for writing");
+                }
+                write(MAGIC, sizeof(MAGIC));
+                write(&VERSION, sizeof(VERSION));
+            }
+
+            ~Writer() {
+                if(out != nullptr) {
+                    try {
+                        close();
+                    }
+                    catch(...) {
+                    }
+                }
+            }
+
+            Writer(const Writer&) = delete;
+            Writer& operator=(const Writer&) = delete;
+
+            // Registers an input file and returns the id its rows are stored with
+            uint32_t addFile(const std::string& path) {
+                files.push_back({ path, parseFill(path) });
+                return files.size() - 1;
+            }
+
+            void append(uint32_t file, uint32_t bunch, uint64_t start, const TuneResult& result) {
+                if(file >= files.size()) {
+                    throw std::runtime_error("Unknown file id in results store");
+                }
+                uint32_t fill = files[file].fill;
+                if(index.empty() || index.back().fill != fill || index.back().bunch != bunch ||
+                        index.back().firstRow + index.back().rows != rows) {
+                    index.push_back({ fill, bunch, rows, 0 });
+                }
+                index.back().rows++;
+
+                block.file.push_back(file);
+                block.bunch.push_back(bunch);
+                block.start.push_back(start);
+                block.tune.push_back(result.tune);
+                block.amplitude.push_back(result.amplitude);
+                block.phase.push_back(result.phase);
+                block.significance.push_back(result.significance);
+                rows++;
+                if(block.size() >= blockRows) {
+                    flushBlock();
+                }
+            }
+
+            void close() {
+                if(out == nullptr) {
+                    return;
+                }
+                flushBlock();
+
+                std::sort(index.begin(), index.end(), [](const IndexEntry& a, const IndexEntry& b) {
+                    return a.fill != b.fill ? a.fill < b.fill : a.bunch != b.bunch ? a.bunch < b.bunch : a.firstRow < b.firstRow;
+                });
+
+                uint64_t footerOffset = position;
+                uint64_t count = files.size();
+                write(&count, sizeof(count));
+                for(const FileEntry& file : files) {
+                    uint64_t length = file.path.size();
+                    write(&file.fill, sizeof(file.fill));
+                    write(&length, sizeof(length));
+                    write(file.path.data(), length);
+                }
+                count = blocks.size();
+                write(&count, sizeof(count));
+                write(blocks.data(), blocks.size() * sizeof(BlockEntry));
+                count = index.size();
+                write(&count, sizeof(count));
+                write(index.data(), index.size() * sizeof(IndexEntry));
+                write(&footerOffset, sizeof(footerOffset));
+                write(MAGIC, sizeof(MAGIC));
+
+                int status = fclose(out);
+                out = nullptr;
+                if(status != 0) {
+                    throw std::runtime_error("Closing results store " + filename + " failed");
+                }
+            }
+
+            uint64_t getRows() const {
+                return rows;
+            }
+
+        private:
+            void write(const void* data, std::size_t size) {
+                if(size > 0 && fwrite(data, 1, size, out) != size) {
+                    throw std::runtime_error("Writing results store " + filename + " failed");
+                }
+                position += size;
+            }
+
+            void writeColumn(BlockEntry& entry, std::size_t column) {
+                deflateColumn(raw, packed, level);
+                uint64_t rawSize = raw.size();
+                entry.offset[column] = position;
+                entry.size[column] = sizeof(rawSize) + packed.size();
+                write(&rawSize, sizeof(rawSize));
+                write(packed.data(), packed.size());
+                raw.clear();
+            }
+
+            void flushBlock() {
+                if(block.size() == 0) {
+                    return;
+                }
+                BlockEntry entry;
+                entry.firstRow = rows - block.size();
+                entry.rows = block.size();
+                encodeDelta(block.file, raw);
+                writeColumn(entry, 0);
+                encodeDelta(block.bunch, raw);
+                writeColumn(entry, 1);
+                encodeDelta(block.start, raw);
+                writeColumn(entry, 2);
+                encodeDouble(block.tune, raw);
+                writeColumn(entry, 3);
+                encodeDouble(block.amplitude, raw);
+                writeColumn(entry, 4);
+                encodeDouble(block.phase, raw);
+                writeColumn(entry, 5);
+                encodeDouble(block.significance, raw);
+                writeColumn(entry, 6);
+                blocks.push_back(entry);
+                block.clear();
+            }
+
+            std::string filename;
+            std::size_t blockRows;
+            int level;
+            FILE* out = nullptr;
+            uint64_t position = 0;
+            uint64_t rows = 0;
+            Columns block;
+            std::vector<uint8_t> raw;
+            std::vector<uint8_t> packed;
+            std::vector<FileEntry> files;
+            std::vector<BlockEntry> blocks;
+            std::vector<IndexEntry> index;
+    };
+
+
+    class Reader {
+        public:
+            Reader(const std::string& filename) {
+                int fd = ::open(filename.c_str(), O_RDONLY);
+                if(fd < 0) {
+                    throw std::runtime_error("Can not open results store " + filename);
+                }
+                struct stat st;
+                if(fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    throw std::runtime_error("Can not stat results store " + filename);
+                }
+                size = st.st_size;
+                void* ptr = size > 0 ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+                ::close(fd);
+                if(ptr == MAP_FAILED) {
+                    throw std::runtime_error("Mapping results store " + filename + " failed");
+                }
+                map = (const uint8_t*)ptr;
+                try {
+                    parseFooter();
+                }
+                catch(...) {
+                    munmap((void*)map, size);
+                    throw;
+                }
+            }
+
+            ~Reader() {
+                munmap((void*)map, size);
+            }
+
+            Reader(const Reader&) = delete;
+            Reader& operator=(const Reader&) = delete;
+
+            uint64_t getRows() const {
+                return blocks.empty() ? 0 : blocks.back().firstRow + blocks.back().rows;
+            }
+
+            const std::vector<FileEntry>& getFiles() const {
+                return files;
+            }
+
+            const std::vector<IndexEntry>& getIndex() const {
+                return index;
+            }
+
+            std::size_t getBlocks() const {
+                return blocks.size();
+            }
+
+            // Decodes every column of one block
+            void readBlock(std::size_t block, Columns& columns) const {
+                const BlockEntry& entry = blocks.at(block);
+                std::vector<uint8_t> raw;
+                column(entry, 0, raw);
+                decodeDelta(raw, entry.rows, columns.file);
+                column(entry, 1, raw);
+                decodeDelta(raw, entry.rows, columns.bunch);
+                column(entry, 2, raw);
+                decodeDelta(raw, entry.rows, columns.start);
+                column(entry, 3, raw);
+                decodeDouble(raw, entry.rows, columns.tune);
+                column(entry, 4, raw);
+                decodeDouble(raw, entry.rows, columns.amplitude);
+                column(entry, 5, raw);
+                decodeDouble(raw, entry.rows, columns.phase);
+                column(entry, 6, raw);
+                decodeDouble(raw, entry.rows, columns.significance);
+            }
+
+            // All rows of one bunch in one fill, in the order they were written
+            Columns query(uint32_t fill, uint32_t bunch) const {
+                Columns result;
+                auto range = std::equal_range(index.begin(), index.end(), IndexEntry { fill, bunch, 0, 0 },
+                    [](const IndexEntry& a, const IndexEntry& b) {
+                        return a.fill != b.fill ? a.fill < b.fill : a.bunch < b.bunch;
+                    });
+                Columns decoded;
+                std::size_t decodedBlock = blocks.size();
+                for(auto it = range.first; it != range.second; ++it) {
+                    uint64_t row = it->firstRow;
+                    uint64_t end = it->firstRow + it->rows;
+                    while(row < end) {
+                        std::size_t block = findBlock(row);
+                        if(block != decodedBlock) {
+                            readBlock(block, decoded);
+                            decodedBlock = block;
+                        }
+                        uint64_t first = row - blocks[block].firstRow;
+                        uint64_t count = std::min(end, blocks[block].firstRow + blocks[block].rows) - row;
+                        result.append(decoded, first, count);
+                        row += count;
+                    }
+                }
+                return result;
+            }
+
+        private:
+            void column(const BlockEntry& entry, std::size_t column, std::vector<uint8_t>& raw) const {
+                if(entry.offset[column] > size || entry.size[column] > size - entry.offset[column]) {
+                    throw std::runtime_error("Column outside of results store");
+                }
+                // the first three columns are varints of at most 10 bytes per row, the others doubles
+                std::size_t perRow = column < 3 ? 10 : sizeof(double);
+                if(entry.rows > SIZE_MAX / perRow) {
+                    throw std::runtime_error("Corrupt block in results store");
+                }
+                inflateColumn(map + entry.offset[column], entry.size[column], entry.rows * perRow, raw);
+            }
+
+            std::size_t findBlock(uint64_t row) const {
+                auto it = std::upper_bound(blocks.begin(), blocks.end(), row, [](uint64_t r, const BlockEntry& b) {
+                    return r < b.firstRow;
+                });
+                return (it - blocks.begin()) - 1;
+            }
+
+            template<class T>
+            void read(uint64_t& offset, T* data, std::size_t count) const {
+                if(!fits(offset, count, sizeof(T))) {
+                    throw std::runtime_error("Footer of results store is truncated");
+                }
+                std::memcpy(data, map + offset, count * sizeof(T));
+                offset += count * sizeof(T);
+            }
+
+            // Whether count entries of entrySize bytes are left after offset, without overflowing
+            bool fits(uint64_t offset, uint64_t count, std::size_t entrySize) const {
+                return offset <= size && count <= (size - offset) / entrySize;
+            }
+
+            // Counts come from the file, they are checked against the bytes left before
+            // anything is allocated for them
+            void checkCount(uint64_t offset, uint64_t count, std::size_t entrySize) const {
+                if(!fits(offset, count, entrySize)) {
+                    throw std::runtime_error("Footer of results store is corrupt");
+                }
+            }
+
+            void parseFooter() {
+                const std::size_t headerSize = sizeof(MAGIC) + sizeof(VERSION);
+                const std::size_t trailerSize = sizeof(uint64_t) + sizeof(MAGIC);
+                uint32_t version;
+                if(size < headerSize + trailerSize || std::memcmp(map, MAGIC, sizeof(MAGIC)) != 0 ||
+                        std::memcmp(map + size - sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0) {
+                    throw std::runtime_error("Not a results store or not closed properly");
+                }
+                std::memcpy(&version, map + sizeof(MAGIC), sizeof(version));
+                if(version != VERSION) {
+                    throw std::runtime_error("Unsupported results store version");
+                }
+                uint64_t offset;
+                std::memcpy(&offset, map + size - trailerSize, sizeof(offset));
+
+                uint64_t count;
+                read(offset, &count, 1);
+                checkCount(offset, count, sizeof(uint32_t) + sizeof(uint64_t));
+                files.resize(count);
+                for(FileEntry& file : files) {
+                    uint64_t length;
+                    read(offset, &file.fill, 1);
+                    read(offset, &length, 1);
+                    checkCount(offset, length, 1);
+                    file.path.resize(length);
+                    read(offset, &file.path[0], length);
+                }
+                read(offset, &count, 1);
+                checkCount(offset, count, sizeof(BlockEntry));
+                blocks.resize(count);
+                read(offset, blocks.data(), count);
+                read(offset, &count, 1);
+                checkCount(offset, count, sizeof(IndexEntry));
+                index.resize(count);
+                read(offset, index.data(), count);
+
+                // blocks follow each other without gaps from row 0, findBlock relies on it
+                uint64_t rows = 0;
+                for(const BlockEntry& block : blocks) {
+                    if(block.firstRow != rows || block.rows == 0 || block.rows > UINT64_MAX - rows) {
+                        throw std::runtime_error("Block table of results store is corrupt");
+                    }
+                    rows += block.rows;
+                }
+                for(const IndexEntry& entry : index) {
+                    if(entry.rows > rows || entry.firstRow > rows - entry.rows) {
+                        throw std::runtime_error("Index of results store points past its rows");
+                    }
+                }
+            }
+
+            const uint8_t* map = nullptr;
+            std::size_t size = 0;
+            std::vector<FileEntry> files;
+            std::vector<BlockEntry> blocks;
+            std::vector<IndexEntry> index;
+    };
+
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef SIGNALSOURCE_HPP
+#define SIGNALSOURCE_HPP
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include "AudioFile.h"
+#include "HDFLib.h"
+
+// A stream of samples that the analysis pulls fixed size blocks from. Blocks are
+// written straight into the caller's buffer, so a source never allocates per read.
+class SignalSource {
+    public:
+        static constexpr std::size_t UNBOUNDED = std::numeric_limits<std::size_t>::max();
+
+        virtual ~SignalSource() { }
+
+        // Copies the next count samples into dest and advances by count. Reads are
+        // all or nothing, false means count samples are not available (yet).
+        virtual bool read(double* dest, std::size_t count) = 0;
+
+        // Moves the read position to sample offset, false for sources that can not seek
+        virtual bool seek(std::size_t offset) {
+            return false;
+        }
+
+        virtual std::size_t getPosition() const = 0;
+
+        // Number of samples in the source, UNBOUNDED for generated and live sources
+        virtual std::size_t getLength() const {
+            return UNBOUNDED;
+        }
+
+        virtual double getSampleRate() const = 0;
+
+        bool readAt(std::size_t offset, double* dest, std::size_t count) {
+            return seek(offset) && read(dest, count);
+        }
+};
+
+
+// Sum of exponentially damped cosines plus white gaussian noise. Every sample only
+// depends on its index, so windows are reproducible after seeking.
+class SyntheticSource : public SignalSource {
+    public:
+        struct Tone {
+            double frequency;
+            double amplitude = 1.0;
+            double phase = 0.0;
+            // amplitude decay rate in 1/s, negative for a growing tone
+            double damping = 0.0;
+        };
+
+        SyntheticSource(double sampleRate, std::vector<Tone> tones, double noise = 0.0, uint64_t seed = 1)
+            : sampleRate { sampleRate }, tones { tones }, noise { noise }, seed { seed } { }
+
+        bool read(double* dest, std::size_t count) override {
+            std::fill(dest, dest + count, 0.0);
+            for(const Tone& tone : tones) {
+                // rotate a phasor instead of calling cos per sample, restarted every
+                // block so the rounding error can not build up
+                double omega = 2 * M_PI * tone.frequency / sampleRate;
+                double decay = tone.damping / sampleRate;
+                std::complex<double> step = std::polar(std::exp(-decay), omega);
+                std::complex<double> phasor = std::polar(tone.amplitude * std::exp(-decay * position),
+                    std::fmod(omega * position, 2 * M_PI) + tone.phase);
+                for(std::size_t i = 0; i < count; i++) {
+                    dest[i] += phasor.real();
+                    phasor *= step;
+                }
+            }
+            if(noise > 0.0) {
+                for(std::size_t i = 0; i < count; i++) {
+                    dest[i] += noise * gaussian(position + i);
+                }
+            }
+            position += count;
+            return true;
+        }
+
+        bool seek(std::size_t offset) override {
+            position = offset;
+            return true;
+        }
+
+        std::size_t getPosition() const override {
+            return position;
+        }
+
+        double getSampleRate() const override {
+            return sampleRate;
+        }
+
+    private:
+        // splitmix64 of the sample index, then Box-Muller
+        double gaussian(std::size_t index) const {
+            uint64_t a = mix(seed ^ (2 * index));
+            uint64_t b = mix(seed ^ (2 * index + 1));
+            double u1 = ((a >> 11) + 1) * (1.0 / 9007199254740992.0);
+            double u2 = (b >> 11) * (1.0 / 9007199254740992.0);
+            return std::sqrt(-2.0 * std::log(u1)) * std::cos(2 * M_PI * u2);
+        }
+
+        static uint64_t mix(uint64_t x) {
+            x += 0x9e3779b97f4a7c15ull;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+
+        double sampleRate;
+        std::vector<Tone> tones;
+        double noise;
+        uint64_t seed;
+        std::size_t position = 0;
+};
+
+
+// One channel of a WAV file, decoded window by window from the mapping
+class AudioSource : public SignalSource {
+    public:
+        AudioSource(const std::string& filename, int channel = 0): channel { channel } {
+            if(!audioFile.map(filename)) {
+                throw std::runtime_error("Mapping audio file " + filename + " failed");
+            }
+            if(channel < 0 || channel >= audioFile.getNumChannels()) {
+                throw std::runtime_error("Audio channel out of range");
+            }
+        }
+
+        bool read(double* dest, std::size_t count) override {
+            if(!audioFile.readChannel(channel, position, count, dest)) {
+                return false;
+            }
+            position += count;
+            return true;
+        }
+
+        bool seek(std::size_t offset) override {
+            if(offset > getLength()) {
+                return false;
+            }
+            position = offset;
+            return true;
+        }
+
+        std::size_t getPosition() const override {
+            return position;
+        }
+
+        std::size_t getLength() const override {
+            return audioFile.getNumSamplesPerChannel();
+        }
+
+        double getSampleRate() const override {
+            return audioFile.getSampleRate();
+        }
+
+    private:
+        AudioFile<double> audioFile;
+        int channel;
+        std::size_t position = 0;
+};
+
+
+// The turn by turn positions of one bunch in an ADTObsBox file. The column is one
+// chunk column in the file, so it is read once and windows are converted from it.
+class HDFBunchSource : public SignalSource {
+    public:
+        HDFBunchSource(const std::string& filename, std::size_t bunch, double revolutionFrequency = 11245.0)
+            : revolutionFrequency { revolutionFrequency } {
+            HDFLib::HDFFile file(filename);
+            file.open();
+            if(bunch >= file.getColumns()) {
+                throw std::runtime_error("Bunch out of range in " + filename);
+            }
+            turns = file.getRows();
+            column = file.getColumnData(bunch);
+            file.close();
+        }
+
+        bool read(double* dest, std::size_t count) override {
+            if(position + count > turns) {
+                return false;
+            }
+            const int16_t* data = column.get() + position;
+            for(std::size_t i = 0; i < count; i++) {
+                dest[i] = data[i];
+            }
+            position += count;
+            return true;
+        }
+
+        bool seek(std::size_t offset) override {
+            if(offset > turns) {
+                return false;
+            }
+            position = offset;
+            return true;
+        }
+
+        std::size_t getPosition() const override {
+            return position;
+        }
+
+        std::size_t getLength() const override {
+            return turns;
+        }
+
+        double getSampleRate() const override {
+            return revolutionFrequency;
+        }
+
+    private:
+        std::unique_ptr<int16_t> column;
+        std::size_t turns = 0;
+        double revolutionFrequency;
+        std::size_t position = 0;
+};
+
+
+// Single producer, single consumer ring of samples. The producer thread calls push,
+// the analysis thread reads whole blocks once they are complete. No locks are taken,
+// head and tail live on separate cache lines so the two threads do not share one.
+class RingBufferSource : public SignalSource {
+    public:
+        RingBufferSource(std::size_t capacity, double sampleRate): sampleRate { sampleRate } {
+            std::size_t size = 1;
+            while(size < capacity) {
+                size <<= 1;
+            }
+            buffer = std::vector<double>(size);
+            mask = size - 1;
+        }
+
+        // Producer side, returns how many samples fit into the ring
+        std::size_t push(const double* data, std::size_t count) {
+            std::size_t h = head.load(std::memory_order_relaxed);
+            std::size_t t = tail.load(std::memory_order_acquire);
+            count = std::min(count, buffer.size() - (h - t));
+            copyIn(h, data, count);
+            head.store(h + count, std::memory_order_release);
+            return count;
+        }
+
+        bool read(double* dest, std::size_t count) override {
+            std::size_t t = tail.load(std::memory_order_relaxed);
+            std::size_t h = head.load(std::memory_order_acquire);
+            if(h - t < count) {
+                return false;
+            }
+            copyOut(t, dest, count);
+            tail.store(t + count, std::memory_order_release);
+            return true;
+        }
+
+        std::size_t getPosition() const override {
+            return tail.load(std::memory_order_relaxed);
+        }
+
+        std::size_t available() const {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+        }
+
+        std::size_t capacity() const {
+            return buffer.size();
+        }
+
+        double getSampleRate() const override {
+            return sampleRate;
+        }
+
+    private:
+        void copyIn(std::size_t index, const double* data, std::size_t count) {
+            std::size_t start = index & mask;
+            std::size_t first = std::min(count, buffer.size() - start);
+            std::memcpy(buffer.data() + start, data, first * sizeof(double));
+            std::memcpy(buffer.data(), data + first, (count - first) * sizeof(double));
+        }
+
+        void copyOut(std::size_t index, double* dest, std::size_t count) const {
+            std::size_t start = index & mask;
+            std::size_t first = std::min(count, buffer.size() - start);
+            std::memcpy(dest, buffer.data() + start, first * sizeof(double));
+            std::memcpy(dest + first, buffer.data(), (count - first) * sizeof(double));
+        }
+
+        std::vector<double> buffer;
+        std::size_t mask;
+        double sampleRate;
+        alignas(64) std::atomic<std::size_t> head { 0 };
+        alignas(64) std::atomic<std::size_t> tail { 0 };
+};
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include <unistd.h>
+
+// Building blocks of parameter sweeps: a grid of named parameters, a work stealing
+// pool to run its points and a checkpoint file that completed points are appended to,
+// so an interrupted sweep resumes where it stopped.
+
+// Cartesian product of parameters, the last parameter varies fastest. Point i has
+// the mixed radix digits of i as value indices.
+class Grid {
+    public:
+        void add(const std::string& name, const std::vector<double>& values) {
+            if(values.empty()) {
+                throw std::runtime_error("Parameter " + name + " has no values");
+            }
+            names.push_back(name);
+            this->values.push_back(values);
+        }
+
+        std::size_t size() const {
+            std::size_t total = 1;
+            for(const std::vector<double>& v : values) {
+                total *= v.size();
+            }
+            return total;
+        }
+
+        const std::vector<std::string>& getNames() const {
+            return names;
+        }
+
+        std::vector<double> point(std::size_t index) const {
+            std::vector<double> out(values.size());
+            for(std::size_t p = values.size(); p-- > 0;) {
+                out[p] = values[p][index % values[p].size()];
+                index /= values[p].size();
+            }
+            return out;
+        }
+
+        // Every name and value, to tell sweeps apart
+        std::string describe() const {
+            std::string text;
+            char number[32];
+            for(std::size_t p = 0; p < names.size(); p++) {
+                text += names[p] + "=";
+                for(double v : values[p]) {
+                    snprintf(number, sizeof(number), "%.17g,", v);
+                    text += number;
+                }
+                text += ";";
+            }
+            return text;
+        }
+
+    private:
+        std::vector<std::string> names;
+        std::vector<std::vector<double>> values;
+};
+
+
+// Runs task(index, worker) for the indices [0, count) on threads. Every worker owns a
+// range and takes indices from its front, a worker that runs dry steals the back half
+// of the largest range left, so uneven point costs still keep all threads busy.
+class StealingPool {
+    public:
+        StealingPool(unsigned threads): threads { std::max(1u, threads) } { }
+
+        template<typename Task>
+        void run(const std::vector<std::size_t>& indices, Task task) {
+            std::size_t count = indices.size();
+            unsigned workers = (unsigned)std::max<std::size_t>(1, std::min<std::size_t>(threads, count));
+            std::vector<Range> ranges(workers);
+            for(unsigned w = 0; w < workers; w++) {
+                ranges[w].begin = count * w / workers;
+                ranges[w].end = count * (w + 1) / workers;
+            }
+
+            auto worker = [&](unsigned w) {
+                std::size_t i;
+                while(take(ranges, w, i)) {
+                    task(indices[i], w);
+                }
+            };
+            std::vector<std::thread> pool;
+            for(unsigned w = 1; w < workers; w++) {
+                pool.emplace_back(worker, w);
+            }
+            worker(0);
+            for(std::thread& thread : pool) {
+                thread.join();
+            }
+        }
+
+        unsigned getThreads() const {
+            return threads;
+        }
+
+    private:
+        struct Range {
+            std::mutex mutex;
+            std::size_t begin = 0;
+            std::size_t end = 0;
+        };
+
+        static bool take(std::vector<Range>& ranges, unsigned w, std::size_t& index) {
+            while(true) {
+                {
+                    std::lock_guard<std::mutex> lock(ranges[w].mutex);
+                    if(ranges[w].begin < ranges[w].end) {
+                        index = ranges[w].begin++;
+                        return true;
+                    }
+                }
+                // the largest remaining range, sizes are only a hint without the locks
+                std::size_t victim = w, largest = 0;
+                for(std::size_t v = 0; v < ranges.size(); v++) {
+                    std::lock_guard<std::mutex> lock(ranges[v].mutex);
+                    std::size_t left = ranges[v].end - ranges[v].begin;
+                    if(left > largest) {
+                        largest = left;
+                        victim = v;
+                    }
+                }
+                if(largest == 0) {
+                    return false;
+                }
+                std::scoped_lock lock(ranges[victim].mutex, ranges[w].mutex);
+                std::size_t left = ranges[victim].end - ranges[victim].begin;
+                if(left == 0) {
+                    continue;
+                }
+                std::size_t half = left - left / 2;
+                ranges[w].begin = ranges[victim].end - half;
+                ranges[w].end = ranges[victim].end;
+                ranges[victim].end -= half;
+            }
+        }
+
+        unsigned threads;
+};
+
+
+// Text file of completed points, one tab separated line per point starting with its
+// index, after a header naming the sweep. Opening an existing file resumes it: the
+// indices found are done, a line cut off by an interruption is dropped. Lines are
+// flushed as they come and synced to disk at most once per second.
+class Checkpoint {
+    public:
+        Checkpoint(const std::string& filename, const std::string& signature, const std::string& columns)
+            : filename { filename } {
+            std::string header = "# sweep " + hex(hash(signature)) + "\n";
+            std::string existing;
+            if(FILE* in = fopen(filename.c_str(), "rb")) {
+                char buffer[1 << 16];
+                std::size_t n;
+                while((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+                    existing.append(buffer, n);
+                }
+                fclose(in);
+            }
+
+            if(!existing.empty()) {
+                if(existing.compare(0, header.size(), header) != 0) {
+                    throw std::runtime_error(filename + " is the checkpoint of a different sweep");
+                }
+                // keep complete lines only
+                std::size_t end = existing.rfind('\n') + 1;
+                if(truncate(filename.c_str(), end) != 0) {
+                    throw std::runtime_error("Can not truncate " + filename);
+                }
+                existing.resize(end);
+                std::size_t position = 0;
+                while(position < existing.size()) {
+                    std::size_t next = existing.find('\n', position);
+                    if(existing[position] != '#') {
+                        done.push_back(std::stoull(existing.substr(position, next - position)));
+                    }
+                    position = next + 1;
+                }
+                std::sort(done.begin(), done.end());
+            }
+
+            out = fopen(filename.c_str(), "ab");
+            if(out == nullptr) {
+                throw std::runtime_error("Can not open " + filename + " for writing");
+            }
+            if(existing.empty()) {
+                fputs(header.c_str(), out);
+                fputs(("# index\t" + columns + "\n").c_str(), out);
+                fflush(out);
+            }
+            lastSync = std::chrono::steady_clock::now();
+        }
+
+        ~Checkpoint() {
+            if(out != nullptr) {
+                fflush(out);
+                fsync(fileno(out));
+                fclose(out);
+            }
+        }
+
+        bool isDone(std::size_t index) const {
+            return std::binary_search(done.begin(), done.end(), index);
+        }
+
+        std::size_t getDone() const {
+            return done.size();
+        }
+
+        // Indices of [0, count) still to run
+        std::vector<std::size_t> pending(std::size_t count) const {
+            std::vector<std::size_t> indices;
+            for(std::size_t i = 0; i < count; i++) {
+                if(!isDone(i)) {
+                    indices.push_back(i);
+                }
+            }
+            return indices;
+        }
+
+        // Appends the line of a completed point, safe to call from several threads
+        void record(std::size_t index, const std::string& line) {
+            std::string text = std::to_string(index) + "\t" + line + "\n";
+            std::lock_guard<std::mutex> lock(mutex);
+            if(fwrite(text.data(), 1, text.size(), out) != text.size() || fflush(out) != 0) {
+                throw std::runtime_error("Writing " + filename + " failed");
+            }
+            auto now = std::chrono::steady_clock::now();
+            if(now - lastSync > std::chrono::seconds(1)) {
+                fsync(fileno(out));
+                lastSync = now;
+            }
+        }
+
+    private:
+        // FNV-1a
+        static uint64_t hash(const std::string& text) {
+            uint64_t h = 0xcbf29ce484222325ull;
+            for(unsigned char c : text) {
+                h = (h ^ c) * 0x100000001b3ull;
+            }
+            return h;
+        }
+
+        static std::string hex(uint64_t value) {
+            char text[17];
+            snprintf(text, sizeof(text), "%016llx", (unsigned long long)value);
+            return text;
+        }
+
+        std::string filename;
+        std::vector<std::size_t> done;
+        FILE* out = nullptr;
+        std::mutex mutex;
+        std::chrono::steady_clock::time_point lastSync;
+};
+
+#endif
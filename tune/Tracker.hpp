@@ -0,0 +1,310 @@
+#ifndef TRACKER_HPP
+#define TRACKER_HPP
+
+#include <vector>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+
+#include "algos/Damper.hpp"
+
+// Reduced model of main.py for damper gain and phase scans. Instead of tracking
+// macroparticles through PyHEADTAIL every bunch is a few rigid slices that rotate
+// linearly in normalised phase space (x, beta * xp) once per turn, and the damper
+// (Damper::FilterBank) closes the loop on the centroids as OneboxFeedback does with
+// a displacement pickup and a divergence kicker:
+//
+//   rotate -> pickup centroid (+ noise) -> filter bank -> xp -= gain * kick / beta
+//
+// Slices sit at equal probability quantiles of a gaussian tune distribution whose
+// rms is the chromatic spread Q' * sigma_dp combined with any further incoherent
+// spread, so the centroid decoheres like a bunch with that spread would. Synchrotron
+// motion, wakes and amplitude detuning of single particles are not modelled.
+
+// The machine and bunches, defaults are the 6.5 TeV collision settings of LHC.py
+struct Beam {
+    double tune = 64.31;
+    double beta = 92.7;
+    std::size_t slots = 3564;
+    // slots holding a bunch, all slots if empty
+    std::vector<std::size_t> filled;
+    std::size_t slices = 1;
+    double chromaticity = 0.0;
+    double momentumSpread = 1.1e-4;
+    double tuneSpread = 0.0;
+    // initial centroid offset in metres, in a random betatron phase per bunch or
+    // the same phase for all
+    double amplitude = 1e-4;
+    bool randomPhase = true;
+    // rms pickup noise in metres
+    double noise = 0.0;
+    uint64_t seed = 1;
+};
+
+// One setting of the damper, gain as in Damper.py (2 / damping time in turns)
+struct ScanPoint {
+    double gain = 0.1;
+    Damper::Config damper;
+};
+
+
+class BunchTracker {
+    public:
+        BunchTracker(const Beam& beam): beam { beam } {
+            if(beam.slices == 0 || beam.slots == 0) {
+                throw std::runtime_error("BunchTracker needs slots and at least one slice");
+            }
+            if(this->beam.filled.empty()) {
+                for(std::size_t i = 0; i < beam.slots; i++) {
+                    this->beam.filled.push_back(i);
+                }
+            }
+            std::vector<std::size_t>& filled = this->beam.filled;
+            std::sort(filled.begin(), filled.end());
+            filled.erase(std::unique(filled.begin(), filled.end()), filled.end());
+            if(filled.back() >= beam.slots) {
+                throw std::runtime_error("Filled slot outside the ring");
+            }
+
+            double spread = std::hypot(beam.chromaticity * beam.momentumSpread, beam.tuneSpread);
+            for(std::size_t s = 0; s < beam.slices; s++) {
+                double q = beam.tune + spread * gaussianQuantile((s + 0.5) / beam.slices);
+                cosines.push_back(std::cos(2 * M_PI * q));
+                sines.push_back(std::sin(2 * M_PI * q));
+            }
+        }
+
+        std::size_t getBunches() const {
+            return beam.filled.size();
+        }
+
+        const Beam& getBeam() const {
+            return beam;
+        }
+
+        // Tracks turns turns with the damper of point. Writes the pickup signal, the
+        // centroid plus noise, as rows of all bunches per turn (the ADTObsBox layout)
+        // and, if given, the mean centroid amplitude sqrt(x^2 + (beta xp)^2) per turn.
+        // With several threads every thread takes a range of slots.
+        void track(const ScanPoint& point, std::size_t turns, double* rows, double* amplitude = nullptr,
+                unsigned threads = 1) const {
+            const std::size_t bunches = getBunches();
+            const std::size_t slices = beam.slices;
+            Damper::FilterBank bank(beam.slots, beam.tune, point.damper);
+
+            // slice major, so the rotation runs over all bunches with the same angle
+            std::vector<double> x(slices * bunches), px(slices * bunches);
+            for(std::size_t b = 0; b < bunches; b++) {
+                double phase = beam.randomPhase ? 2 * M_PI * uniform(beam.seed, b) : 0.0;
+                for(std::size_t s = 0; s < slices; s++) {
+                    x[s * bunches + b] = beam.amplitude * std::cos(phase);
+                    px[s * bunches + b] = -beam.amplitude * std::sin(phase);
+                }
+            }
+
+            std::vector<double> pickup(beam.slots, 0.0);
+            std::vector<double> filtered(beam.slots, 0.0);
+            std::vector<double> kicks(beam.slots, 0.0);
+            threads = std::max(1u, std::min<unsigned>(threads, bunches));
+            std::vector<double> sums(threads, 0.0);
+            Barrier barrier(threads);
+
+            auto worker = [&](unsigned w) {
+                // bunches [first, last) in slots [slotFirst, slotLast)
+                std::size_t first = bunches * w / threads;
+                std::size_t last = bunches * (w + 1) / threads;
+                std::size_t slotFirst = w == 0 ? 0 : beam.filled[first];
+                std::size_t slotLast = w + 1 == threads ? beam.slots : beam.filled[last];
+                for(std::size_t t = 0; t < turns; t++) {
+                    if(t > 0) {
+                        bank.slotKicks(filtered.data(), kicks.data(), slotFirst, slotLast);
+                        for(std::size_t s = 0; s < slices; s++) {
+                            double* p = px.data() + s * bunches;
+                            for(std::size_t b = first; b < last; b++) {
+                                p[b] -= point.gain * kicks[beam.filled[b]];
+                            }
+                        }
+                    }
+                    rotate(x.data(), px.data(), bunches, first, last);
+
+                    double sum = 0;
+                    for(std::size_t b = first; b < last; b++) {
+                        double cx = 0, cp = 0;
+                        for(std::size_t s = 0; s < slices; s++) {
+                            cx += x[s * bunches + b];
+                            cp += px[s * bunches + b];
+                        }
+                        cx /= slices;
+                        cp /= slices;
+                        sum += std::hypot(cx, cp);
+                        std::size_t slot = beam.filled[b];
+                        double measured = cx;
+                        if(beam.noise > 0) {
+                            measured += beam.noise * gaussian(beam.seed, (t + 1) * beam.slots + slot);
+                        }
+                        pickup[slot] = measured;
+                        rows[t * bunches + b] = measured;
+                    }
+                    sums[w] = sum;
+                    barrier.wait();
+                    if(w == 0) {
+                        bank.turnStage(pickup.data(), filtered.data());
+                        if(amplitude != nullptr) {
+                            double total = 0;
+                            for(double partial : sums) {
+                                total += partial;
+                            }
+                            amplitude[t] = total / bunches;
+                        }
+                    }
+                    barrier.wait();
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for(unsigned w = 1; w < threads; w++) {
+                pool.emplace_back(worker, w);
+            }
+            worker(0);
+            for(std::thread& thread : pool) {
+                thread.join();
+            }
+        }
+
+    private:
+        // Reusable barrier for a fixed number of threads
+        class Barrier {
+            public:
+                Barrier(unsigned count): count { count } { }
+
+                void wait() {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    std::size_t current = generation;
+                    if(++waiting == count) {
+                        waiting = 0;
+                        generation++;
+                        condition.notify_all();
+                        return;
+                    }
+                    condition.wait(lock, [&] { return generation != current; });
+                }
+
+            private:
+                unsigned count;
+                unsigned waiting = 0;
+                std::size_t generation = 0;
+                std::mutex mutex;
+                std::condition_variable condition;
+        };
+
+        void rotate(double* x, double* px, std::size_t bunches, std::size_t first, std::size_t last) const {
+            for(std::size_t s = 0; s < beam.slices; s++) {
+                const double c = cosines[s];
+                const double n = sines[s];
+                double* xs = x + s * bunches;
+                double* ps = px + s * bunches;
+                for(std::size_t b = first; b < last; b++) {
+                    double u = xs[b];
+                    xs[b] = c * u + n * ps[b];
+                    ps[b] = -n * u + c * ps[b];
+                }
+            }
+        }
+
+        // splitmix64 of the index, as SyntheticSource
+        static uint64_t mix(uint64_t x) {
+            x += 0x9e3779b97f4a7c15ull;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+
+        static double uniform(uint64_t seed, uint64_t index) {
+            return (mix(seed ^ mix(index)) >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        static double gaussian(uint64_t seed, uint64_t index) {
+            double u1 = uniform(seed, 2 * index) + 1.0 / 9007199254740992.0;
+            double u2 = uniform(seed, 2 * index + 1);
+            return std::sqrt(-2.0 * std::log(u1)) * std::cos(2 * M_PI * u2);
+        }
+
+        // Inverse of the standard normal distribution by bisection, only used for setup
+        static double gaussianQuantile(double p) {
+            double low = -10, high = 10;
+            for(int i = 0; i < 100; i++) {
+                double mid = (low + high) / 2;
+                if(0.5 * std::erfc(-mid / std::sqrt(2.0)) < p) {
+                    low = mid;
+                }
+                else {
+                    high = mid;
+                }
+            }
+            return (low + high) / 2;
+        }
+
+        Beam beam;
+        std::vector<double> cosines;
+        std::vector<double> sines;
+};
+
+
+// Growth rate per turn of a decaying amplitude (negative while damped) from a
+// least squares line through its logarithm, over the turns before it first falls
+// below floor
+inline double growthRate(const double* amplitude, std::size_t turns, double floor) {
+    double n = 0, st = 0, sy = 0, stt = 0, sty = 0;
+    for(std::size_t t = 0; t < turns && amplitude[t] > floor; t++) {
+        double y = std::log(amplitude[t]);
+        n++;
+        st += t;
+        sy += y;
+        stt += (double)t * t;
+        sty += t * y;
+    }
+    double denominator = n * stt - st * st;
+    return n > 2 && denominator != 0 ? (n * sty - st * sy) / denominator : 0.0;
+}
+
+
+// Tracks every point on its own copy of the beam. Points are shared out between
+// threads, threads left over split the bunches of each point. sink(index, rows,
+// amplitude) gets the results of a point from the worker threads, one call at a time.
+template<typename Sink>
+void scan(const BunchTracker& tracker, const std::vector<ScanPoint>& points, std::size_t turns,
+        unsigned threads, Sink sink) {
+    if(points.empty()) {
+        return;
+    }
+    threads = std::max(1u, threads);
+    unsigned perPoint = std::max<unsigned>(1, threads / points.size());
+    unsigned workers = std::min<std::size_t>(threads / perPoint, points.size());
+
+    std::atomic<std::size_t> next { 0 };
+    std::mutex sinkMutex;
+    auto worker = [&]() {
+        std::vector<double> rows(turns * tracker.getBunches());
+        std::vector<double> amplitude(turns);
+        for(std::size_t i = next++; i < points.size(); i = next++) {
+            tracker.track(points[i], turns, rows.data(), amplitude.data(), perPoint);
+            std::lock_guard<std::mutex> lock(sinkMutex);
+            sink(i, (const std::vector<double>&)rows, (const std::vector<double>&)amplitude);
+        }
+    };
+    std::vector<std::thread> pool;
+    for(unsigned w = 1; w < workers; w++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(std::thread& thread : pool) {
+        thread.join();
+    }
+}
+
+#endif
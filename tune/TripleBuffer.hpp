@@ -0,0 +1,47 @@
+#ifndef TRIPLEBUFFER_HPP
+#define TRIPLEBUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the newest value from one writer thread to one reader thread without locks.
+// The writer fills back() and publishes it, the reader picks up whatever was
+// published last with update() and keeps reading front() until the next update.
+// Neither side ever waits for the other, values published in between are skipped.
+template<class T>
+class TripleBuffer {
+    public:
+        T& back() {
+            return slots[backIndex];
+        }
+
+        // Swaps the filled back slot into the middle and marks it as fresh
+        void publish() {
+            backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // Takes the middle slot if something was published since the last call
+        bool update() {
+            if(!(middle.load(std::memory_order_relaxed) & FRESH)) {
+                return false;
+            }
+            frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+
+        const T& front() const {
+            return slots[frontIndex];
+        }
+
+    private:
+        static constexpr uint8_t INDEX = 0x3;
+        static constexpr uint8_t FRESH = 0x4;
+
+        T slots[3];
+        // the writer and reader indices are only touched by their own thread
+        alignas(64) uint8_t backIndex = 0;
+        alignas(64) std::atomic<uint8_t> middle { 1 };
+        alignas(64) uint8_t frontIndex = 2;
+};
+
+#endif
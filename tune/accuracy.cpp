@@ -0,0 +1,323 @@
+// Accuracy against cost of the tune estimators on signals with a known tune.
+//
+//   accuracy [options] [-o results.tsv]
+//
+// The grid is the product of the --estimator, --window, --noise, --damping and
+// --sideband lists. Every point runs --trials windows of SyntheticSource through the
+// estimator: a line of unit amplitude at a tune drawn uniformly from --tune +- --range
+// with a random phase, damped by --damping per turn, two synchrotron sidebands at
+// +- --qs with --sideband times its amplitude, and white noise of --noise rms. Trial
+// k is the same signal for every estimator, so estimators are compared on equal data.
+//
+// One line per point gives the distribution of the tune error and the CPU time per
+// estimate of the thread that ran it, which does not count time lost to other
+// threads. Errors above --fail are counted as failures and left out of the error
+// statistics, a wrong line picked by one estimator would otherwise hide everything
+// else about it.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <getopt.h>
+#include <time.h>
+
+#include "Sweep.hpp"
+#include "CliParse.hpp"
+#include "SignalSource.hpp"
+#include "algos/TuneEstimator.hpp"
+
+struct Options {
+    std::string estimators = "all";
+    std::string windows = "1024,2048,4096,8192,16384";
+    std::string noises = "0,0.01,0.1";
+    std::string dampings = "0";
+    std::string sidebands = "0,0.1";
+    std::size_t trials = 200;
+    double tune = 0.31;
+    double range = 0.01;
+    double synchrotronTune = 0.002;
+    double order = 2.0;
+    double tolerance = 1.490116e-8;
+    double fail = 0.01;
+    uint64_t seed = 1;
+    std::string output = "-";
+    unsigned threads = 1;
+};
+
+void printUsage(std::ostream& out) {
+    out << "usage: accuracy [options]\n"
+        << "  grid, values and start:stop:count ranges:\n"
+        << "  -e, --estimator LIST  estimators to compare (default all: fft, interpolated,\n"
+        << "                        hilbert, naff, naff-classic, nafflib)\n"
+        << "  -w, --window LIST     turns per estimate (default 1024,2048,4096,8192,16384)\n"
+        << "      --noise LIST      rms noise relative to the line (default 0,0.01,0.1)\n"
+        << "      --damping LIST    amplitude decay rate per turn (default 0)\n"
+        << "      --sideband LIST   amplitude of each synchrotron sideband relative to\n"
+        << "                        the line (default 0,0.1)\n"
+        << "  signals:\n"
+        << "  -n, --trials N        windows per point (default 200)\n"
+        << "      --tune X          centre of the true tunes (default 0.31)\n"
+        << "      --range X         true tunes are uniform in tune +- X (default 0.01)\n"
+        << "      --qs X            synchrotron tune of the sidebands (default 0.002)\n"
+        << "      --seed N          seed of the tunes, phases and noise (default 1)\n"
+        << "  estimators:\n"
+        << "      --order X         order of the Hann harmonic window (default 2)\n"
+        << "      --tolerance X     tune tolerance of the naff and naff-classic estimators\n"
+        << "  run:\n"
+        << "      --fail X          errors above X count as failures (default 0.01)\n"
+        << "  -o, --output FILE     write results to FILE instead of stdout\n"
+        << "  -j, --threads N       threads (default 1, more threads disturb the timings)\n"
+        << "  -h, --help            show this help\n";
+}
+
+Options parseOptions(int argc, char** argv) {
+    enum { NOISE = 1000, DAMPING, SIDEBAND, TUNE, RANGE, QS, SEED, ORDER, TOLERANCE, FAIL };
+    static const option longOptions[] = {
+        { "estimator", required_argument, nullptr, 'e' },
+        { "window", required_argument, nullptr, 'w' },
+        { "noise", required_argument, nullptr, NOISE },
+        { "damping", required_argument, nullptr, DAMPING },
+        { "sideband", required_argument, nullptr, SIDEBAND },
+        { "trials", required_argument, nullptr, 'n' },
+        { "tune", required_argument, nullptr, TUNE },
+        { "range", required_argument, nullptr, RANGE },
+        { "qs", required_argument, nullptr, QS },
+        { "seed", required_argument, nullptr, SEED },
+        { "order", required_argument, nullptr, ORDER },
+        { "tolerance", required_argument, nullptr, TOLERANCE },
+        { "fail", required_argument, nullptr, FAIL },
+        { "output", required_argument, nullptr, 'o' },
+        { "threads", required_argument, nullptr, 'j' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    Options options;
+    int c;
+    while((c = getopt_long(argc, argv, "e:w:n:o:j:h", longOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'e': options.estimators = optarg; break;
+            case 'w': options.windows = optarg; break;
+            case NOISE: options.noises = optarg; break;
+            case DAMPING: options.dampings = optarg; break;
+            case SIDEBAND: options.sidebands = optarg; break;
+            case 'n': options.trials = std::stoul(optarg); break;
+            case TUNE: options.tune = std::stod(optarg); break;
+            case RANGE: options.range = std::stod(optarg); break;
+            case QS: options.synchrotronTune = std::stod(optarg); break;
+            case SEED: options.seed = std::stoull(optarg); break;
+            case ORDER: options.order = std::stod(optarg); break;
+            case TOLERANCE: options.tolerance = std::stod(optarg); break;
+            case FAIL: options.fail = std::stod(optarg); break;
+            case 'o': options.output = optarg; break;
+            case 'j': options.threads = std::stoul(optarg); break;
+            case 'h': printUsage(std::cout); exit(0);
+            default: printUsage(std::cerr); exit(2);
+        }
+    }
+    if(optind != argc) {
+        printUsage(std::cerr);
+        exit(2);
+    }
+
+    if(options.trials == 0) {
+        throw std::runtime_error("trials must be positive");
+    }
+    if(options.tune - options.range <= 0 || options.tune + options.range >= 0.5) {
+        throw std::runtime_error("true tunes must stay between 0 and 0.5");
+    }
+    if(options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return options;
+}
+
+std::vector<std::string> parseEstimators(const std::string& spec) {
+    if(spec == "all") {
+        return estimatorNames();
+    }
+    std::vector<std::string> names;
+    std::stringstream stream(spec);
+    std::string name;
+    while(std::getline(stream, name, ',')) {
+        if(std::find(estimatorNames().begin(), estimatorNames().end(), name) == estimatorNames().end()) {
+            throw std::runtime_error("Unknown estimator " + name);
+        }
+        names.push_back(name);
+    }
+    if(names.empty()) {
+        throw std::runtime_error("no estimator selected");
+    }
+    return names;
+}
+
+// Tunes are only known modulo 1 and up to the sign, estimators may return either
+double foldTune(double tune) {
+    tune -= std::floor(tune);
+    return tune > 0.5 ? 1.0 - tune : tune;
+}
+
+// CPU time of the calling thread
+double threadSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Value at fraction q of sorted values
+double quantile(const std::vector<double>& sorted, double q) {
+    if(sorted.empty()) {
+        return NAN;
+    }
+    return sorted[std::min(sorted.size() - 1, (std::size_t)(q * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    Grid grid;
+    std::vector<std::string> names;
+    try {
+        options = parseOptions(argc, argv);
+        names = parseEstimators(options.estimators);
+        std::vector<double> indices;
+        for(std::size_t e = 0; e < names.size(); e++) {
+            indices.push_back(e);
+        }
+        grid.add("estimator", indices);
+        grid.add("window", parseValues(options.windows));
+        grid.add("noise", parseValues(options.noises));
+        grid.add("damping", parseValues(options.dampings));
+        grid.add("sideband", parseValues(options.sidebands));
+
+        for(double window : parseValues(options.windows)) {
+            if(window < 16 || window != std::floor(window)) {
+                throw std::runtime_error("windows must be whole numbers of at least 16 turns");
+            }
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "accuracy: " << e.what() << std::endl;
+        return 2;
+    }
+
+    FILE* out = stdout;
+    if(options.output != "-" && (out = fopen(options.output.c_str(), "w")) == nullptr) {
+        std::cerr << "accuracy: can not open " << options.output << std::endl;
+        return 2;
+    }
+    fprintf(stderr, "accuracy: %zu points of %zu trials on %u threads\n", grid.size(), options.trials, options.threads);
+
+    // FFTW planning is not thread safe
+    std::mutex planMutex;
+    std::vector<std::map<std::pair<std::string, std::size_t>, std::unique_ptr<TuneEstimator>>> estimators(options.threads);
+    std::vector<std::string> lines(grid.size());
+    std::atomic<std::size_t> failed { 0 };
+    std::mutex errorMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::size_t> todo(grid.size());
+    for(std::size_t i = 0; i < todo.size(); i++) {
+        todo[i] = i;
+    }
+    StealingPool pool(options.threads);
+    pool.run(todo, [&](std::size_t index, unsigned w) {
+        std::vector<double> values = grid.point(index);
+        const std::string& name = names[(std::size_t)values[0]];
+        std::size_t window = (std::size_t)values[1];
+        double noise = values[2], damping = values[3], sideband = values[4];
+        try {
+            std::unique_ptr<TuneEstimator>& estimator = estimators[w][{ name, window }];
+            if(!estimator) {
+                std::lock_guard<std::mutex> lock(planMutex);
+                estimator = makeEstimator(name, window, options.order, options.tolerance);
+            }
+
+            std::vector<double> data(window), errors, seconds;
+            std::size_t failures = 0;
+            for(std::size_t k = 0; k < options.trials; k++) {
+                // the trial alone decides the signal, not the estimator or thread
+                std::mt19937_64 random(options.seed * 0x9e3779b97f4a7c15ull + k);
+                std::uniform_real_distribution<double> uniform(0.0, 1.0);
+                double tune = options.tune + options.range * (2 * uniform(random) - 1);
+                double phase = 2 * M_PI * uniform(random);
+                std::vector<SyntheticSource::Tone> tones = { { tune, 1.0, phase, damping } };
+                if(sideband > 0) {
+                    tones.push_back({ tune - options.synchrotronTune, sideband, 2 * M_PI * uniform(random), damping });
+                    tones.push_back({ tune + options.synchrotronTune, sideband, 2 * M_PI * uniform(random), damping });
+                }
+                SyntheticSource source(1.0, tones, noise, random());
+                source.read(data.data(), window);
+
+                double before = threadSeconds();
+                TuneResult result = estimator->estimate(data.data(), window);
+                seconds.push_back(threadSeconds() - before);
+
+                double error = foldTune(result.tune) - tune;
+                if(!std::isfinite(error) || std::abs(error) > options.fail) {
+                    failures++;
+                }
+                else {
+                    errors.push_back(error);
+                }
+            }
+
+            double bias = 0, squares = 0;
+            for(double e : errors) {
+                bias += e;
+                squares += e * e;
+            }
+            std::size_t good = errors.size();
+            bias = good > 0 ? bias / good : NAN;
+            double rms = good > 0 ? std::sqrt(squares / good) : NAN;
+            std::vector<double> absolute;
+            for(double e : errors) {
+                absolute.push_back(std::abs(e));
+            }
+            std::sort(absolute.begin(), absolute.end());
+            double total = 0;
+            for(double s : seconds) {
+                total += s;
+            }
+            std::sort(seconds.begin(), seconds.end());
+
+            char line[512];
+            snprintf(line, sizeof(line), "%s\t%zu\t%.6g\t%.6g\t%.6g\t%zu\t%zu\t%.3e\t%.3e\t%.3e\t%.3e\t%.3e\t%.4g\t%.4g",
+                name.c_str(), window, noise, damping, sideband, options.trials, failures, bias, rms,
+                quantile(absolute, 0.5), quantile(absolute, 0.95), absolute.empty() ? NAN : absolute.back(),
+                total / seconds.size() * 1e6, quantile(seconds, 0.5) * 1e6);
+            lines[index] = line;
+        }
+        catch(const std::exception& e) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            std::cerr << "accuracy: " << name << " with " << window << " turns: " << e.what() << std::endl;
+            failed++;
+        }
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    fprintf(out, "estimator\twindow\tnoise\tdamping\tsideband\ttrials\tfailures\tbias\trms error"
+        "\tmedian |error|\tp95 |error|\tmax |error|\tcpu us/estimate\tmedian cpu us\n");
+    for(const std::string& line : lines) {
+        if(!line.empty()) {
+            fprintf(out, "%s\n", line.c_str());
+        }
+    }
+    if(out != stdout) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "accuracy: %zu points (%zu failed), %zu estimates in %.3f s\n",
+        grid.size(), failed.load(), grid.size() * options.trials, elapsed.count());
+    return failed > 0 ? 1 : 0;
+}
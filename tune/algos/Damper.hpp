@@ -0,0 +1,556 @@
+#ifndef DAMPER_HPP
+#define DAMPER_HPP
+
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+
+#include "TurnFilter.hpp"
+
+// Native version of the ADT signal processing chain of Damper.py, to replay it over
+// recorded ADTObsBox data (one int16 sample per bunch slot and turn):
+//
+//   HarmonicADC -> TurnFIRFilter -> FIRFilter(phase) -> Upsampler(3) -> FIRFilter(gain) -> DAC -> Lowpass
+//
+// Every stage works on whole turns, i.e. rows of all bunch slots as HDFFile stores
+// them, so the loops run across bunches and vectorise. The stages follow the
+// PyHEADTAIL_feedback processors:
+//   - Quantizer: step * floor(x / step + 0.5), clipped to the range (resampling.py)
+//   - TurnFilter: y[t] = sum_i c[i] x[t - delay - i], zero until the register is full
+//     (Register and FIRCombiner in register.py, see TurnFilter.hpp)
+//   - FIRFilter: y[j] = sum_k c[k] x[j - k + zeroTap], zero outside the samples
+//     (FIRFilter in convolution.py, the ADC extras are zero slots)
+//   - Upsampler: every sample becomes kernel[0..m) * sample (resampling.py)
+//   - Lowpass: first order response of the kicker, exp(-t / tau) truncated after 10
+//     tau and normalised to unit sum (convolution.py), applied to the DAC samples
+// The DAC upsampling by 4 only repeats samples, BackToOriginalBins and the gaussian
+// smoothing of the Lowpass act on the beam slices, those are left out. A bunch kick
+// is the mean of the kicker samples of its slot.
+namespace Damper {
+    // Firmware taps from Damper.py
+    const std::vector<int> LOWPASS_20MHZ = {
+        38, 118, 182, 112, -133, -389, -385, -45, 318, 257, -259, -665, -361, 473, 877, 180,
+        -996, -1187, 162, 1670, 1329, -954, -2648, -1219, 2427, 4007, 419, -5623, -6590, 2893, 19575, 32700,
+        32700, 19575, 2893, -6590, -5623, 419, 4007, 2427, -1219, -2648, -954, 1329, 1670, 162, -1187, -996,
+        180, 877, 473, -361, -665, -259, 257, 318, -45, -385, -389, -133, 112, 182, 118, 38
+    };
+    const std::vector<int> PHASE_EQUALIZER = {
+        2, 4, 7, 10, 12, 16, 19, 22, 27, 31, 36, 42, 49, 57, 67, 77,
+        90, 104, 121, 141, 164, 191, 223, 261, 305, 358, 422, 498, 589, 700, 836, 1004,
+        1215, 1483, 1832, 2301, 2956, 3944, 5600, 9184, 25000, -16746, -4256, -2056, -1195, -769, -523, -372,
+        -271, -202, -153, -118, -91, -71, -56, -44, -34, -27, -20, -15, -11, -7, -4, -1
+    };
+    const int PHASE_ZERO_TAP = 40;
+    const int GAIN_ZERO_TAP = 34;
+
+    // Taps divided by their sum, as FIR_phase_filter and FIR_gain_filter
+    inline std::vector<double> normalise(const std::vector<int>& taps) {
+        double sum = 0;
+        for(int tap : taps) {
+            sum += tap;
+        }
+        std::vector<double> out(taps.size());
+        for(std::size_t i = 0; i < taps.size(); i++) {
+            out[i] = taps[i] / sum;
+        }
+        return out;
+    }
+
+    // calculate_coefficients_3_tap (MD4063_filter_functions.py)
+    inline std::vector<double> coefficients3Tap(double Q, int delay, double additionalPhase) {
+        Q = -Q;
+        double ppt = 2. * M_PI;
+        double c12 = std::cos(Q * 1. * ppt);
+        double s12 = std::sin(Q * 1. * ppt);
+        double c13 = std::cos(Q * 2. * ppt);
+        double s13 = std::sin(Q * 2. * ppt);
+        double c14 = std::cos((Q * (2 + delay) - additionalPhase) * ppt);
+        double s14 = std::sin((Q * (2 + delay) - additionalPhase) * ppt);
+
+        double divider = -1. * (-c12 * s13 + c13 * s12 - s12 + s13);
+
+        double cx1 = c14 * (1 - (c12 * s13 - c13 * s12) / divider) + s14 * (-c12 + c13) / divider;
+        double cx2 = (c14 * s13 + s14 * (-c13 + 1)) / divider;
+        double cx3 = (c14 * -s12 + s14 * (c12 - 1)) / divider;
+        return { cx3, cx2, cx1 };
+    }
+
+    // hilbert_notch_coefficients: the 7 tap Hilbert phase filter convolved with the [1, -1] notch
+    inline std::vector<double> hilbertNotchCoefficients(double Q, double phaseCorrection, double gainCorrection,
+            int delay, double additionalPhase) {
+        // 3.5 = group delay of the notch + hilbert, 0.25 = phase shift of the notch
+        double phase = -((3.5 + delay) * Q + additionalPhase + phaseCorrection - 0.25) * 2. * M_PI;
+        double hilbert[7] = {
+            gainCorrection * -2. * std::sin(phase) / (M_PI * 3.),
+            0,
+            gainCorrection * -2. * std::sin(phase) / (M_PI * 1.),
+            gainCorrection * std::cos(phase),
+            gainCorrection * 2. * std::sin(phase) / (M_PI * 1.),
+            0,
+            gainCorrection * 2. * std::sin(phase) / (M_PI * 3.)
+        };
+        std::vector<double> out(8, 0.0);
+        for(int i = 0; i < 7; i++) {
+            out[i] += hilbert[i];
+            out[i + 1] -= hilbert[i];
+        }
+        return out;
+    }
+
+
+    // Rounds to 2^bits - 1 levels over the range and clips to it
+    class Quantizer {
+        public:
+            Quantizer(int bits, double low, double high)
+                : low { low }, high { high }, step { (high - low) / (std::pow(2.0, bits) - 1.0) } { }
+
+            void apply(double* data, std::size_t n) const {
+                for(std::size_t i = 0; i < n; i++) {
+                    double q = step * std::floor(data[i] / step + 0.5);
+                    data[i] = std::min(std::max(q, low), high);
+                }
+            }
+
+            double getStep() const {
+                return step;
+            }
+
+        private:
+            double low;
+            double high;
+            double step;
+    };
+
+
+    // calculate_hilbert_corrections: phase and gain corrections of the Hilbert notch
+    // filter that make its corrections match the 3 tap filter over the last 20 of 100
+    // turns of a rotating two point signal with an offset of 20. Python minimises
+    // with scipy TNC, this uses Nelder-Mead within the same bounds, so results agree
+    // to the tolerance of the minimisation only. Pass the Python values in Config for
+    // an exact match.
+    inline std::pair<double, double> hilbertCorrections(double Q, int delay, double additionalPhase) {
+        auto track = [&](const std::vector<double>& taps) {
+            TurnFilter filter(taps, delay, 2);
+            double x[2] = { 0.0, 10.0 }, xp[2] = { 0.0, 0.0 };
+            std::vector<double> corrections;
+            double angle = Q * 2. * M_PI;
+            for(int turn = 0; turn < 100; turn++) {
+                double s = std::sin(angle), c = std::cos(angle);
+                double row[2], out[2];
+                for(int i = 0; i < 2; i++) {
+                    double nx = c * x[i] + s * xp[i];
+                    xp[i] = -s * x[i] + c * xp[i];
+                    x[i] = nx;
+                    row[i] = x[i] + 20.0;
+                }
+                filter.process(row, out);
+                corrections.push_back(out[1]);
+            }
+            return corrections;
+        };
+        std::vector<double> reference = track(coefficients3Tap(Q, delay, additionalPhase));
+        auto error = [&](double dQ, double dGain) {
+            dQ = std::min(std::max(dQ, -0.25), 0.5);
+            dGain = std::min(std::max(dGain, 0.25), 1.5);
+            std::vector<double> corrections = track(hilbertNotchCoefficients(Q, dQ, dGain, delay, additionalPhase));
+            double sum = 0;
+            for(int i = 80; i < 100; i++) {
+                sum += std::abs(corrections[i] - reference[i]);
+            }
+            return sum;
+        };
+
+        // Nelder-Mead from (0, 1)
+        double p[3][2] = { { 0.0, 1.0 }, { 0.05, 1.0 }, { 0.0, 1.05 } };
+        double f[3];
+        for(int i = 0; i < 3; i++) {
+            f[i] = error(p[i][0], p[i][1]);
+        }
+        for(int iteration = 0; iteration < 2000; iteration++) {
+            int order[3] = { 0, 1, 2 };
+            std::sort(order, order + 3, [&](int a, int b) { return f[a] < f[b]; });
+            int best = order[0], mid = order[1], worst = order[2];
+            if(std::abs(f[worst] - f[best]) < 1e-12 && std::abs(p[worst][0] - p[best][0]) < 1e-10) {
+                break;
+            }
+            double centre[2] = { (p[best][0] + p[mid][0]) / 2, (p[best][1] + p[mid][1]) / 2 };
+            auto at = [&](double t, double* q) {
+                q[0] = centre[0] + t * (p[worst][0] - centre[0]);
+                q[1] = centre[1] + t * (p[worst][1] - centre[1]);
+                return error(q[0], q[1]);
+            };
+            double r[2], e[2], c[2];
+            double fr = at(-1.0, r);
+            if(fr < f[best]) {
+                double fe = at(-2.0, e);
+                if(fe < fr) {
+                    std::copy(e, e + 2, p[worst]);
+                    f[worst] = fe;
+                }
+                else {
+                    std::copy(r, r + 2, p[worst]);
+                    f[worst] = fr;
+                }
+            }
+            else if(fr < f[mid]) {
+                std::copy(r, r + 2, p[worst]);
+                f[worst] = fr;
+            }
+            else {
+                double fc = at(0.5, c);
+                if(fc < f[worst]) {
+                    std::copy(c, c + 2, p[worst]);
+                    f[worst] = fc;
+                }
+                else {
+                    for(int i : { mid, worst }) {
+                        p[i][0] = (p[i][0] + p[best][0]) / 2;
+                        p[i][1] = (p[i][1] + p[best][1]) / 2;
+                        f[i] = error(p[i][0], p[i][1]);
+                    }
+                }
+            }
+        }
+        int best = std::min_element(f, f + 3) - f;
+        return { std::min(std::max(p[best][0], -0.25), 0.5), std::min(std::max(p[best][1], 0.25), 1.5) };
+    }
+
+    // calculate_hilbert_notch_coefficients
+    inline std::vector<double> calculateHilbertNotchCoefficients(double Q, int delay, double additionalPhase) {
+        std::pair<double, double> corrections = hilbertCorrections(Q, delay, additionalPhase);
+        return hilbertNotchCoefficients(Q, corrections.first, corrections.second, delay, additionalPhase);
+    }
+
+    // FIR along the samples of one turn, coefficient zeroTap is applied to the sample itself
+    class FIRFilter {
+        public:
+            FIRFilter(const std::vector<double>& coefficients, int zeroTap)
+                : coefficients { coefficients }, zeroTap { zeroTap } { }
+
+            void apply(const double* in, std::size_t n, double* out) const {
+                apply(in, n, out, 0, n);
+            }
+
+            // Only the outputs [begin, end) of the n samples
+            void apply(const double* in, std::size_t n, double* out, std::size_t begin, std::size_t end) const {
+                std::fill(out + begin, out + end, 0.0);
+                for(std::size_t k = 0; k < coefficients.size(); k++) {
+                    // out[j] += c[k] * in[j + shift] for all j with j + shift inside
+                    long shift = (long)zeroTap - (long)k;
+                    std::size_t first = shift < 0 ? -shift : 0;
+                    std::size_t last = shift > 0 ? (n > (std::size_t)shift ? n - shift : 0) : n;
+                    first = std::max(first, begin);
+                    last = std::min(last, end);
+                    const double c = coefficients[k];
+                    const double* src = in + shift;
+                    for(std::size_t j = first; j < last; j++) {
+                        out[j] += c * src[j];
+                    }
+                }
+            }
+
+            // Inputs that outputs [begin, end) depend on, clipped to the n samples
+            std::pair<std::size_t, std::size_t> support(std::size_t begin, std::size_t end, std::size_t n) const {
+                long low = (long)begin + zeroTap - (long)coefficients.size() + 1;
+                long high = (long)end + zeroTap;
+                return { (std::size_t)std::min(std::max(low, 0l), (long)n), (std::size_t)std::min(std::max(high, 0l), (long)n) };
+            }
+
+        private:
+            std::vector<double> coefficients;
+            int zeroTap;
+    };
+
+
+    // The kicker response along the samples. The truncated exponential is run as a
+    // recursion, y[j] = a y[j - 1] + x[j] - a^length x[j - length].
+    class Lowpass {
+        public:
+            Lowpass(double cutoff, double sampleRate, double maxImpulseLength = 10.) {
+                if(cutoff > 0) {
+                    double tau = sampleRate / (2 * M_PI * cutoff);
+                    decay = std::exp(-1.0 / tau);
+                    length = std::max<std::size_t>(1, (std::size_t)std::ceil(maxImpulseLength * tau));
+                    tail = std::pow(decay, (double)length);
+                    norm = (1 - decay) / (1 - tail);
+                }
+            }
+
+            // Outputs [begin, end), the samples before begin are taken as zero so
+            // outputs from begin + getLength() on are exact
+            void apply(const double* in, double* out, std::size_t begin, std::size_t end) const {
+                if(length == 0) {
+                    std::copy(in + begin, in + end, out + begin);
+                    return;
+                }
+                double y = 0;
+                for(std::size_t j = begin; j < end; j++) {
+                    y = decay * y + in[j];
+                    if(j >= begin + length) {
+                        y -= tail * in[j - length];
+                    }
+                    out[j] = norm * y;
+                }
+            }
+
+            // Samples of the impulse response, 0 when disabled
+            std::size_t getLength() const {
+                return length;
+            }
+
+        private:
+            double decay = 0;
+            double tail = 0;
+            double norm = 1;
+            std::size_t length = 0;
+    };
+
+
+    class Upsampler {
+        public:
+            Upsampler(const std::vector<double>& kernel): kernel { kernel } { }
+
+            // out holds n * getFactor() samples
+            void apply(const double* in, std::size_t n, double* out) const {
+                apply(in, out, 0, n);
+            }
+
+            // Samples [begin, end) only
+            void apply(const double* in, double* out, std::size_t begin, std::size_t end) const {
+                std::size_t m = kernel.size();
+                for(std::size_t j = begin; j < end; j++) {
+                    for(std::size_t k = 0; k < m; k++) {
+                        out[j * m + k] = kernel[k] * in[j];
+                    }
+                }
+            }
+
+            std::size_t getFactor() const {
+                return kernel.size();
+            }
+
+        private:
+            std::vector<double> kernel;
+    };
+
+
+    // Settings of a FilterBank, the defaults are those of Damper.py
+    struct Config {
+        int delay = 1;
+        double additionalPhase = 0.25;
+        int adcBits = 16;
+        double adcLow = -1e-3;
+        double adcHigh = 1e-3;
+        // converts the int16 samples to the ADC input, by default a sample is one ADC level
+        double inputScale = 0.0;
+        // turn filter taps, by default the Hilbert notch filter for the tune
+        std::vector<double> turnCoefficients;
+        // corrections of hilbertNotchCoefficients, fitted like Damper.py does
+        // unless given (the values printed by calculate_hilbert_notch_coefficients)
+        bool fitCorrections = true;
+        double phaseCorrection = 0.0;
+        double gainCorrection = 1.0;
+        std::vector<double> phaseCoefficients = normalise(PHASE_EQUALIZER);
+        int phaseZeroTap = PHASE_ZERO_TAP;
+        std::vector<double> upsamplerKernel = { 1.5, 1.5, 0.0 };
+        std::vector<double> gainCoefficients = normalise(LOWPASS_20MHZ);
+        int gainZeroTap = GAIN_ZERO_TAP;
+        // cut off of the kicker, 0 leaves the Lowpass out, and the ADC sampling rate
+        // of one sample per bunch slot (f_RF / 10)
+        double kickerCutoff = 1e6;
+        double sampleRate = 40.0789e6;
+    };
+
+
+    // The whole chain for one plane over rows of bunch slots
+    class FilterBank {
+        public:
+            // Turns process converts to doubles at a time
+            static constexpr std::size_t STRIP_TURNS = 1024;
+
+            FilterBank(std::size_t slots, double Q, const Config& config = Config())
+                : slots { slots }, config { config },
+                  adc { config.adcBits, config.adcLow, config.adcHigh },
+                  turnFilter { turnTaps(Q, config), config.delay, slots },
+                  phaseFilter { config.phaseCoefficients, config.phaseZeroTap },
+                  upsampler { config.upsamplerKernel },
+                  gainFilter { config.gainCoefficients, config.gainZeroTap },
+                  dac { config.adcBits, config.adcLow, config.adcHigh },
+                  kicker { config.kickerCutoff, config.sampleRate * config.upsamplerKernel.size() } {
+                scale = config.inputScale != 0.0 ? config.inputScale : adc.getStep();
+            }
+
+            std::size_t getSlots() const {
+                return slots;
+            }
+
+            // DAC samples per slot
+            std::size_t getFactor() const {
+                return upsampler.getFactor();
+            }
+
+            // One turn of all slots to getFactor() DAC samples per slot
+            void processTurn(const int16_t* row, double* samples) {
+                std::vector<double>& filtered = scratch().filtered;
+                filtered.resize(slots);
+                turnStage(row, filtered.data());
+                slotStages(filtered.data(), samples, 0, slots);
+            }
+
+            // HarmonicADC and TurnFIRFilter of one turn given as ADC input (displacement)
+            // rather than ObsBox samples, for closing the loop in a simulation
+            void turnStage(const double* row, double* filtered) {
+                std::vector<double>& input = scratch().input;
+                input.assign(row, row + slots);
+                adc.apply(input.data(), slots);
+                turnFilter.process(input.data(), filtered);
+            }
+
+            // Kicks of the slots [first, last) from one turn out of turnStage. Only the
+            // samples these slots depend on are computed, so disjoint slot ranges can be
+            // handed to different threads.
+            void slotKicks(const double* filtered, double* kicks, std::size_t first, std::size_t last) const {
+                std::vector<double>& samples = scratch().samples;
+                samples.resize(slots * getFactor());
+                slotStages(filtered, samples.data(), first, last);
+                toKicks(samples.data(), kicks, first, last);
+            }
+
+            // turns rows of slots (turn major as stored in ADTObsBox files) to one kick
+            // per slot and turn. The turns go through in strips of STRIP_TURNS, the turn
+            // filter runs over each strip in order and the stages within the turns of a
+            // strip are shared out between threads. Only a strip is held as doubles.
+            void process(const int16_t* rows, std::size_t turns, double* kicks, unsigned threads = 1) {
+                std::size_t strip = std::min(turns, STRIP_TURNS);
+                std::vector<double> input(strip * slots);
+                std::vector<double> filtered(strip * slots);
+                for(std::size_t turn = 0; turn < turns; turn += strip) {
+                    std::size_t count = std::min(strip, turns - turn);
+                    digitise(rows + turn * slots, count * slots, input.data());
+                    turnFilter.process(input.data(), count, filtered.data());
+
+                    double* out = kicks + turn * slots;
+                    auto worker = [&](std::size_t first, std::size_t last) {
+                        std::vector<double>& samples = scratch().samples;
+                        samples.resize(slots * getFactor());
+                        for(std::size_t t = first; t < last; t++) {
+                            slotStages(filtered.data() + t * slots, samples.data(), 0, slots);
+                            toKicks(samples.data(), out + t * slots, 0, slots);
+                        }
+                    };
+                    unsigned used = std::max(1u, std::min<unsigned>(threads, count));
+                    std::vector<std::thread> pool;
+                    for(unsigned i = 1; i < used; i++) {
+                        pool.emplace_back(worker, count * i / used, count * (i + 1) / used);
+                    }
+                    worker(0, count / used);
+                    for(std::thread& thread : pool) {
+                        thread.join();
+                    }
+                }
+            }
+
+            // Mean of the DAC samples of every slot
+            void toKicks(const double* samples, double* kicks) const {
+                toKicks(samples, kicks, 0, slots);
+            }
+
+            void toKicks(const double* samples, double* kicks, std::size_t first, std::size_t last) const {
+                std::size_t m = getFactor();
+                for(std::size_t b = first; b < last; b++) {
+                    double sum = 0;
+                    for(std::size_t k = 0; k < m; k++) {
+                        sum += samples[b * m + k];
+                    }
+                    kicks[b] = sum / m;
+                }
+            }
+
+            void reset() {
+                turnFilter.reset();
+            }
+
+        private:
+            struct Scratch {
+                std::vector<double> filtered;
+                std::vector<double> input;
+                std::vector<double> phased;
+                std::vector<double> upsampled;
+                std::vector<double> converted;
+                std::vector<double> samples;
+            };
+
+            static Scratch& scratch() {
+                thread_local Scratch buffers;
+                return buffers;
+            }
+
+            static std::vector<double> turnTaps(double Q, const Config& config) {
+                if(!config.turnCoefficients.empty()) {
+                    return config.turnCoefficients;
+                }
+                if(config.fitCorrections) {
+                    return calculateHilbertNotchCoefficients(Q, config.delay, config.additionalPhase);
+                }
+                return hilbertNotchCoefficients(Q, config.phaseCorrection, config.gainCorrection,
+                    config.delay, config.additionalPhase);
+            }
+
+            // HarmonicADC and TurnFIRFilter
+            void turnStage(const int16_t* row, double* out) {
+                std::vector<double>& input = scratch().input;
+                input.resize(slots);
+                digitise(row, slots, input.data());
+                turnFilter.process(input.data(), out);
+            }
+
+            // HarmonicADC
+            void digitise(const int16_t* samples, std::size_t n, double* out) const {
+                for(std::size_t i = 0; i < n; i++) {
+                    out[i] = samples[i] * scale;
+                }
+                adc.apply(out, n);
+            }
+
+            // FIRFilter(phase), Upsampler, FIRFilter(gain), DAC and Lowpass for the
+            // kicker samples of slots [first, last), the earlier stages only where the
+            // later ones read
+            void slotStages(const double* filtered, double* samples, std::size_t first, std::size_t last) const {
+                Scratch& buffers = scratch();
+                std::size_t m = getFactor();
+                buffers.phased.resize(slots);
+                buffers.upsampled.resize(slots * m);
+                buffers.converted.resize(slots * m);
+                // the Lowpass starts its length early to have settled at first
+                std::size_t lowFirst = first * m - std::min(first * m, kicker.getLength());
+                std::pair<std::size_t, std::size_t> needed = gainFilter.support(lowFirst, last * m, slots * m);
+                std::size_t begin = needed.first / m;
+                std::size_t end = (needed.second + m - 1) / m;
+                phaseFilter.apply(filtered, slots, buffers.phased.data(), begin, end);
+                upsampler.apply(buffers.phased.data(), buffers.upsampled.data(), begin, end);
+                gainFilter.apply(buffers.upsampled.data(), slots * m, buffers.converted.data(), lowFirst, last * m);
+                dac.apply(buffers.converted.data() + lowFirst, last * m - lowFirst);
+                kicker.apply(buffers.converted.data(), samples, lowFirst, last * m);
+            }
+
+            std::size_t slots;
+            Config config;
+            double scale;
+            Quantizer adc;
+            TurnFilter turnFilter;
+            FIRFilter phaseFilter;
+            Upsampler upsampler;
+            FIRFilter gainFilter;
+            Quantizer dac;
+            Lowpass kicker;
+    };
+
+
+}
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef FIXEDPOINT_HPP
+#define FIXEDPOINT_HPP
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Integer versions of the damper filters for validating firmware, with int16 samples,
+// int16 taps (the integer coefficients of Damper.py as they are) and a 32 bit
+// accumulator. The arithmetic is fixed so results are bit exact against the
+// firmware and between the two implementations here:
+//   - taps are taken in pairs, each pair is one 32 bit sum of two products (pmaddwd),
+//     taps are limited to +-32767 so that sum never wraps
+//   - pairs are added to the accumulator in tap order with 32 bit saturation
+//   - the output is (acc + 2^(shift - 1)) >> shift, saturated again, then saturated to int16
+// With SSE2 eight samples go through per vector (two for double), the scalar code does
+// the same operations in the same order and handles the tails and other targets.
+// fixed_test (make test) checks both against a plain int64 model of these rules.
+namespace Fixed {
+    inline int32_t saturate32(int64_t x) {
+        return (int32_t)std::min<int64_t>(std::max<int64_t>(x, INT32_MIN), INT32_MAX);
+    }
+
+    inline int16_t saturate16(int32_t x) {
+        return (int16_t)std::min<int32_t>(std::max<int32_t>(x, INT16_MIN), INT16_MAX);
+    }
+
+    // One pmaddwd lane
+    inline int32_t madd(int16_t x0, int16_t c0, int16_t x1, int16_t c1) {
+        return (int32_t)x0 * c0 + (int32_t)x1 * c1;
+    }
+
+    inline int32_t addSaturate(int32_t a, int32_t b) {
+        return saturate32((int64_t)a + b);
+    }
+
+    inline int16_t output(int32_t acc, int shift) {
+        if(shift > 0) {
+            acc = addSaturate(acc, 1 << (shift - 1)) >> shift;
+        }
+        return saturate16(acc);
+    }
+
+    // Rounds coefficients to integers with fractionalBits bits after the point
+    inline std::vector<int> quantise(const std::vector<double>& taps, int fractionalBits) {
+        std::vector<int> out(taps.size());
+        for(std::size_t i = 0; i < taps.size(); i++) {
+            out[i] = (int)std::lround(std::ldexp(taps[i], fractionalBits));
+        }
+        return out;
+    }
+
+#ifdef __SSE2__
+    inline __m128i addSaturate(__m128i a, __m128i b) {
+        __m128i sum = _mm_add_epi32(a, b);
+        // overflow if a and b have the same sign and the sum has the other one
+        __m128i overflow = _mm_srai_epi32(_mm_andnot_si128(_mm_xor_si128(a, b), _mm_xor_si128(a, sum)), 31);
+        __m128i limit = _mm_xor_si128(_mm_srai_epi32(a, 31), _mm_set1_epi32(INT32_MAX));
+        return _mm_or_si128(_mm_and_si128(overflow, limit), _mm_andnot_si128(overflow, sum));
+    }
+
+    // Two vectors of four accumulators to eight int16 outputs
+    inline __m128i output(__m128i low, __m128i high, int shift) {
+        if(shift > 0) {
+            __m128i half = _mm_set1_epi32(1 << (shift - 1));
+            __m128i count = _mm_cvtsi32_si128(shift);
+            low = _mm_sra_epi32(addSaturate(low, half), count);
+            high = _mm_sra_epi32(addSaturate(high, half), count);
+        }
+        return _mm_packs_epi32(low, high);
+    }
+
+    // Adds c0 * x0[i] + c1 * x1[i] for eight neighbouring samples to the accumulators
+    inline void maddPair(const int16_t* x0, const int16_t* x1, __m128i taps, __m128i& low, __m128i& high) {
+        __m128i a = _mm_loadu_si128((const __m128i*)x0);
+        __m128i b = _mm_loadu_si128((const __m128i*)x1);
+        low = addSaturate(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), taps));
+        high = addSaturate(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), taps));
+    }
+#endif
+
+    // Taps as int16, padded to an even count
+    inline std::vector<int16_t> pairTaps(const std::vector<int>& taps) {
+        if(taps.empty()) {
+            throw std::runtime_error("Fixed point filter needs taps");
+        }
+        std::vector<int16_t> out(taps.size() + taps.size() % 2, 0);
+        for(std::size_t i = 0; i < taps.size(); i++) {
+            if(taps[i] < -INT16_MAX || taps[i] > INT16_MAX) {
+                throw std::runtime_error("Fixed point taps must be within +-32767");
+            }
+            out[i] = (int16_t)taps[i];
+        }
+        return out;
+    }
+
+    // Neighbouring taps packed as the int16 pairs of a pmaddwd operand
+    inline std::vector<int32_t> packPairs(const std::vector<int16_t>& taps) {
+        std::vector<int32_t> out(taps.size() / 2);
+        for(std::size_t k = 0; k < taps.size(); k += 2) {
+            out[k / 2] = (int32_t)(((uint32_t)(uint16_t)taps[k + 1] << 16) | (uint16_t)taps[k]);
+        }
+        return out;
+    }
+
+
+    // FIR along the samples of one turn like Damper::FIRFilter, coefficient zeroTap is
+    // applied to the sample itself and samples outside are zero
+    class FIRFilter {
+        public:
+            FIRFilter(const std::vector<int>& taps, int zeroTap, int shift)
+                : taps { pairTaps(taps) }, pairs { packPairs(this->taps) }, zeroTap { zeroTap }, shift { shift } {
+                if(shift < 0 || shift > 30) {
+                    throw std::runtime_error("Fixed point shift must be within 0 to 30");
+                }
+            }
+
+            void apply(const int16_t* in, std::size_t n, int16_t* out) const {
+                const int16_t* x = pad(in, n);
+                std::size_t j = 0;
+#ifdef __SSE2__
+                for(; j + 8 <= n; j += 8) {
+                    __m128i low = _mm_setzero_si128();
+                    __m128i high = _mm_setzero_si128();
+                    for(std::size_t k = 0; k < taps.size(); k += 2) {
+                        const int16_t* x0 = x + ((long)j + zeroTap - (long)k);
+                        maddPair(x0, x0 - 1, _mm_set1_epi32(pairs[k / 2]), low, high);
+                    }
+                    _mm_storeu_si128((__m128i*)(out + j), output(low, high, shift));
+                }
+#endif
+                for(; j < n; j++) {
+                    out[j] = sample(x, j);
+                }
+            }
+
+            // Filters and keeps every factor-th output, out holds (n + factor - 1) / factor samples
+            void decimate(const int16_t* in, std::size_t n, std::size_t factor, int16_t* out) const {
+                if(factor <= 1) {
+                    apply(in, n, out);
+                    return;
+                }
+                std::size_t outputs = (n + factor - 1) / factor;
+                std::size_t i = 0;
+#ifdef __SSE2__
+                std::size_t vectors = outputs / 8 * 8;
+                if(vectors > 0) {
+                    std::size_t span;
+                    long first;
+                    const int16_t* phases = split(in, n, factor, vectors, span, first);
+                    std::vector<const int16_t*>& sources = scratchSources();
+                    sources.resize(taps.size());
+                    for(std::size_t k = 0; k < taps.size(); k++) {
+                        // sample i * factor + d of tap k is sample i + q of phase p
+                        long d = (long)zeroTap - (long)k;
+                        long q = d >= 0 ? d / (long)factor : -((-d + (long)factor - 1) / (long)factor);
+                        long p = d - q * (long)factor;
+                        sources[k] = phases + p * span + (q - first);
+                    }
+                    for(; i < vectors; i += 8) {
+                        __m128i low = _mm_setzero_si128();
+                        __m128i high = _mm_setzero_si128();
+                        for(std::size_t k = 0; k < taps.size(); k += 2) {
+                            maddPair(sources[k] + i, sources[k + 1] + i, _mm_set1_epi32(pairs[k / 2]), low, high);
+                        }
+                        _mm_storeu_si128((__m128i*)(out + i), output(low, high, shift));
+                    }
+                }
+#endif
+                const int16_t* x = pad(in, n);
+                for(; i < outputs; i++) {
+                    out[i] = sample(x, i * factor);
+                }
+            }
+
+            // Same as apply without SSE2, for checking
+            void applyScalar(const int16_t* in, std::size_t n, int16_t* out) const {
+                const int16_t* x = pad(in, n);
+                for(std::size_t j = 0; j < n; j++) {
+                    out[j] = sample(x, j);
+                }
+            }
+
+        private:
+            // Copy of the samples with zeros around, returns the first sample
+            const int16_t* pad(const int16_t* in, std::size_t n) const {
+                thread_local std::vector<int16_t> padded;
+                std::size_t left = taps.size() + std::max(-zeroTap, 0) + 1;
+                std::size_t right = std::max(zeroTap, 0) + 8;
+                padded.assign(left + n + right, 0);
+                std::copy(in, in + n, padded.begin() + left);
+                return padded.data() + left;
+            }
+
+#ifdef __SSE2__
+            // The samples the first vectors outputs of decimate read, split into factor
+            // phases of span samples: phase p holds samples m * factor + p for m from
+            // first on, zero outside the n samples. Tap k then reads neighbouring samples
+            // of one phase for neighbouring outputs.
+            const int16_t* split(const int16_t* in, std::size_t n, std::size_t factor, std::size_t vectors,
+                    std::size_t& span, long& first) const {
+                thread_local std::vector<int16_t> phases;
+                long f = (long)factor;
+                long low = (long)zeroTap - (long)taps.size() + 1;
+                long high = (long)(vectors - 1) * f + zeroTap;
+                first = low >= 0 ? low / f : -((-low + f - 1) / f);
+                long last = high >= 0 ? high / f : -((-high + f - 1) / f);
+                span = (std::size_t)(last - first + 1);
+                phases.assign(factor * span, 0);
+                for(long p = 0; p < f; p++) {
+                    int16_t* phase = phases.data() + p * span;
+                    for(long m = first; m <= last; m++) {
+                        long s = m * f + p;
+                        if(s >= 0 && s < (long)n) {
+                            phase[m - first] = in[s];
+                        }
+                    }
+                }
+                return phases.data();
+            }
+
+            static std::vector<const int16_t*>& scratchSources() {
+                thread_local std::vector<const int16_t*> sources;
+                return sources;
+            }
+#endif
+
+            int16_t sample(const int16_t* x, std::size_t j) const {
+                int32_t acc = 0;
+                for(std::size_t k = 0; k < taps.size(); k += 2) {
+                    const int16_t* x0 = x + ((long)j + zeroTap - (long)k);
+                    acc = addSaturate(acc, madd(x0[0], taps[k], x0[-1], taps[k + 1]));
+                }
+                return output(acc, shift);
+            }
+
+            std::vector<int16_t> taps;
+            std::vector<int32_t> pairs;
+            int zeroTap;
+            int shift;
+    };
+
+
+    // Integer TurnFilter: y[t][b] = sum_i c[i] x[t - delay - i][b] over rows of all
+    // bunches, zero until taps + delay turns have been seen. The last taps + delay - 1
+    // rows are kept between blocks.
+    class TurnFilter {
+        public:
+            TurnFilter(const std::vector<int>& taps, int delay, std::size_t width, int shift)
+                : taps { pairTaps(taps) }, pairs { packPairs(this->taps) }, delay((std::size_t)delay),
+                  width { width }, shift { shift } {
+                if(delay < 0) {
+                    throw std::runtime_error("TurnFilter needs a non negative delay");
+                }
+                if(shift < 0 || shift > 30) {
+                    throw std::runtime_error("Fixed point shift must be within 0 to 30");
+                }
+                // the zero padding tap of odd filters looks one row further back
+                depth = this->taps.size() + delay;
+                history.resize(depth * width);
+                count = taps.size() + delay - 1;
+            }
+
+            void process(const int16_t* rows, std::size_t turns, int16_t* out) {
+                std::vector<const int16_t*> sources(taps.size());
+                for(std::size_t t = 0; t < turns; t++) {
+                    int16_t* row = out + t * width;
+                    if(seen + t < count) {
+                        std::fill(row, row + width, 0);
+                        continue;
+                    }
+                    for(std::size_t i = 0; i < taps.size(); i++) {
+                        std::size_t lag = delay + i;
+                        sources[i] = lag <= t ? rows + (t - lag) * width : previous(lag - t);
+                    }
+                    filterRow(sources.data(), row);
+                }
+                keep(rows, turns);
+            }
+
+            std::size_t getWidth() const {
+                return width;
+            }
+
+            void reset() {
+                head = 0;
+                seen = 0;
+                std::fill(history.begin(), history.end(), 0);
+            }
+
+        private:
+            void filterRow(const int16_t* const* sources, int16_t* row) const {
+                std::size_t b = 0;
+#ifdef __SSE2__
+                for(; b + 8 <= width; b += 8) {
+                    __m128i low = _mm_setzero_si128();
+                    __m128i high = _mm_setzero_si128();
+                    for(std::size_t k = 0; k < taps.size(); k += 2) {
+                        maddPair(sources[k] + b, sources[k + 1] + b, _mm_set1_epi32(pairs[k / 2]), low, high);
+                    }
+                    _mm_storeu_si128((__m128i*)(row + b), output(low, high, shift));
+                }
+#endif
+                for(; b < width; b++) {
+                    int32_t acc = 0;
+                    for(std::size_t k = 0; k < taps.size(); k += 2) {
+                        acc = addSaturate(acc, madd(sources[k][b], taps[k], sources[k + 1][b], taps[k + 1]));
+                    }
+                    row[b] = output(acc, shift);
+                }
+            }
+
+            const int16_t* previous(std::size_t age) const {
+                return history.data() + ((head + depth - age) % depth) * width;
+            }
+
+            void keep(const int16_t* rows, std::size_t turns) {
+                seen += turns;
+                std::size_t first = turns > depth ? turns - depth : 0;
+                for(std::size_t t = first; t < turns; t++) {
+                    std::copy(rows + t * width, rows + (t + 1) * width, history.data() + head * width);
+                    head = (head + 1) % depth;
+                }
+            }
+
+            std::vector<int16_t> taps;
+            std::vector<int32_t> pairs;
+            std::size_t delay;
+            std::size_t width;
+            int shift;
+            std::size_t depth;
+            std::size_t count;
+            std::vector<int16_t> history;
+            std::size_t head = 0;
+            std::size_t seen = 0;
+    };
+}
+
+#endif
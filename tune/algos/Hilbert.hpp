@@ -2,17 +2,19 @@
 #include "Algorithm.hpp"
 #include <iostream>
 #include <math.h>
+#include <complex>
 extern "C" {
     #include <fftw3.h>
 }
 
 // https://stackoverflow.com/questions/24518989/how-to-perform-1-dimensional-valid-convolution
+// Full convolution into out, which keeps its capacity between calls of the same size
 template<typename T>
-std::vector<T> conv(std::vector<T> const &f, std::vector<T> const &g) {
+void conv(std::vector<T> const &f, std::vector<T> const &g, std::vector<T> &out) {
   int const nf = f.size();
   int const ng = g.size();
   int const n  = nf + ng - 1;
-  std::vector<T> out(n, T());
+  out.assign(n, T());
   for(auto i(0); i < n; ++i) {
     int const jmn = (i >= ng - 1)? i - (ng - 1) : 0;
     int const jmx = (i <  nf - 1)? i            : nf - 1;
@@ -20,13 +22,20 @@ std::vector<T> conv(std::vector<T> const &f, std::vector<T> const &g) {
       out[i] += (f[j] * g[i - j]);
     }
   }
+}
+
+template<typename T>
+std::vector<T> conv(std::vector<T> const &f, std::vector<T> const &g) {
+  std::vector<T> out;
+  conv(f, g, out);
   return out; 
 }
 
 class Hilbert {
     public:
         Hilbert(int size) {     
-              
+            I.reserve(size + iKernel.size() - 1);
+            Q.reserve(size + qKernel.size() - 1);
             in = (double*)fftw_malloc(size * sizeof(double));
             out = (fftw_complex*)fftw_malloc(size * sizeof(fftw_complex)); 
             planForward = fftw_plan_dft_r2c_1d(size, in, out, FFTW_ESTIMATE);
@@ -43,23 +52,26 @@ class Hilbert {
             
         }
 
+        // Mean phase advance per sample of the analytic signal built from the FIR
+        // Hilbert pair, in units of the sampling frequency. The advances are averaged
+        // as phasors weighted by the amplitude, which keeps noisy low amplitude samples
+        // from dominating. Only samples where both filters fully overlap the data count.
         float performAnalysis(const std::vector<double>& data) {
-            std::vector<double> I = conv(data, iKernel);
-            std::vector<double> Q = conv(data, qKernel);
-            double totalPhase = 0;
-
-            const double PI = 3.14159265359;
-            std::vector<double> angle(I.size());           
-            for(int i = 0; i < I.size(); i++) {
-                angle[i] = std::remainder(std::atan(I[i] / Q[i]), 2.0 * M_PI);
+            conv(data, iKernel, I);
+            conv(data, qKernel, Q);
+            std::size_t first = iKernel.size() - 1;
+            std::size_t last = data.size();
+            if(last < first + 2) {
+                return -1;
             }
 
-            // Diff phase 
-            std::vector<double> diff(I.size());
-            for(int i = 0; i < I.size() - 1; i++) {
-                diff[i] = (angle[i + 1] - angle[i]) / (2 * PI) * 11245.;
-                totalPhase += diff[i]; 
+            std::complex<double> advance = 0;
+            for(std::size_t i = first; i + 1 < last; i++) {
+                std::complex<double> now(Q[i], I[i]);
+                std::complex<double> next(Q[i + 1], I[i + 1]);
+                advance += next * std::conj(now);
             }
+            return std::abs(std::arg(advance)) / (2 * M_PI);
         };
 
     private:
@@ -69,5 +81,7 @@ class Hilbert {
         //fftw_plan planInverse;
         std::vector<double> iKernel{ -0.0906,-0.0197,-0.5941,0,0.5941,0.0197,0.0906 };
         std::vector<double> qKernel{ 0,0,0,1,0,0,0 };
+        // filter outputs, kept between windows
+        std::vector<double> I, Q;
 };
 
@@ -15,6 +15,14 @@ class Naff {
     public:
         Naff(int size) {     
             NAFFData = std::vector<double>(size);
+            // performNAFF only takes windows of this size, so its buffers and the
+            // Hanning window are made once here
+            NAFFSine = std::vector<double>(size);
+            NAFFCosine = std::vector<double>(size);
+            NAFFMagnitude2 = std::vector<double>(size);
+            NAFFHanning = std::vector<double>(size);
+            for (int i=0; i < size && size > 1; i++)
+                NAFFHanning[i] = (1 - std::cos(M_PI*2*i/(size-1.0)))/2;
             in = (double*)fftw_malloc(size * sizeof(double));
             out = (fftw_complex*)fftw_malloc(size * sizeof(fftw_complex)); 
             p = fftw_plan_dft_r2c_1d(size, in, out, FFTW_ESTIMATE);
@@ -256,7 +264,8 @@ class Naff {
 		size_t M = data.size();
     	int imax = 0;
     	double max = 0;
-		for(size_t i = 0; i < M; i++) {
+		// the r2c transform only fills the non negative half of the spectrum
+		for(size_t i = 0; i <= M / 2; i++) {
 			double amp = out[i][0]*out[i][0] + out[i][1]*out[i][1];
 			if( amp > max )
 			{
@@ -360,12 +369,9 @@ class Naff {
 		double wStart, freqSpacing;
 		int iBest, code, trys;
 		double maxMag2;
-		std::vector<double> sine(points);
-		std::vector<double> cosine(points);
-		std::vector<double> magnitude2(points);
-		std::vector<double> hanning(points);
 
-		if ( points < 2 ) {
+		// the spectrum comes from the plan made for the constructor's size
+		if ( points < 2 || points != (int)NAFFData.size() ) {
 			return -1;
 		}
 
@@ -374,10 +380,8 @@ class Naff {
 
 		/* subtract off mean and apply the Hanning window */
 		mean = arithmeticAverage(data);
-		for (i=0; i < points; i++) {
-			hanning[i]  = (1 - std::cos(M_PI*2*i/(points-1.0)))/2;
-			NAFFData[i] = (data[i]-mean)*hanning[i];
-		}
+		for (i=0; i < points; i++)
+			NAFFData[i] = (data[i]-mean)*NAFFHanning[i];
 
 		rmsOrig = 0;
 		if (fracRMSChangeLimit != 0) {
@@ -394,15 +398,19 @@ class Naff {
 			amplitude[i] = phase[i] = significance[i] = frequency[i] = -1;
 
 		while (freqsFound < maxFrequencies) {
-			//simpleFFT(magnitude2, NAFFData, points);
+			// power spectrum of what is left after the lines found so far
+			memcpy(in, NAFFData.data(), points * sizeof(double));
+			fftw_execute(p);
+			for (i=0; i < FFTFreqs; i++)
+				NAFFMagnitude2[i] = out[i][0]*out[i][0] + out[i][1]*out[i][1];
 			maxMag2 = 0;
 			iBest = 0;
 			for (i=0; i < FFTFreqs; i++) {
-				if (magnitude2[i] > maxMag2) {
+				if (NAFFMagnitude2[i] > maxMag2) {
 					if (i*freqSpacing<lowerFreqLimit || i*freqSpacing>upperFreqLimit)
 						continue;
 					iBest = i;
-					maxMag2 = magnitude2[i];
+					maxMag2 = NAFFMagnitude2[i];
 				}
 			}
 
@@ -434,7 +442,7 @@ class Naff {
 			}
 			
 			calculatePhaseAndAmplitudeFromFreq(
-					hanning, 
+					NAFFHanning, 
 					points, 
 					NAFFdt, 
 					frequency[freqsFound], 
@@ -443,8 +451,8 @@ class Naff {
 					phase, 
 					amplitude,
 					significance, 
-					cosine, 
-					sine);
+					NAFFCosine, 
+					NAFFSine);
 			
 			frequency[freqsFound] /= M_PI*2;
 			freqsFound ++;
@@ -518,27 +526,24 @@ class Naff {
         //    
 				//}
         //std::cout << "------------------------\n" << std::endl;
-        return 0;
+        // strongest line in units of the sampling frequency, -1 if none was found
+        return frequency[0];
     };
 
 
 
 
 	double performAnalysis2(std::vector<double>& data, int sampleRate, double actualFrequency) {
-		merit_args_cpp margs;
 		int N = data.size();
-		margs.N = N;
-		margs.window = cplxvec(N);
-		margs.signal = cplxvec(N);
-
-
-		double _Complex* signal2 = (double _Complex*)malloc(N * sizeof(double _Complex));
-		for(int i = 0; i < data.size(); i++) {
-			signal2[i] = data[i];
-		}	
 
-
-		double Q = get_q(signal2, N, 2.0, 0);
+		// the window only depends on the length and order, so it is kept between calls
+		if (margs.N != (size_t)N || margsOrder != windowOrder) {
+			margs.N = N;
+			margs.window = cplxvec(N);
+			margs.signal = cplxvec(N);
+			hann_harm_window_cpp(margs.window, margs.N, windowOrder);
+			margsOrder = windowOrder;
+		}
 
 		// Subtract mean from signal
 		double mean = arithmeticAverage(data);
@@ -549,28 +554,43 @@ class Naff {
 
 		double (*merit_function)(double, const merit_args_cpp*) = minus_magnitude_fourier_integral_v2;
 
-		double order = 2.0;
-		hann_harm_window_cpp(margs.window, margs.N, order);
-
-		double _Complex* signal = (double _Complex*)malloc(N * sizeof(double _Complex));
-		for(int i = 0; i < N; i++) {
-			signal[i] = data[i];
-		}  
-
-		
 		double fft_estimate = maxFFTValue(data);
 		double step = 1./N;
 
-		double v0 = (fft_estimate-step);
-		double v1 = fft_estimate ;
-		double v2 = (fft_estimate+step) ;
-		double naff_estimate = brent_minimize_cpp( merit_function, fft_estimate-step, fft_estimate+step, &margs); 
+		double naff_estimate = brent_minimize_cpp( merit_function, fft_estimate-step, fft_estimate+step, &margs, brentTolerance); 
 
-		std::cout  << " -- " << Q << " | " << naff_estimate << " | " << actualFrequency <<  std::endl;
+		if (verbose) {
+			double _Complex* signal2 = (double _Complex*)malloc(N * sizeof(double _Complex));
+			for(int i = 0; i < data.size(); i++) {
+				signal2[i] = data[i];
+			}	
+			double Q = get_q(signal2, N, windowOrder, 0);
+			free(signal2);
 
+			std::cout  << " -- " << Q << " | " << naff_estimate << " | " << actualFrequency <<  std::endl;
+		}
 
 		return naff_estimate;
 	}
+
+	// mean free signal and window of the last performAnalysis2 call
+	const merit_args_cpp& getMeritArgs() const {
+		return margs;
+	}
+
+	// performAnalysis2 prints the nafflib estimate next to its own when verbose
+	void setVerbose(bool value) {
+		verbose = value;
+	}
+
+	void setWindowOrder(double order) {
+		windowOrder = order;
+	}
+
+	void setBrentTolerance(double tolerance) {
+		brentTolerance = tolerance;
+	}
+
     private:
         double* in;
         fftw_complex* out;
@@ -580,5 +600,16 @@ class Naff {
         int NAFFPoints;
         double NAFFdt;
         std::vector<double> NAFFData;
+        std::vector<double> NAFFSine;
+        std::vector<double> NAFFCosine;
+        std::vector<double> NAFFMagnitude2;
+        std::vector<double> NAFFHanning;
+
+        // performAnalysis2 state
+        merit_args_cpp margs { 0 };
+        double margsOrder = -1;
+        double windowOrder = 2.0;
+        double brentTolerance = 1.490116e-8;
+        bool verbose = true;
 };
 
@@ -0,0 +1,367 @@
+#ifndef TUNEESTIMATOR_HPP
+#define TUNEESTIMATOR_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <sstream>
+#include <complex>
+#include <stdexcept>
+#include <math.h>
+#include "Naff.hpp"
+#include "Hilbert.hpp"
+
+extern "C" {
+    #include <fftw3.h>
+}
+
+// Result of one window, the tune is in units of the sampling frequency (fractional
+// tune for turn by turn data). Significance is the fraction of the signal energy
+// left after removing the found line, small means a clean line.
+struct TuneResult {
+    double tune = 0.0;
+    double amplitude = 0.0;
+    double phase = 0.0;
+    double significance = 1.0;
+};
+
+// Common interface of the tune estimators so the CLI, caches and benchmarks can
+// treat them alike. Instances keep FFT plans and work buffers for one window length
+// and are not thread safe, use one per thread.
+class TuneEstimator {
+    public:
+        virtual ~TuneEstimator() { }
+
+        virtual TuneResult estimate(const double* data, std::size_t n) = 0;
+
+        virtual std::string getName() const = 0;
+
+        // Every setting that changes the result, used to key cached results
+        virtual std::string getParameters() const = 0;
+
+    protected:
+        // Amplitude and phase of the line at tune from the windowed Fourier integral
+        // of the mean free signal, significance from the energy that remains.
+        static void projectLine(const cplxvec& signal, const cplxvec& window, std::size_t n, TuneResult& result) {
+            std::complex<double> a = inner_product(signal, 1., result.tune, window, n);
+            result.amplitude = 2.0 * std::abs(a);
+            result.phase = std::arg(a);
+
+            double omega = 2 * M_PI * result.tune;
+            double total = 0, residual = 0;
+            for(std::size_t i = 0; i < n; i++) {
+                double x = signal[i].real();
+                double r = x - result.amplitude * std::cos(omega * i + result.phase);
+                total += x * x;
+                residual += r * r;
+            }
+            result.significance = total > 0 ? residual / total : 1.0;
+        }
+};
+
+
+// Highest bin of a Hann windowed FFT, cheapest and limited to a resolution of 1/n.
+// With interpolate the line is placed between the highest bin and its larger
+// neighbour from the ratio of their magnitudes (Grandke's formula for the Hann
+// window), which is exact for a single line away from other lines.
+class FFTEstimator : public TuneEstimator {
+    public:
+        FFTEstimator(std::size_t size, bool interpolate = false): size { size }, interpolate { interpolate } {
+            in = fftw_alloc_real(size);
+            out = fftw_alloc_complex(size / 2 + 1);
+            plan = fftw_plan_dft_r2c_1d(size, in, out, FFTW_ESTIMATE);
+            hann = std::vector<double>(size);
+            // the interpolation assumes the periodic window
+            double period = interpolate ? size : size - 1;
+            for(std::size_t i = 0; i < size; i++) {
+                hann[i] = 0.5 * (1 - std::cos(2 * M_PI * i / period));
+            }
+        }
+
+        ~FFTEstimator() {
+            fftw_destroy_plan(plan);
+            fftw_free(in);
+            fftw_free(out);
+        }
+
+        TuneResult estimate(const double* data, std::size_t n) override {
+            if(n != size) {
+                throw std::runtime_error("FFTEstimator used with a different window length");
+            }
+            double mean = 0;
+            for(std::size_t i = 0; i < n; i++) {
+                mean += data[i];
+            }
+            mean /= n;
+            double norm = 0;
+            for(std::size_t i = 0; i < n; i++) {
+                in[i] = (data[i] - mean) * hann[i];
+                norm += hann[i];
+            }
+            fftw_execute(plan);
+
+            std::size_t best = 1;
+            double bestPower = -1, total = 0;
+            for(std::size_t i = 1; i <= n / 2; i++) {
+                double power = out[i][0] * out[i][0] + out[i][1] * out[i][1];
+                total += power;
+                if(power > bestPower) {
+                    bestPower = power;
+                    best = i;
+                }
+            }
+
+            TuneResult result;
+            result.tune = (double)best / n;
+            result.amplitude = 2.0 * std::sqrt(bestPower) / norm;
+            result.phase = std::atan2(out[best][1], out[best][0]);
+            result.significance = total > 0 ? 1.0 - bestPower / total : 1.0;
+            if(interpolate && bestPower > 0) {
+                std::size_t left = best - 1, right = best + 1;
+                double powerLeft = out[left][0] * out[left][0] + out[left][1] * out[left][1];
+                double powerRight = right <= n / 2 ? out[right][0] * out[right][0] + out[right][1] * out[right][1] : 0;
+                double side = powerRight >= powerLeft ? 1.0 : -1.0;
+                double alpha = std::sqrt(std::max(powerLeft, powerRight) / bestPower);
+                double delta = (2 * alpha - 1) / (alpha + 1);
+                result.tune = (best + side * delta) / n;
+                // the Hann response sinc(d) / (1 - d^2) at the offset of the line
+                if(delta > 1e-9 && delta < 1 - 1e-9) {
+                    result.amplitude *= M_PI * delta * (1 - delta * delta) / std::sin(M_PI * delta);
+                }
+            }
+            return result;
+        }
+
+        std::string getName() const override {
+            return interpolate ? "interpolated" : "fft";
+        }
+
+        std::string getParameters() const override {
+            return interpolate ? "window=hann;interpolation=grandke" : "window=hann";
+        }
+
+    private:
+        std::size_t size;
+        bool interpolate;
+        double* in;
+        fftw_complex* out;
+        fftw_plan plan;
+        std::vector<double> hann;
+};
+
+
+// NAFF as in the viewer: FFT peak, then Brent maximisation of the Fourier integral
+// with a Hann harmonic window of the given order (Naff::performAnalysis2)
+class NaffEstimator : public TuneEstimator {
+    public:
+        NaffEstimator(std::size_t size, double order = 2.0, double tolerance = 1.490116e-8)
+            : naff { (int)size }, data(size), order { order }, tolerance { tolerance } {
+            naff.setVerbose(false);
+            naff.setWindowOrder(order);
+            naff.setBrentTolerance(tolerance);
+        }
+
+        TuneResult estimate(const double* samples, std::size_t n) override {
+            if(n != data.size()) {
+                throw std::runtime_error("NaffEstimator used with a different window length");
+            }
+            std::copy(samples, samples + n, data.begin());
+            TuneResult result;
+            result.tune = naff.performAnalysis2(data, 1, 0.0);
+            const merit_args_cpp& margs = naff.getMeritArgs();
+            projectLine(margs.signal, margs.window, n, result);
+            return result;
+        }
+
+        std::string getName() const override {
+            return "naff";
+        }
+
+        std::string getParameters() const override {
+            std::ostringstream out;
+            out.precision(17);
+            out << "order=" << order << ";tolerance=" << tolerance;
+            return out.str();
+        }
+
+    private:
+        Naff naff;
+        std::vector<double> data;
+        double order;
+        double tolerance;
+};
+
+
+// The C nafflib estimate (get_q), which picks its own FFT start point and integral
+class NafflibEstimator : public TuneEstimator {
+    public:
+        NafflibEstimator(std::size_t size, double order = 2.0)
+            : signal(size), window(size), order { order } {
+            hann_harm_window_cpp(window, size, order);
+            complexSignal = (double _Complex*)malloc(size * sizeof(double _Complex));
+        }
+
+        ~NafflibEstimator() {
+            free(complexSignal);
+        }
+
+        TuneResult estimate(const double* data, std::size_t n) override {
+            if(n != signal.size()) {
+                throw std::runtime_error("NafflibEstimator used with a different window length");
+            }
+            double mean = 0;
+            for(std::size_t i = 0; i < n; i++) {
+                complexSignal[i] = data[i];
+                mean += data[i];
+            }
+            mean /= n;
+            for(std::size_t i = 0; i < n; i++) {
+                signal[i] = data[i] - mean;
+            }
+            TuneResult result;
+            result.tune = get_q(complexSignal, n, order, 0);
+            projectLine(signal, window, n, result);
+            return result;
+        }
+
+        std::string getName() const override {
+            return "nafflib";
+        }
+
+        std::string getParameters() const override {
+            std::ostringstream out;
+            out.precision(17);
+            out << "order=" << order;
+            return out.str();
+        }
+
+    private:
+        cplxvec signal;
+        cplxvec window;
+        double _Complex* complexSignal;
+        double order;
+};
+
+
+// NAFF as ported from SDDS (Naff::performNAFF): FFT peak of the Hann windowed
+// signal, then parabolic maximisation of naffFunc until the bracket is narrower
+// than tolerance. Finds one line only.
+class ClassicNaffEstimator : public TuneEstimator {
+    public:
+        ClassicNaffEstimator(std::size_t size, double tolerance = 1.490116e-8)
+            : naff { (int)size }, data(size), frequency(1), amplitude(1), phase(1), significance(1),
+              tolerance { tolerance } { }
+
+        TuneResult estimate(const double* samples, std::size_t n) override {
+            if(n != data.size()) {
+                throw std::runtime_error("ClassicNaffEstimator used with a different window length");
+            }
+            std::copy(samples, samples + n, data.begin());
+            // the bracket limit is given as a fraction of pi / dt, i.e. of the Nyquist frequency
+            int found = naff.performNAFF(frequency, amplitude, phase, significance, 0.0, 1.0, data, (int)n,
+                0.0, 1, 100, 2 * tolerance, 0, 0.5);
+            TuneResult result;
+            if(found > 0) {
+                result.tune = frequency[0];
+                result.amplitude = amplitude[0];
+                result.phase = phase[0];
+                result.significance = significance[0];
+            }
+            return result;
+        }
+
+        std::string getName() const override {
+            return "naff-classic";
+        }
+
+        std::string getParameters() const override {
+            std::ostringstream out;
+            out.precision(17);
+            out << "tolerance=" << tolerance;
+            return out.str();
+        }
+
+    private:
+        Naff naff;
+        std::vector<double> data;
+        // the one line performNAFF returns, kept between windows
+        std::vector<double> frequency, amplitude, phase, significance;
+        double tolerance;
+};
+
+
+// Phase advance of the analytic signal from the 7 tap FIR Hilbert pair of the
+// damper firmware (Hilbert.hpp), needs no FFT and works on short windows but is
+// biased by noise and by other lines
+class HilbertEstimator : public TuneEstimator {
+    public:
+        HilbertEstimator(std::size_t size)
+            : hilbert { (int)size }, data(size), signal(size), window(size) {
+            hann_harm_window_cpp(window, size, 1);
+        }
+
+        TuneResult estimate(const double* samples, std::size_t n) override {
+            if(n != data.size()) {
+                throw std::runtime_error("HilbertEstimator used with a different window length");
+            }
+            double mean = 0;
+            for(std::size_t i = 0; i < n; i++) {
+                mean += samples[i];
+            }
+            mean /= n;
+            for(std::size_t i = 0; i < n; i++) {
+                data[i] = samples[i] - mean;
+                signal[i] = data[i];
+            }
+            TuneResult result;
+            result.tune = std::max(0.0f, hilbert.performAnalysis(data));
+            projectLine(signal, window, n, result);
+            return result;
+        }
+
+        std::string getName() const override {
+            return "hilbert";
+        }
+
+        std::string getParameters() const override {
+            return "kernel=fir7";
+        }
+
+    private:
+        Hilbert hilbert;
+        std::vector<double> data;
+        cplxvec signal;
+        cplxvec window;
+};
+
+
+// Every name makeEstimator knows
+inline const std::vector<std::string>& estimatorNames() {
+    static const std::vector<std::string> names = { "fft", "interpolated", "hilbert", "naff", "naff-classic", "nafflib" };
+    return names;
+}
+
+// Creates an estimator by the name used on the command line
+inline std::unique_ptr<TuneEstimator> makeEstimator(const std::string& name, std::size_t size, double order, double tolerance) {
+    if(name == "naff") {
+        return std::unique_ptr<TuneEstimator>(new NaffEstimator(size, order, tolerance));
+    }
+    else if(name == "nafflib") {
+        return std::unique_ptr<TuneEstimator>(new NafflibEstimator(size, order));
+    }
+    else if(name == "fft") {
+        return std::unique_ptr<TuneEstimator>(new FFTEstimator(size));
+    }
+    else if(name == "interpolated") {
+        return std::unique_ptr<TuneEstimator>(new FFTEstimator(size, true));
+    }
+    else if(name == "naff-classic") {
+        return std::unique_ptr<TuneEstimator>(new ClassicNaffEstimator(size, tolerance));
+    }
+    else if(name == "hilbert") {
+        return std::unique_ptr<TuneEstimator>(new HilbertEstimator(size));
+    }
+    throw std::runtime_error("Unknown estimator " + name + ", expected fft, interpolated, hilbert, naff, naff-classic or nafflib");
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef TURNFILTER_HPP
+#define TURNFILTER_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+// Turn by turn FIR with the same taps for every bunch, applied to the turn major
+// layout of ADTObsBox files (one row of all bunches per turn) without transposing:
+//
+//   y[t][b] = sum_i c[i] x[t - delay - i][b]
+//
+// Rows come in blocks of any length. Inside a block the taps read the input rows in
+// place, so the inner loop is one multiply add across all bunches of a row and
+// vectorises for int16 and double input alike. Only the last taps + delay - 1 rows
+// are kept as state between blocks. Like Register and FIRCombiner in register.py the
+// output is zero until taps + delay turns have been seen.
+class TurnFilter {
+    public:
+        TurnFilter(const std::vector<double>& coefficients, int delay, std::size_t width)
+            : coefficients { coefficients }, delay((std::size_t)delay), width { width } {
+            if(coefficients.empty() || delay < 0) {
+                throw std::runtime_error("TurnFilter needs taps and a non negative delay");
+            }
+            depth = coefficients.size() + delay - 1;
+            history.resize(depth * width);
+        }
+
+        // Filters turns rows of width samples into turns rows of out
+        template<typename T>
+        void process(const T* rows, std::size_t turns, double* out) {
+            for(std::size_t t = 0; t < turns; t++) {
+                double* row = out + t * width;
+                std::fill(row, row + width, 0.0);
+                if(seen + t < depth) {
+                    continue;
+                }
+                for(std::size_t i = 0; i < coefficients.size(); i++) {
+                    std::size_t lag = delay + i;
+                    if(lag <= t) {
+                        accumulate(rows + (t - lag) * width, coefficients[i], row);
+                    }
+                    else {
+                        accumulate(previous(lag - t), coefficients[i], row);
+                    }
+                }
+            }
+            keep(rows, turns);
+        }
+
+        template<typename T>
+        void process(const T* row, double* out) {
+            process(row, 1, out);
+        }
+
+        std::size_t getWidth() const {
+            return width;
+        }
+
+        // Turns of state, the rows a block may look back into
+        std::size_t getDepth() const {
+            return depth;
+        }
+
+        void reset() {
+            head = 0;
+            seen = 0;
+        }
+
+    private:
+        template<typename T>
+        void accumulate(const T* __restrict in, double c, double* __restrict out) const {
+            for(std::size_t b = 0; b < width; b++) {
+                out[b] += c * in[b];
+            }
+        }
+
+        // Row that came in age turns before the current block
+        const double* previous(std::size_t age) const {
+            return history.data() + ((head + depth - age) % depth) * width;
+        }
+
+        // Moves the last rows of a block into the ring
+        template<typename T>
+        void keep(const T* rows, std::size_t turns) {
+            seen += turns;
+            if(depth == 0) {
+                return;
+            }
+            std::size_t first = turns > depth ? turns - depth : 0;
+            for(std::size_t t = first; t < turns; t++) {
+                std::copy(rows + t * width, rows + (t + 1) * width, history.data() + head * width);
+                head = (head + 1) % depth;
+            }
+        }
+
+        std::vector<double> coefficients;
+        std::size_t delay;
+        std::size_t width;
+        std::size_t depth;
+        std::vector<double> history;
+        std::size_t head = 0;
+        std::size_t seen = 0;
+};
+
+// Streams a whole file through a TurnFilter in blocks of blockTurns rows. File is an
+// HDFFile (not transposed) or anything with getRows, getColumns and getBlockParallel.
+// sink(firstTurn, rows, turns) gets every filtered block, rows are turn major.
+template<typename File, typename Sink>
+void filterTurns(File& file, TurnFilter& filter, std::size_t blockTurns, Sink sink, unsigned threads = 0) {
+    std::size_t turns = file.getRows();
+    std::size_t bunches = file.getColumns();
+    if(bunches != filter.getWidth()) {
+        throw std::runtime_error("TurnFilter width does not match the bunches of the file");
+    }
+    blockTurns = std::max<std::size_t>(blockTurns, 1);
+    std::vector<double> out(std::min(blockTurns, turns) * bunches);
+    for(std::size_t turn = 0; turn < turns; turn += blockTurns) {
+        std::size_t count = std::min(blockTurns, turns - turn);
+        std::unique_ptr<int16_t> block = file.getBlockParallel(turn, count, 0, bunches, threads);
+        filter.process(block.get(), count, out.data());
+        sink(turn, (const double*)out.data(), count);
+    }
+}
+
+#endif
@@ -65,12 +65,11 @@ double minus_magnitude_fourier_integral_v2(double frequency, const merit_args_cp
     return -(amp.real()*amp.real() + amp.imag()*amp.imag());
 }
 
-double brent_minimize_cpp(double (*f)(double,const merit_args_cpp*), double min, double max, const merit_args_cpp* S)
+double brent_minimize_cpp(double (*f)(double,const merit_args_cpp*), double min, double max, const merit_args_cpp* S, const double tolerance = 1.490116e-8 /* ldexp(1.-25) */)
 {
 
     const int max_iter = 10000;
     const double golden = 0.3819660;
-    const double tolerance = 1.490116e-8; //ldexp(1.-25)
 
     double x, w, v, u; 
     double fu, fv, fw, fx;
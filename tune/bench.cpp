@@ -0,0 +1,292 @@
+// Google Benchmark suite of the tune estimators and their building blocks.
+//
+//   bench [--file recording.h5] [--benchmark_filter=...] [--benchmark_out=results.json]
+//
+// The kernels (naffFunc, inner_product, brent_minimize_cpp, maxFFTValue, the
+// windows and the FFT) and the estimators run on windows of 2048 to 65536 turns of
+// a synthetic multi-tone signal with noise. The Recorded benchmarks read a recorded
+// file, by default the checked-in fill 7355 file, and extract the tunes bunch by
+// bunch as the tune CLI does. They are left out when the file can not be opened.
+//
+// `make bench-json` runs everything and writes benchmarks/<git describe>.json, the
+// version is also stored in the context of the JSON so results of different
+// versions can be compared with compare.py of Google Benchmark.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <complex>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include "HDFLib.h"
+#include "SignalSource.hpp"
+#include "algos/TuneEstimator.hpp"
+
+#ifndef TUNE_VERSION
+#define TUNE_VERSION "unknown"
+#endif
+
+const char* DEFAULT_FILE = "07355_64k_B1H_Q7_20181025_21h17m01s.h5";
+
+const std::size_t MIN_WINDOW = 2048;
+const std::size_t MAX_WINDOW = 65536;
+
+// Betatron line, its second harmonic, a synchrotron sideband and noise
+std::vector<double> syntheticWindow(std::size_t size) {
+    SyntheticSource source(1.0, { { 0.31, 1.0, 0.3 }, { 0.62, 0.1, 1.1 }, { 0.3105, 0.05, 2.0 } }, 0.05, 7355);
+    std::vector<double> data(size);
+    source.read(data.data(), size);
+    return data;
+}
+
+// Mean free window as complex signal, as performAnalysis2 prepares it
+cplxvec meanFree(const std::vector<double>& data) {
+    double mean = 0;
+    for(double x : data) {
+        mean += x;
+    }
+    mean /= data.size();
+    cplxvec signal(data.size());
+    for(std::size_t i = 0; i < data.size(); i++) {
+        signal[i] = data[i] - mean;
+    }
+    return signal;
+}
+
+void setCounters(benchmark::State& state, std::size_t samples) {
+    state.SetItemsProcessed(state.iterations() * samples);
+    state.SetBytesProcessed(state.iterations() * samples * sizeof(double));
+}
+
+
+// Kernels
+
+void BM_NaffFunc(benchmark::State& state) {
+    std::size_t size = state.range(0);
+    std::vector<double> data = syntheticWindow(size);
+    Naff naff(size);
+    // performAnalysis leaves the windowed residual behind that naffFunc integrates
+    naff.performAnalysis(data);
+    double omega = 2 * M_PI * 0.31;
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(naff.naffFunc(omega));
+        omega += 1e-9;
+    }
+    setCounters(state, size);
+}
+BENCHMARK(BM_NaffFunc)->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+
+void BM_InnerProduct(benchmark::State& state) {
+    std::size_t size = state.range(0);
+    cplxvec signal = meanFree(syntheticWindow(size));
+    cplxvec window(size);
+    hann_harm_window_cpp(window, size, 1);
+    double frequency = 0.31;
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(inner_product(signal, 1., frequency, window, size));
+        frequency += 1e-9;
+    }
+    setCounters(state, size);
+}
+BENCHMARK(BM_InnerProduct)->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+
+// One refinement as done by the naff estimator, from the FFT bin to the tolerance
+void BM_BrentMinimize(benchmark::State& state) {
+    std::size_t size = state.range(0);
+    merit_args_cpp args;
+    args.N = size;
+    args.signal = meanFree(syntheticWindow(size));
+    args.window = cplxvec(size);
+    hann_harm_window_cpp(args.window, size, 1);
+    double estimate = std::round(0.31 * size) / size;
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(brent_minimize_cpp(minus_magnitude_fourier_integral_v2,
+            estimate - 1. / size, estimate + 1. / size, &args, 1e-10));
+    }
+    setCounters(state, size);
+}
+BENCHMARK(BM_BrentMinimize)->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+
+void BM_MaxFFTValue(benchmark::State& state) {
+    std::size_t size = state.range(0);
+    std::vector<double> data = syntheticWindow(size);
+    Naff naff(size);
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(naff.maxFFTValue(data));
+    }
+    setCounters(state, size);
+}
+BENCHMARK(BM_MaxFFTValue)->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+
+// The bare real to complex transform under maxFFTValue and the FFT estimator
+void BM_FFT(benchmark::State& state) {
+    std::size_t size = state.range(0);
+    std::vector<double> data = syntheticWindow(size);
+    double* in = fftw_alloc_real(size);
+    fftw_complex* out = fftw_alloc_complex(size / 2 + 1);
+    fftw_plan plan = fftw_plan_dft_r2c_1d(size, in, out, FFTW_ESTIMATE);
+    std::memcpy(in, data.data(), size * sizeof(double));
+    for(auto _ : state) {
+        fftw_execute(plan);
+        benchmark::DoNotOptimize(out);
+        benchmark::ClobberMemory();
+    }
+    fftw_destroy_plan(plan);
+    fftw_free(in);
+    fftw_free(out);
+    setCounters(state, size);
+}
+BENCHMARK(BM_FFT)->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+
+// Hann window of order range(1), computed for every window of the naff estimator
+void BM_HannHarmWindow(benchmark::State& state) {
+    std::size_t size = state.range(0);
+    cplxvec window(size);
+    for(auto _ : state) {
+        hann_harm_window_cpp(window, size, state.range(1));
+        benchmark::DoNotOptimize(window.data());
+        benchmark::ClobberMemory();
+    }
+    setCounters(state, size);
+}
+BENCHMARK(BM_HannHarmWindow)->ArgsProduct({ benchmark::CreateRange(MIN_WINDOW, MAX_WINDOW, 2), { 1, 2, 4 } })
+    ->Unit(benchmark::kMicrosecond);
+
+
+// Estimators, one window per iteration with the CLI defaults
+
+void BM_Estimator(benchmark::State& state, const std::string& name) {
+    std::size_t size = state.range(0);
+    std::vector<double> data = syntheticWindow(size);
+    std::unique_ptr<TuneEstimator> estimator = makeEstimator(name, size, 1, 1e-10);
+    TuneResult result;
+    for(auto _ : state) {
+        result = estimator->estimate(data.data(), size);
+        benchmark::DoNotOptimize(result);
+    }
+    state.counters["tune_error"] = std::abs(result.tune - 0.31);
+    setCounters(state, size);
+}
+BENCHMARK_CAPTURE(BM_Estimator, fft, std::string("fft"))
+    ->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Estimator, naff, std::string("naff"))
+    ->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Estimator, nafflib, std::string("nafflib"))
+    ->RangeMultiplier(2)->Range(MIN_WINDOW, MAX_WINDOW)->Unit(benchmark::kMicrosecond);
+
+
+// Recorded data
+
+struct Recording {
+    std::string filename;
+    std::size_t turns = 0;
+    std::size_t bunches = 0;
+};
+
+// Whole file into memory, turn major as the tune CLI reads it
+void BM_RecordedRead(benchmark::State& state, const Recording& recording) {
+    std::vector<int16_t> data(recording.turns * recording.bunches);
+    for(auto _ : state) {
+        HDFLib::HDFFile file(recording.filename);
+        file.open();
+        file.readBlockParallel(0, recording.turns, 0, recording.bunches, data.data(), state.range(0));
+        file.close();
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * data.size() * sizeof(int16_t));
+}
+
+// Every window of one bunch per iteration, windows do not overlap, the bunch
+// advances every iteration so all bunches of the file take their turn
+void BM_RecordedBunch(benchmark::State& state, const Recording& recording, const std::string& name) {
+    std::size_t size = state.range(0);
+    if(recording.turns < size) {
+        state.SkipWithError("recording shorter than the window");
+        return;
+    }
+    std::vector<int16_t> data(recording.turns * recording.bunches);
+    {
+        HDFLib::HDFFile file(recording.filename);
+        file.open();
+        file.readBlockParallel(0, recording.turns, 0, recording.bunches, data.data());
+        file.close();
+    }
+    std::unique_ptr<TuneEstimator> estimator = makeEstimator(name, size, 1, 1e-10);
+    std::size_t windows = recording.turns / size;
+    std::vector<double> column(recording.turns);
+    std::size_t bunch = 0;
+    for(auto _ : state) {
+        for(std::size_t turn = 0; turn < recording.turns; turn++) {
+            column[turn] = data[turn * recording.bunches + bunch];
+        }
+        for(std::size_t w = 0; w < windows; w++) {
+            TuneResult result = estimator->estimate(column.data() + w * size, size);
+            benchmark::DoNotOptimize(result);
+        }
+        bunch = (bunch + 1) % recording.bunches;
+    }
+    state.counters["windows"] = windows;
+    state.SetItemsProcessed(state.iterations() * windows);
+    state.SetBytesProcessed(state.iterations() * recording.turns * sizeof(int16_t));
+}
+
+void registerRecorded(const Recording& recording) {
+    benchmark::RegisterBenchmark("BM_RecordedRead", BM_RecordedRead, recording)
+        ->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+    for(const std::string name : { "fft", "naff", "nafflib" }) {
+        benchmark::RegisterBenchmark(("BM_RecordedBunch/" + name).c_str(), BM_RecordedBunch, recording, name)
+            ->RangeMultiplier(4)->Range(MIN_WINDOW, std::min(MAX_WINDOW, recording.turns))->Unit(benchmark::kMillisecond);
+    }
+}
+
+
+int main(int argc, char** argv) {
+    // --file is ours, everything else goes to Google Benchmark
+    Recording recording;
+    recording.filename = DEFAULT_FILE;
+    int kept = 1;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg.compare(0, 7, "--file=") == 0) {
+            recording.filename = arg.substr(7);
+        }
+        else if(arg == "--file" && i + 1 < argc) {
+            recording.filename = argv[++i];
+        }
+        else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    try {
+        HDFLib::HDFFile file(recording.filename);
+        file.open();
+        recording.turns = file.getRows();
+        recording.bunches = file.getColumns();
+        file.close();
+    }
+    catch(const std::exception& e) {
+        std::cerr << "bench: " << e.what() << std::endl;
+    }
+    if(recording.turns > 0 && recording.bunches > 0) {
+        registerRecorded(recording);
+    }
+    else {
+        std::cerr << "bench: no data in " << recording.filename << ", recorded benchmarks left out" << std::endl;
+    }
+
+    benchmark::AddCustomContext("tune_version", TUNE_VERSION);
+    benchmark::AddCustomContext("recording", recording.filename);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
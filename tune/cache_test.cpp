@@ -0,0 +1,161 @@
+// Sidecar cache of decoded files (HDFCache.h) against HDFFile.
+//
+//   cache_test [directory]
+//
+// Builds the int16_t and float sidecars of a chunked, compressed file and compares
+// every bunch with HDFFile::getColumnData, then reopens them from disk without
+// building. A sidecar must be found stale and be rebuilt when the modification time
+// or the size of its source changes, and must not be used when it is cut short. Exits
+// with 1 if any check fails.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+
+#include "hdf5.h"
+#include "HDFCache.h"
+
+const std::size_t BUNCHES = 21;
+const hsize_t CHUNK[2] = { 64, 8 };
+
+std::vector<int16_t> makeData(std::size_t turns, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<int16_t> data(turns * BUNCHES);
+    for(int16_t& value : data) {
+        value = (int16_t)(random() & 0xffff);
+    }
+    return data;
+}
+
+// /B1/horizontal with shuffle and deflate and an edge chunk in both dimensions
+void writeFile(const std::string& filename, std::size_t turns, const std::vector<int16_t>& data) {
+    hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t group = H5Gcreate2(file, "/B1", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hsize_t dims[2] = { turns, BUNCHES };
+    hid_t space = H5Screate_simple(2, dims, nullptr);
+    hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, CHUNK);
+    H5Pset_shuffle(plist);
+    H5Pset_deflate(plist, 6);
+    hid_t dataset = H5Dcreate2(file, "/B1/horizontal", H5T_NATIVE_SHORT, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+    herr_t status = dataset < 0 ? -1 : H5Dwrite(dataset, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data());
+    H5Dclose(dataset);
+    H5Pclose(plist);
+    H5Sclose(space);
+    H5Gclose(group);
+    H5Fclose(file);
+    if(status < 0) {
+        throw std::runtime_error("writing " + filename + " failed");
+    }
+}
+
+// Every bunch of the open cache against the file decoded by HDFFile
+template<class T>
+bool compare(const std::string& what, const HDFLib::BunchCache<T>& cache, const std::string& filename) {
+    HDFLib::HDFFile file(filename);
+    file.open();
+    if(cache.getTurns() != file.getRows() || cache.getBunches() != file.getColumns() ||
+            cache.getPlane() != file.getPlane() || cache.getBeam() != file.getBeam()) {
+        std::cerr << "cache_test: " << what << ": the shape or names differ from the file" << std::endl;
+        return false;
+    }
+    for(std::size_t bunch = 0; bunch < cache.getBunches(); bunch++) {
+        std::unique_ptr<int16_t> column = file.getColumnData(bunch);
+        const T* cached = cache.getBunch(bunch);
+        for(std::size_t turn = 0; turn < cache.getTurns(); turn++) {
+            if(cached[turn] != static_cast<T>(column.get()[turn])) {
+                std::cerr << "cache_test: " << what << ": bunch " << bunch << " differs in turn " << turn << std::endl;
+                return false;
+            }
+        }
+    }
+    file.close();
+    return true;
+}
+
+// Builds the sidecar of filename, then reopens it without building
+template<class T>
+bool buildAndReopen(const std::string& what, const std::string& filename, const std::string& directory) {
+    HDFLib::BunchCache<T> cache(filename, directory);
+    if(cache.open()) {
+        std::cerr << "cache_test: " << what << ": a sidecar was found before it was built" << std::endl;
+        return false;
+    }
+    cache.build();
+    bool ok = compare(what + " after building", cache, filename);
+    cache.close();
+
+    HDFLib::BunchCache<T> reopened(filename, directory);
+    if(!reopened.open()) {
+        std::cerr << "cache_test: " << what << ": the sidecar was not reused" << std::endl;
+        return false;
+    }
+    return ok && compare(what + " reopened", reopened, filename);
+}
+
+// After the source changed the sidecar has to be stale, openOrBuild rebuilds it
+bool rebuilt(const std::string& what, const std::string& filename, const std::string& directory) {
+    HDFLib::BunchCache<int16_t> cache(filename, directory);
+    if(cache.open()) {
+        std::cerr << "cache_test: " << what << ": the stale sidecar was used" << std::endl;
+        return false;
+    }
+    cache.openOrBuild();
+    return compare(what, cache, filename);
+}
+
+int main(int argc, char** argv) {
+    std::string directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path().string();
+    std::string filename = directory + "/cache_test_" + std::to_string(getpid()) + ".h5";
+    std::string sidecars = filename + ".d";
+    std::filesystem::create_directories(sidecars);
+    int failures = 0;
+    auto report = [&](const std::string& what, bool ok) {
+        std::cout << (ok ? "ok     " : "FAILED ") << what << std::endl;
+        failures += ok ? 0 : 1;
+    };
+    auto attempt = [&](const std::string& what, auto check) {
+        bool ok = false;
+        try {
+            ok = check();
+        }
+        catch(const std::exception& e) {
+            std::cerr << "cache_test: " << what << ": " << e.what() << std::endl;
+        }
+        report(what, ok);
+    };
+
+    const std::size_t turns = 1000;
+    writeFile(filename, turns, makeData(turns, 1));
+    attempt("int16_t sidecar", [&]() { return buildAndReopen<int16_t>("int16_t sidecar", filename, sidecars); });
+    attempt("float sidecar", [&]() { return buildAndReopen<float>("float sidecar", filename, sidecars); });
+
+    // the file is only touched, so the time alone tells them apart
+    attempt("rebuilt after the modification time changed", [&]() {
+        auto time = std::filesystem::last_write_time(filename);
+        std::filesystem::last_write_time(filename, time + std::chrono::seconds(1));
+        return rebuilt("rebuilt after the modification time changed", filename, sidecars);
+    });
+    // more turns with the modification time put back
+    attempt("rebuilt after the size changed", [&]() {
+        auto time = std::filesystem::last_write_time(filename);
+        writeFile(filename, turns + 100, makeData(turns + 100, 3));
+        std::filesystem::last_write_time(filename, time);
+        return rebuilt("rebuilt after the size changed", filename, sidecars);
+    });
+    attempt("truncated sidecar not used", [&]() {
+        HDFLib::BunchCache<int16_t> cache(filename, sidecars);
+        std::string sidecar = cache.getCacheFilename();
+        std::filesystem::resize_file(sidecar, std::filesystem::file_size(sidecar) - 2);
+        return !cache.open();
+    });
+
+    std::filesystem::remove_all(sidecars);
+    std::filesystem::remove(filename);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+// Round trip of the raw chunk path of HDFFile against the HDF5 library decoder.
+//
+//   chunk_test [directory]
+//
+// Writes /B1/horizontal datasets with every filter combination HDFFile may meet,
+// with edge chunks, chunks that are never written and a fill value, then compares
+// getDataParallel, getBlockParallel and readBlockParallel with H5Dread byte for
+// byte. Pipelines decodeChunk does not know (fletcher32) must fall back to the
+// library and still match. Exits with 1 on the first mismatch.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+
+#include "hdf5.h"
+#include "HDFLib.h"
+
+struct Case {
+    std::string name;
+    bool scaleOffset;
+    bool shuffle;
+    bool deflate;
+    bool fletcher;
+    // only the first writtenTurns turns are written, the rest stays fill value
+    std::size_t writtenTurns;
+    int16_t fill;
+};
+
+const std::size_t TURNS = 1000;
+const std::size_t BUNCHES = 37;
+const hsize_t CHUNK[2] = { 128, 16 };
+
+// Turns of narrow, full range, constant and extreme values, so scale-offset sees
+// every number of bits per value
+std::vector<int16_t> makeData(uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<int16_t> data(TURNS * BUNCHES);
+    for(std::size_t t = 0; t < TURNS; t++) {
+        for(std::size_t b = 0; b < BUNCHES; b++) {
+            int16_t value;
+            if(t < 256) {
+                value = (int16_t)(random() % 64 - 32);
+            }
+            else if(t < 512) {
+                value = (int16_t)(random() & 0xffff);
+            }
+            else if(t < 640) {
+                value = 1234;
+            }
+            else {
+                // extremes of the type, minbits 16
+                value = (int16_t)(t % 2 == 0 ? INT16_MIN + (int)(random() % 3) : INT16_MAX - (int)(random() % 3));
+            }
+            data[t * BUNCHES + b] = value;
+        }
+    }
+    return data;
+}
+
+void writeFile(const std::string& filename, const Case& c, const std::vector<int16_t>& data) {
+    hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t group = H5Gcreate2(file, "/B1", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hsize_t dims[2] = { TURNS, BUNCHES };
+    hid_t space = H5Screate_simple(2, dims, nullptr);
+    hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, CHUNK);
+    H5Pset_fill_value(plist, H5T_NATIVE_SHORT, &c.fill);
+    if(c.fletcher) {
+        H5Pset_fletcher32(plist);
+    }
+    if(c.scaleOffset) {
+        H5Pset_scaleoffset(plist, H5Z_SO_INT, H5Z_SO_INT_MINBITS_DEFAULT);
+    }
+    if(c.shuffle) {
+        H5Pset_shuffle(plist);
+    }
+    if(c.deflate) {
+        H5Pset_deflate(plist, 6);
+    }
+    hid_t dataset = H5Dcreate2(file, "/B1/horizontal", H5T_NATIVE_SHORT, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+    if(dataset < 0) {
+        throw std::runtime_error("creating the dataset of " + c.name + " failed");
+    }
+
+    hsize_t start[2] = { 0, 0 };
+    hsize_t count[2] = { c.writtenTurns, BUNCHES };
+    hid_t memory = H5Screate_simple(2, count, nullptr);
+    H5Sselect_hyperslab(space, H5S_SELECT_SET, start, nullptr, count, nullptr);
+    if(H5Dwrite(dataset, H5T_NATIVE_SHORT, memory, space, H5P_DEFAULT, data.data()) < 0) {
+        throw std::runtime_error("writing " + c.name + " failed");
+    }
+    H5Sclose(memory);
+    H5Dclose(dataset);
+    H5Pclose(plist);
+    H5Sclose(space);
+    H5Gclose(group);
+    H5Fclose(file);
+}
+
+// The whole dataset through the library's filter pipeline
+std::vector<int16_t> readReference(const std::string& filename) {
+    std::vector<int16_t> data(TURNS * BUNCHES);
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    hid_t dataset = H5Dopen2(file, "/B1/horizontal", H5P_DEFAULT);
+    herr_t status = H5Dread(dataset, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data());
+    H5Dclose(dataset);
+    H5Fclose(file);
+    if(status < 0) {
+        throw std::runtime_error("H5Dread of " + filename + " failed");
+    }
+    return data;
+}
+
+bool compare(const std::string& what, const int16_t* data, const std::vector<int16_t>& reference,
+        std::size_t turn, std::size_t turns, std::size_t bunch, std::size_t bunches) {
+    for(std::size_t t = 0; t < turns; t++) {
+        if(std::memcmp(data + t * bunches, reference.data() + (turn + t) * BUNCHES + bunch, bunches * sizeof(int16_t)) != 0) {
+            std::cerr << "chunk_test: " << what << " differs from H5Dread in turn " << turn + t << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path().string();
+    std::vector<Case> cases = {
+        { "scaleoffset", true, false, false, false, TURNS, 0 },
+        { "deflate", false, false, true, false, TURNS, 0 },
+        { "shuffle", false, true, false, false, TURNS, 0 },
+        { "shuffle+deflate", false, true, true, false, TURNS, 0 },
+        { "scaleoffset+deflate", true, false, true, false, TURNS, 0 },
+        { "scaleoffset+shuffle+deflate", true, true, true, false, TURNS, 0 },
+        { "scaleoffset, partly written", true, false, false, false, 300, -7 },
+        { "deflate, partly written", false, false, true, false, 300, 42 },
+        { "fletcher32+deflate", false, false, true, true, TURNS, 0 },
+    };
+    // blocks with edges inside chunks and across the last partial chunk
+    struct Block { std::size_t turn, turns, bunch, bunches; };
+    std::vector<Block> blocks = { { 0, TURNS, 0, BUNCHES }, { 100, 300, 5, 20 }, { 999, 1, 36, 1 }, { 127, 2, 15, 2 } };
+
+    int failures = 0;
+    for(std::size_t i = 0; i < cases.size(); i++) {
+        const Case& c = cases[i];
+        std::string filename = directory + "/chunk_test_" + std::to_string(i) + ".h5";
+        bool ok = true;
+        try {
+            writeFile(filename, c, makeData(i + 1));
+            std::vector<int16_t> reference = readReference(filename);
+
+            HDFLib::HDFFile file(filename);
+            file.open();
+            for(unsigned threads : { 1u, 4u }) {
+                std::unique_ptr<int16_t> all = file.getDataParallel(threads);
+                ok = ok && compare("getDataParallel", all.get(), reference, 0, TURNS, 0, BUNCHES);
+            }
+            for(const Block& b : blocks) {
+                std::unique_ptr<int16_t> block = file.getBlockParallel(b.turn, b.turns, b.bunch, b.bunches, 3);
+                ok = ok && compare("getBlockParallel", block.get(), reference, b.turn, b.turns, b.bunch, b.bunches);
+                std::vector<int16_t> out(b.turns * b.bunches);
+                file.readBlockParallel(b.turn, b.turns, b.bunch, b.bunches, out.data(), 2);
+                ok = ok && compare("readBlockParallel", out.data(), reference, b.turn, b.turns, b.bunch, b.bunches);
+            }
+            file.close();
+        }
+        catch(const std::exception& e) {
+            std::cerr << "chunk_test: " << c.name << ": " << e.what() << std::endl;
+            ok = false;
+        }
+        std::filesystem::remove(filename);
+        std::cout << (ok ? "ok     " : "FAILED ") << c.name << std::endl;
+        failures += ok ? 0 : 1;
+    }
+    return failures > 0 ? 1 : 0;
+}
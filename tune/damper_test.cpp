@@ -0,0 +1,204 @@
+// Closed form checks of the filters of the damper chain (algos/Damper.hpp).
+//
+//   damper_test
+//
+// The Lowpass impulse response against the truncated, normalised exp(-t / tau), and
+// the DC gain of every filter: Lowpass, the phase equaliser and 20 MHz gain FIRs, a
+// FIR that is a pure delay, and the Hilbert notch turn filter, which must not pass
+// DC. FilterBank::process works in strips of turns and has to match the chain run
+// turn by turn. The turn filter taps and the fitted Hilbert corrections are checked
+// against values printed by MD4063_filter_functions.py (numpy 2.4, scipy 1.17), and
+// the 3 tap filter must pass a betatron oscillation at Q with unit gain and the
+// requested phase advance. Exits with 1 if any check fails.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstdint>
+
+#include "algos/Damper.hpp"
+
+int failures = 0;
+
+void check(const std::string& what, double value, double expected, double tolerance = 1e-12) {
+    bool ok = std::abs(value - expected) <= tolerance;
+    if(!ok) {
+        std::cerr << "damper_test: " << what << " is " << value << ", expected " << expected << std::endl;
+        failures++;
+    }
+}
+
+void report(const std::string& what, int before) {
+    std::cout << (failures == before ? "ok     " : "FAILED ") << what << std::endl;
+}
+
+// Output of a FIR in the middle of a constant input, away from the edges
+double firDCGain(const Damper::FIRFilter& filter, std::size_t taps) {
+    std::size_t n = 4 * taps + 16;
+    std::vector<double> in(n, 1.0), out(n);
+    filter.apply(in.data(), n, out.data());
+    return out[n / 2];
+}
+
+void lowpass() {
+    int before = failures;
+    const double cutoff = 1e6;
+    const double sampleRate = 3 * 40.0789e6;
+    Damper::Lowpass filter(cutoff, sampleRate);
+    std::size_t length = filter.getLength();
+    double tau = sampleRate / (2 * M_PI * cutoff);
+    double norm = (1 - std::exp(-1 / tau)) / (1 - std::exp(-(double)length / tau));
+
+    std::size_t n = length + 50;
+    std::vector<double> impulse(n, 0.0), out(n);
+    impulse[0] = 1.0;
+    filter.apply(impulse.data(), out.data(), 0, n);
+    double sum = 0;
+    for(std::size_t j = 0; j < n; j++) {
+        double expected = j < length ? norm * std::exp(-(double)j / tau) : 0.0;
+        check("Lowpass impulse response at " + std::to_string(j), out[j], expected);
+        sum += out[j];
+    }
+    check("Lowpass DC gain from the impulse response", sum, 1.0);
+
+    std::vector<double> step(n, 1.0);
+    filter.apply(step.data(), out.data(), 0, n);
+    check("Lowpass settled step response", out[n - 1], 1.0);
+    report("Lowpass", before);
+}
+
+void firFilters() {
+    int before = failures;
+    std::vector<double> phase = Damper::normalise(Damper::PHASE_EQUALIZER);
+    check("phase equaliser DC gain", firDCGain(Damper::FIRFilter(phase, Damper::PHASE_ZERO_TAP), phase.size()), 1.0);
+    std::vector<double> gain = Damper::normalise(Damper::LOWPASS_20MHZ);
+    check("20 MHz gain filter DC gain", firDCGain(Damper::FIRFilter(gain, Damper::GAIN_ZERO_TAP), gain.size()), 1.0);
+    report("FIRFilter DC gain", before);
+
+    // y[j] = x[j - 3]
+    before = failures;
+    Damper::FIRFilter delay({ 0, 0, 0, 1 }, 0);
+    check("delay DC gain", firDCGain(delay, 4), 1.0);
+    std::vector<double> impulse(20, 0.0), out(20);
+    impulse[5] = 1.0;
+    delay.apply(impulse.data(), impulse.size(), out.data());
+    for(std::size_t j = 0; j < out.size(); j++) {
+        check("delayed impulse at " + std::to_string(j), out[j], j == 8 ? 1.0 : 0.0);
+    }
+    report("FIRFilter delay", before);
+}
+
+void turnFilters() {
+    int before = failures;
+    const double Q = 0.31;
+    std::vector<double> taps = Damper::hilbertNotchCoefficients(Q, 0.02, 0.9, 1, 0.25);
+    TurnFilter filter(taps, 1, 3);
+    std::vector<double> row = { 1.0, -2.5, 7.0 }, out(3);
+    for(std::size_t t = 0; t < 2 * filter.getDepth() + 1; t++) {
+        filter.process(row.data(), out.data());
+    }
+    for(double value : out) {
+        check("Hilbert notch DC gain", value, 0.0);
+    }
+    report("TurnFilter notch DC gain", before);
+}
+
+// Values printed by calculate_coefficients_3_tap(0.31, 1, 0.25) and
+// hilbert_notch_coefficients(0.31, 0.02, 0.9, 1, 0.25)
+void pythonCoefficients() {
+    int before = failures;
+    const std::vector<double> threeTap = { -0.6421900200408525, 0.5003543753274495, 0.14183564471340293 };
+    std::vector<double> taps = Damper::coefficients3Tap(0.31, 1, 0.25);
+    for(std::size_t i = 0; i < threeTap.size(); i++) {
+        check("3 tap coefficient " + std::to_string(i), taps[i], threeTap[i], 1e-14);
+    }
+    const std::vector<double> notch = { 0.09721974906620197, -0.09721974906620197, 0.2916592471986059,
+        -1.0663270715021547, 0.48300857710494294, 0.2916592471986059, -0.09721974906620197, 0.09721974906620197 };
+    taps = Damper::hilbertNotchCoefficients(0.31, 0.02, 0.9, 1, 0.25);
+    check("Hilbert notch length", taps.size(), notch.size(), 0.0);
+    for(std::size_t i = 0; i < notch.size() && i < taps.size(); i++) {
+        check("Hilbert notch coefficient " + std::to_string(i), taps[i], notch[i], 1e-14);
+    }
+    report("turn filter taps against Python", before);
+}
+
+// A cosine at the tune through the 3 tap TurnFilter comes out with the same amplitude
+// and advanced by the additional phase, for the delay it was designed for
+void threeTapResponse() {
+    int before = failures;
+    const int delay = 1;
+    for(double Q : { 64.31, 59.32, 0.28 }) {
+        for(double phase : { 0.25, 0.0, 0.1 }) {
+            TurnFilter filter(Damper::coefficients3Tap(Q, delay, phase), delay, 1);
+            int start = failures;
+            for(int t = 0; t < 40 && failures == start; t++) {
+                double in = std::cos(2 * M_PI * Q * t), out;
+                filter.process(&in, &out);
+                // the register holds the 3 taps from turn delay + 2 on
+                if(t >= delay + 2) {
+                    check("3 tap output for Q " + std::to_string(Q) + ", phase " + std::to_string(phase) +
+                        " in turn " + std::to_string(t), out, std::cos(2 * M_PI * (Q * t + phase)), 1e-9);
+                }
+            }
+        }
+    }
+    report("3 tap filter gain and phase at Q", before);
+}
+
+// calculate_hilbert_corrections(Q, 1, 0.25) for the tunes of main.py with the
+// settings of Damper.py. TNC stops at its evaluation limit, Nelder-Mead converges to
+// the same minimum within a few 1e-6.
+void pythonCorrections() {
+    int before = failures;
+    struct Reference { double Q, phase, gain; };
+    for(const Reference& r : { Reference { 64.31, 0.0002402919634532097, 0.6038320123918933 },
+            Reference { 59.32, 0.5, 0.5890638828702344 } }) {
+        std::pair<double, double> corrections = Damper::hilbertCorrections(r.Q, 1, 0.25);
+        check("phase correction for Q " + std::to_string(r.Q), corrections.first, r.phase, 1e-6);
+        check("gain correction for Q " + std::to_string(r.Q), corrections.second, r.gain, 1e-5);
+    }
+    report("Hilbert corrections against Python", before);
+}
+
+// process in strips against processTurn turn by turn, over more than one strip
+void strips() {
+    int before = failures;
+    const std::size_t slots = 48;
+    const std::size_t turns = 2 * Damper::FilterBank::STRIP_TURNS + 77;
+    std::mt19937 random(41);
+    std::normal_distribution<double> noise(0.0, 800.0);
+    std::vector<int16_t> rows(turns * slots);
+    for(std::size_t t = 0; t < turns; t++) {
+        for(std::size_t b = 0; b < slots; b++) {
+            rows[t * slots + b] = (int16_t)std::lround(3000 * std::cos(2 * M_PI * 0.31 * t + b) + noise(random));
+        }
+    }
+    Damper::Config config;
+    config.fitCorrections = false;
+    Damper::FilterBank bank(slots, 0.31, config);
+    Damper::FilterBank reference(slots, 0.31, config);
+    std::vector<double> kicks(turns * slots);
+    bank.process(rows.data(), turns, kicks.data(), 3);
+    std::vector<double> samples(slots * reference.getFactor()), expected(slots);
+    for(std::size_t t = 0; t < turns && failures == before; t++) {
+        reference.processTurn(rows.data() + t * slots, samples.data());
+        reference.toKicks(samples.data(), expected.data());
+        for(std::size_t b = 0; b < slots; b++) {
+            check("kick of slot " + std::to_string(b) + " in turn " + std::to_string(t), kicks[t * slots + b], expected[b], 0.0);
+        }
+    }
+    report("FilterBank::process in strips", before);
+}
+
+int main() {
+    lowpass();
+    firFilters();
+    turnFilters();
+    pythonCoefficients();
+    threeTapResponse();
+    pythonCorrections();
+    strips();
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+// Bit exactness of the fixed point filters (algos/FixedPoint.hpp) against a plain
+// int64 model of their arithmetic.
+//
+//   fixed_test
+//
+// The model takes the taps in pairs, adds each pair to the accumulator in tap order,
+// saturating it to 32 bit, then rounds, shifts and saturates to int16, all in int64
+// without the helpers of the header. FIRFilter apply (SSE2 where available),
+// applyScalar and decimate, and TurnFilter over blocks of any length must match it
+// on random inputs and on inputs that saturate the accumulator and the output.
+// Exits with 1 on the first mismatch of a case.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+
+#include "algos/FixedPoint.hpp"
+
+std::mt19937_64 random64(43);
+
+int64_t clamp(int64_t x, int64_t low, int64_t high) {
+    return x < low ? low : x > high ? high : x;
+}
+
+// Rounded, shifted and saturated output of an int32 accumulator
+int16_t model(int64_t acc, int shift) {
+    if(shift > 0) {
+        int64_t divisor = (int64_t)1 << shift;
+        acc = clamp(acc + divisor / 2, INT32_MIN, INT32_MAX);
+        // floor division, as the arithmetic shift
+        acc = (acc - (((acc % divisor) + divisor) % divisor)) / divisor;
+    }
+    return (int16_t)clamp(acc, INT16_MIN, INT16_MAX);
+}
+
+// One output from the values tap k reads, value(k)
+template<typename Value>
+int16_t modelOutput(const std::vector<int>& taps, int shift, Value value) {
+    int64_t acc = 0;
+    for(std::size_t k = 0; k < taps.size(); k += 2) {
+        int64_t pair = value(k) * taps[k];
+        if(k + 1 < taps.size()) {
+            pair += value(k + 1) * taps[k + 1];
+        }
+        acc = clamp(acc + pair, INT32_MIN, INT32_MAX);
+    }
+    return model(acc, shift);
+}
+
+// y[j] = sum_k c[k] x[j + zeroTap - k], samples outside are zero
+std::vector<int16_t> modelFIR(const std::vector<int>& taps, int zeroTap, int shift, const std::vector<int16_t>& in) {
+    long n = in.size();
+    std::vector<int16_t> out(n);
+    for(long j = 0; j < n; j++) {
+        out[j] = modelOutput(taps, shift, [&](std::size_t k) -> int64_t {
+            long s = j + zeroTap - (long)k;
+            return s < 0 || s >= n ? 0 : in[s];
+        });
+    }
+    return out;
+}
+
+// y[t][b] = sum_i c[i] x[t - delay - i][b], zero for the first taps + delay - 1 turns
+std::vector<int16_t> modelTurns(const std::vector<int>& taps, int delay, std::size_t width, int shift,
+        const std::vector<int16_t>& rows) {
+    long turns = rows.size() / width;
+    std::vector<int16_t> out(rows.size(), 0);
+    for(long t = (long)taps.size() + delay - 1; t < turns; t++) {
+        for(std::size_t b = 0; b < width; b++) {
+            out[t * width + b] = modelOutput(taps, shift, [&](std::size_t i) -> int64_t {
+                return rows[(t - delay - (long)i) * width + b];
+            });
+        }
+    }
+    return out;
+}
+
+enum Fill { RANDOM, EXTREMES, SMALL };
+
+std::vector<int16_t> samples(std::size_t n, Fill fill) {
+    std::vector<int16_t> out(n);
+    for(std::size_t i = 0; i < n; i++) {
+        if(fill == RANDOM) {
+            out[i] = (int16_t)(random64() & 0xffff);
+        }
+        else if(fill == EXTREMES) {
+            // full scale of either sign, mostly the same so sums run into the limits
+            out[i] = random64() % 8 == 0 ? INT16_MAX : INT16_MIN + (int)(random64() % 2);
+        }
+        else {
+            out[i] = (int16_t)((int)(random64() % 7) - 3);
+        }
+    }
+    return out;
+}
+
+std::vector<int> randomTaps(std::size_t count, bool extreme) {
+    std::vector<int> out(count);
+    for(int& tap : out) {
+        tap = extreme ? (random64() % 2 ? INT16_MAX : -INT16_MAX) : (int)(random64() % 65535) - INT16_MAX;
+    }
+    return out;
+}
+
+bool same(const std::string& what, const std::vector<int16_t>& value, const std::vector<int16_t>& expected) {
+    for(std::size_t i = 0; i < expected.size(); i++) {
+        if(value[i] != expected[i]) {
+            std::cerr << "fixed_test: " << what << " differs at " << i << ": " << value[i]
+                << " instead of " << expected[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool firCase(std::size_t tapCount, int zeroTap, int shift, std::size_t n, Fill fill, bool extremeTaps) {
+    std::vector<int> taps = randomTaps(tapCount, extremeTaps);
+    std::vector<int16_t> in = samples(n, fill);
+    std::vector<int16_t> expected = modelFIR(taps, zeroTap, shift, in);
+    Fixed::FIRFilter filter(taps, zeroTap, shift);
+    std::string name = std::to_string(tapCount) + " taps, zero tap " + std::to_string(zeroTap) +
+        ", shift " + std::to_string(shift) + ", " + std::to_string(n) + " samples";
+
+    std::vector<int16_t> out(n);
+    filter.apply(in.data(), n, out.data());
+    bool ok = same("apply with " + name, out, expected);
+    filter.applyScalar(in.data(), n, out.data());
+    ok = ok && same("applyScalar with " + name, out, expected);
+    for(std::size_t factor : { 2, 3, 4, 7 }) {
+        std::vector<int16_t> decimated((n + factor - 1) / factor), kept;
+        filter.decimate(in.data(), n, factor, decimated.data());
+        for(std::size_t j = 0; j < n; j += factor) {
+            kept.push_back(expected[j]);
+        }
+        ok = ok && same("decimate by " + std::to_string(factor) + " with " + name, decimated, kept);
+    }
+    return ok;
+}
+
+bool turnCase(std::size_t tapCount, int delay, std::size_t width, int shift, Fill fill, bool extremeTaps) {
+    const std::size_t turns = 120;
+    std::vector<int> taps = randomTaps(tapCount, extremeTaps);
+    std::vector<int16_t> rows = samples(turns * width, fill);
+    std::vector<int16_t> expected = modelTurns(taps, delay, width, shift, rows);
+    Fixed::TurnFilter filter(taps, delay, width, shift);
+    std::vector<int16_t> out(turns * width);
+    // blocks shorter and longer than the history
+    for(std::size_t turn = 0; turn < turns; ) {
+        std::size_t count = std::min<std::size_t>(1 + random64() % 17, turns - turn);
+        filter.process(rows.data() + turn * width, count, out.data() + turn * width);
+        turn += count;
+    }
+    return same("TurnFilter with " + std::to_string(tapCount) + " taps, delay " + std::to_string(delay) +
+        ", width " + std::to_string(width) + ", shift " + std::to_string(shift), out, expected);
+}
+
+int main() {
+    int failures = 0;
+    auto report = [&](const std::string& what, bool ok) {
+        std::cout << (ok ? "ok     " : "FAILED ") << what << std::endl;
+        failures += ok ? 0 : 1;
+    };
+
+    struct { const char* name; Fill fill; bool extremeTaps; } inputs[] = {
+        { "random", RANDOM, false },
+        { "saturating", EXTREMES, true },
+        { "small", SMALL, false },
+    };
+    for(auto& input : inputs) {
+        bool ok = true;
+        for(std::size_t tapCount : { 1, 2, 3, 8, 63, 64 }) {
+            for(int zeroTap : { -3, 0, (int)tapCount / 2, (int)tapCount + 5 }) {
+                for(int shift : { 0, 1, 15, 30 }) {
+                    for(std::size_t n : { 1, 7, 8, 9, 64, 1003 }) {
+                        ok = ok && firCase(tapCount, zeroTap, shift, n, input.fill, input.extremeTaps);
+                    }
+                }
+            }
+        }
+        report(std::string("FIRFilter, ") + input.name, ok);
+
+        ok = true;
+        for(std::size_t tapCount : { 1, 3, 8, 17 }) {
+            for(int delay : { 0, 1, 4 }) {
+                for(std::size_t width : { 1, 7, 8, 33 }) {
+                    for(int shift : { 0, 15, 30 }) {
+                        ok = ok && turnCase(tapCount, delay, width, shift, input.fill, input.extremeTaps);
+                    }
+                }
+            }
+        }
+        report(std::string("TurnFilter, ") + input.name, ok);
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -5,6 +5,12 @@
 #include "HDFLib.h"
 //#include "algos/Hilbert.hpp"
 #include "AudioFile.h"
+#include "SignalSource.hpp"
+#include "TripleBuffer.hpp"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 #include <math.h>
 
 #ifdef SKIA
@@ -31,22 +37,27 @@ extern "C" {
 #define AVG_NOISE_AMT 0.03
 #define REVOLUTION_FREQUENCY 48000//11245.f
 const double maxFPS = 60.0;
+// Analysis frames kept in the waterfall
+#define WATERFALL_ROWS 256
+
+// Everything the viewer draws for one analysed frame
+struct AnalysisSnapshot {
+    std::vector<double> spectrum1;
+    std::vector<double> spectrum2;
+    double tune = 0.0;
+    int frame = -1;
+    double framesPerSecond = 0.0;
+};
 
 class FFTContainer {
 public:
-    FFTContainer(int size): size { size } {
+    FFTContainer(int size, SignalSource& source): size { size }, source { source } {
         int outSize = size / 2 + 1; 
         in          = std::vector<double>(size);
         window      = std::vector<double>(size);
         out         = std::vector<fftw_complex>(outSize);
         magnitude   = std::vector<double>(outSize);
-        
 
-        // Audio stuff
-        audioFile.load ("./audio.wav");
-        audioSampleRate = audioFile.getSampleRate();
-        audioLengthInSeconds = audioFile.getLengthInSeconds();
-        audioNumSamples = audioFile.getNumSamplesPerChannel();
 
         plan = fftw_plan_dft_r2c_1d(size, in.data(), out.data(), FFTW_ESTIMATE);
         
@@ -66,37 +77,31 @@ public:
         } 
     }
 
-    std::vector<double> getSampleData() {
+    std::vector<double>& getSampleData() {
         return in;
     }
 
-    void fillSampleData(float frequency) {
-        float increment = frequency * 2. * PI;
-        const std::vector<float> pickupOffsets{0, 0.001, 0.00013, 0.002 };
-
-        double totalEnergy = 0.0;
-        for(int turn = 0; turn < size; turn++) {
-            for(int j = 0; j < NUM_PICKUPS; j++) {
-                float pos = (turn + pickupOffsets[j]) / REVOLUTION_FREQUENCY;
-                in[turn] = AMP * std::cos(pos * increment);
-            }
+    // Seekable sources are read at the window starting at time seconds, live sources
+    // just deliver their next block. False without a full block, the last one is kept.
+    bool fillData(double seconds) {
+        std::size_t offset = seconds * source.getSampleRate();
+        if(!source.seek(offset) && source.getLength() != SignalSource::UNBOUNDED) {
+            return false;
         }
+        return source.read(in.data(), size);
     }
 
-    void fillAudioData(int frameIdx) {
-        int offset = (frameIdx / maxFPS) * audioSampleRate;
-        if(offset + size > audioNumSamples) {
-            return;
+    // False when there was no new window, the magnitude is left as it was
+    bool analyse(double seconds) {
+        if(!fillData(seconds)) {
+            return false;
         }
-        for(int i = 0; i < size; i++) {
-            in[i] = *(audioFile.samples[0].data() + offset + i);
-        }
-    }
-
-    std::vector<double>& analyse(float frequency, int count) {
-        fillAudioData(count);
         fftw_execute(plan);
         fillMagnitude();
+        return true;
+    }
+
+    std::vector<double>& getMagnitude() {
         return magnitude;
     }
 
@@ -108,18 +113,14 @@ private:
     std::vector<double> window;
     fftw_plan plan;
 
-    // Audio stuff
-    AudioFile<double> audioFile;
-    size_t audioSampleRate;
-    double audioLengthInSeconds = 0;
-    size_t audioNumSamples = 0;
-
+    SignalSource& source;
 };
 
 
 int main() {
-    FFTContainer container1{N};
-    FFTContainer container2{N*4};
+    AudioSource audio{"./audio.wav"};
+    FFTContainer container1{N, audio};
+    FFTContainer container2{N*4, audio};
     Naff n{N};
 
 
@@ -136,33 +137,81 @@ int main() {
 
     #ifdef SKIA
         InitWindow();
-        const double maxPeriod = 1.0 / maxFPS;
-        double lastTime = 0.0;
+        const float frequency = 100;
+
+        // Frames are analysed back to back on their own thread and the newest result is
+        // handed to the render loop below, which only draws and is paced by vsync. Every
+        // frame takes the window at the current wall clock position, so playback keeps
+        // the sample rate and windows are skipped when analysis falls behind.
+        std::atomic<bool> analysing { true };
+        TripleBuffer<AnalysisSnapshot> snapshots;
+        // every analysed frame goes into the waterfall, also the ones the render loop skips
+        Waterfall waterfall{WATERFALL_ROWS, kWidth/2, frequency - 100, frequency + 100};
+        std::thread analysis([&]() {
+            const bool bounded = audio.getLength() != SignalSource::UNBOUNDED;
+            const double sampleRate = audio.getSampleRate();
+            auto start = std::chrono::steady_clock::now();
+            std::size_t lastOffset = SignalSource::UNBOUNDED;
+            int frame = 0;
+            while(analysing.load(std::memory_order_relaxed)) {
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                std::size_t offset = elapsed.count() * sampleRate;
+                if(bounded && offset == lastOffset) {
+                    // ahead of real time, the next window starts with the next sample
+                    std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>((offset + 1) / sampleRate)));
+                    continue;
+                }
+                if(!container1.analyse(elapsed.count()) || !container2.analyse(elapsed.count())) {
+                    // past the end of a file, the last frame stays on screen
+                    if(bounded) {
+                        break;
+                    }
+                    // a live source without a full block yet
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    continue;
+                }
+                lastOffset = offset;
+                AnalysisSnapshot& snapshot = snapshots.back();
+                // copy assignment reuses the capacity of the slot
+                snapshot.spectrum1 = container1.getMagnitude();
+                snapshot.spectrum2 = container2.getMagnitude();
+                snapshot.tune = n.performAnalysis2(container1.getSampleData(), REVOLUTION_FREQUENCY, frequency);
+                snapshot.frame = frame;
+                std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+                snapshot.framesPerSecond = (frame + 1) / spent.count();
+                frame++;
+                waterfall.addRow(snapshot.spectrum1.data(), snapshot.spectrum1.size(),
+                    REVOLUTION_FREQUENCY / (double)N, snapshot.tune * REVOLUTION_FREQUENCY);
+                snapshots.publish();
+            }
+        });
 
+        double lastTitle = 0.0;
         while(running) {
-            double time = glfwGetTime();
-            double deltaTime = time - lastTime;
-            if(deltaTime > maxPeriod) {
-                float frequency = 100;// + counter / 20.;
-                
-                
-                auto data1 = container1.analyse(frequency, counter);
-                auto data10 = container1.getSampleData();
-                auto data2 = container2.analyse(frequency, counter);
-
-                n.performAnalysis2(data10, REVOLUTION_FREQUENCY, frequency);
-
-                ClearCanvas();
-                DrawPoints(data1, frequency, N, REVOLUTION_FREQUENCY, { 1.0, 0.0, 1.0, 1.0 });
-                DrawPoints(data2, frequency, N*4, REVOLUTION_FREQUENCY, { .1, 0.0, 1.0, 1.0 });
-                running = FlushCanvas();
-                usleep(1000); // = 0.01 second.
-                counter++;
-                lastTime = time;
+            snapshots.update();
+            const AnalysisSnapshot& snapshot = snapshots.front();
 
+            ClearCanvas();
+            if(snapshot.frame >= 0) {
+                DrawPoints(snapshot.spectrum1, frequency, N, REVOLUTION_FREQUENCY, { 1.0, 0.0, 1.0, 1.0 });
+                DrawPoints(snapshot.spectrum2, frequency, N*4, REVOLUTION_FREQUENCY, { .1, 0.0, 1.0, 1.0 });
+            }
+            waterfall.draw(dCanvas, kWidth/4, kHeight/2 + 20, kWidth/2, kHeight/2 - 40);
+            running = FlushCanvas();
+            counter++;
+
+            double time = glfwGetTime();
+            if(time - lastTitle > 1.0) {
+                std::string title = "frame " + std::to_string(snapshot.frame) + " | analysis " +
+                    std::to_string((int)snapshot.framesPerSecond) + " frames/s";
+                glfwSetWindowTitle(window, title.c_str());
+                lastTitle = time;
             }
-            
         }
+
+        analysing = false;
+        analysis.join();
         CloseWindow();
     #endif
 
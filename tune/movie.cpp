@@ -0,0 +1,227 @@
+// Headless spectrum movies of one bunch of an ADTObsBox file.
+//
+//   movie [options] <file>
+//
+// The bunch is cut into windows of --window turns spaced by --hop turns and the
+// magnitude spectrum of every window is drawn like in the viewer, but on CPU raster
+// surfaces (Plotting.hpp built with OFFSCREEN) and on several threads. Frames are
+// written as numbered PNGs or as a raw RGBA stream for a video encoder:
+//
+//   movie -b 42 -o - fill.h5 | ffmpeg -f rawvideo -pix_fmt rgba -s 1200x640 -r 30 -i - b42.mp4
+
+#define OFFSCREEN
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <complex>
+#include <getopt.h>
+
+#include "Plotting.hpp"
+#include "SignalSource.hpp"
+#include "CliParse.hpp"
+
+extern "C" {
+    #include <fftw3.h>
+}
+
+struct Options {
+    std::size_t bunch = 0;
+    std::size_t window = 2048;
+    std::size_t hop = 0;
+    double revolutionFrequency = 11245.0;
+    double center = 0.0;
+    std::string output = "frame_%06zu.png";
+    unsigned threads = 0;
+    std::string input;
+};
+
+void printUsage(std::ostream& out) {
+    out << "usage: movie [options] <file>\n"
+        << "  -b, --bunch N         bunch to render (default 0)\n"
+        << "  -w, --window N        turns per frame (default 2048)\n"
+        << "  -s, --hop N           turns between frames (default: window)\n"
+        << "  -r, --frev HZ         revolution frequency (default 11245)\n"
+        << "  -c, --center HZ       frequency in the middle of the plot (default: peak of the first frame)\n"
+        << "  -o, --output PATTERN  PNG file per frame, one integer conversion such as %06zu\n"
+        << "                        for the frame (%% for a percent sign), - for raw RGBA\n"
+        << "                        frames on stdout\n"
+        << "                        (default frame_%06zu.png)\n"
+        << "  -j, --threads N       rendering threads (default: all cores)\n"
+        << "  -h, --help            show this help\n";
+}
+
+Options parseOptions(int argc, char** argv) {
+    static const option longOptions[] = {
+        { "bunch", required_argument, nullptr, 'b' },
+        { "window", required_argument, nullptr, 'w' },
+        { "hop", required_argument, nullptr, 's' },
+        { "frev", required_argument, nullptr, 'r' },
+        { "center", required_argument, nullptr, 'c' },
+        { "output", required_argument, nullptr, 'o' },
+        { "threads", required_argument, nullptr, 'j' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    Options options;
+    int c;
+    while((c = getopt_long(argc, argv, "b:w:s:r:c:o:j:h", longOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'b': options.bunch = std::stoul(optarg); break;
+            case 'w': options.window = std::stoul(optarg); break;
+            case 's': options.hop = std::stoul(optarg); break;
+            case 'r': options.revolutionFrequency = std::stod(optarg); break;
+            case 'c': options.center = std::stod(optarg); break;
+            case 'o': options.output = optarg; break;
+            case 'j': options.threads = std::stoul(optarg); break;
+            case 'h': printUsage(std::cout); exit(0);
+            default: printUsage(std::cerr); exit(2);
+        }
+    }
+    if(optind + 1 != argc) {
+        printUsage(std::cerr);
+        exit(2);
+    }
+    options.input = argv[optind];
+
+    if(options.window < 4) {
+        throw std::runtime_error("window must be at least 4 turns");
+    }
+    if(options.hop == 0) {
+        options.hop = options.window;
+    }
+    if(options.output != "-") {
+        outputName(options.output, 0);
+    }
+    if(options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return options;
+}
+
+// Hann windowed magnitude spectrum scaled like FFTContainer in main.cpp. The plan is
+// shared, every thread brings its own buffers (new array execute is thread safe).
+class Spectrum {
+    public:
+        Spectrum(std::size_t size): size { size }, in(size), out(size / 2 + 1), window(size) {
+            plan = fftw_plan_dft_r2c_1d(size, in.data(), out.data(), FFTW_ESTIMATE | FFTW_UNALIGNED);
+            for(std::size_t i = 0; i < size; i++) {
+                window[i] = 0.5 * (1 - std::cos(2 * M_PI * i / (size - 1)));
+            }
+        }
+
+        ~Spectrum() {
+            fftw_destroy_plan(plan);
+        }
+
+        void compute(const double* data, std::vector<double>& magnitude) const {
+            thread_local std::vector<double> buffer;
+            thread_local std::vector<std::complex<double>> transform;
+            buffer.resize(size);
+            transform.resize(size / 2 + 1);
+            double mean = 0;
+            for(std::size_t i = 0; i < size; i++) {
+                mean += data[i];
+            }
+            mean /= size;
+            for(std::size_t i = 0; i < size; i++) {
+                buffer[i] = (data[i] - mean) * window[i];
+            }
+            fftw_execute_dft_r2c(plan, buffer.data(), reinterpret_cast<fftw_complex*>(transform.data()));
+            magnitude.resize(transform.size());
+            double scale = 2.0 / size;
+            for(std::size_t i = 0; i < transform.size(); i++) {
+                magnitude[i] = std::abs(transform[i]) * scale;
+            }
+        }
+
+    private:
+        std::size_t size;
+        // only used to create the plan
+        std::vector<double> in;
+        std::vector<fftw_complex> out;
+        std::vector<double> window;
+        fftw_plan plan;
+};
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "movie: " << e.what() << std::endl;
+        return 2;
+    }
+
+    // the whole bunch is read once, frames only index into it
+    std::vector<double> samples;
+    try {
+        HDFBunchSource source(options.input, options.bunch, options.revolutionFrequency);
+        samples.resize(source.getLength());
+        source.readAt(0, samples.data(), samples.size());
+    }
+    catch(const std::exception& e) {
+        std::cerr << "movie: " << options.input << ": " << e.what() << std::endl;
+        return 1;
+    }
+    if(samples.size() < options.window) {
+        std::cerr << "movie: " << options.input << " has fewer turns than one window" << std::endl;
+        return 1;
+    }
+    std::size_t frames = (samples.size() - options.window) / options.hop + 1;
+    int sampleRate = (int)options.revolutionFrequency;
+
+    // the first frame fixes the centre and the scale, so damping stays visible
+    Spectrum spectrum(options.window);
+    std::vector<double> first;
+    spectrum.compute(samples.data(), first);
+    std::size_t peak = std::max_element(first.begin() + 1, first.end()) - first.begin();
+    double center = options.center > 0 ? options.center : binToFrequency(peak, options.window, sampleRate);
+    double scale = first[peak] > 0 ? 4.0 / first[peak] : 1.0;
+
+    FILE* raw = nullptr;
+    std::unique_ptr<FrameOutput> output;
+    if(options.output == "-") {
+        raw = stdout;
+        output.reset(new RawFrames(raw));
+    }
+    else {
+        output.reset(new PNGFrames(options.output));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = RenderFrames(frames, options.threads, [&](std::size_t frame) {
+        thread_local std::vector<double> magnitude;
+        spectrum.compute(samples.data() + frame * options.hop, magnitude);
+        for(double& m : magnitude) {
+            m *= scale;
+        }
+        ClearCanvas();
+        DrawPoints(magnitude, center, options.window, sampleRate, { 1.0, 0.0, 1.0, 1.0 });
+
+        SkFont font;
+        font.setSize(16);
+        SkPaint textPaint;
+        std::string label = "bunch " + std::to_string(options.bunch) + "  turn " + std::to_string(frame * options.hop);
+        DrawString(label.c_str(), font, textPaint, 20, 30);
+    }, *output);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if(raw != nullptr) {
+        fflush(raw);
+    }
+    double seconds = std::max(elapsed.count(), 1e-9);
+    fprintf(stderr, "movie: %zu frames in %.3f s: %.1f frames/s, %u threads\n",
+        frames, seconds, frames / seconds, options.threads);
+    if(!ok) {
+        std::cerr << "movie: rendering or writing frames failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
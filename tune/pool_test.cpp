@@ -0,0 +1,254 @@
+// Reads through the reader processes of HDFReaderPool against HDFFile.
+//
+//   pool_test [directory]
+//
+// Writes files of different shapes, beams and planes and reads them through one
+// pool with slots smaller than a block, so blocks are split into many requests in
+// flight together: readInfo, readBlock of whole files and of blocks with edges
+// inside chunks, readColumn and HDFPooledFile, first one file after the other and
+// then from threads that share the pool. Every read has to match HDFFile. A missing
+// file and a reader killed while it serves a request must be reported as
+// exceptions, and the pool must go on serving with the readers left. Exits with 1
+// if any check fails.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "hdf5.h"
+#include "HDFReaderPool.h"
+
+struct File {
+    std::string beam;
+    std::string plane;
+    std::size_t turns;
+    std::size_t bunches;
+    std::string filename;
+};
+
+void writeFile(const File& f, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<int16_t> data(f.turns * f.bunches);
+    for(int16_t& value : data) {
+        value = (int16_t)(random() % 2000 - 1000);
+    }
+    hid_t file = H5Fcreate(f.filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t group = H5Gcreate2(file, ("/" + f.beam).c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hsize_t dims[2] = { f.turns, f.bunches };
+    hsize_t chunk[2] = { 128, 16 };
+    hid_t space = H5Screate_simple(2, dims, nullptr);
+    hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, chunk);
+    H5Pset_shuffle(plist);
+    H5Pset_deflate(plist, 4);
+    std::string path = "/" + f.beam + "/" + f.plane;
+    hid_t dataset = H5Dcreate2(file, path.c_str(), H5T_NATIVE_SHORT, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+    herr_t status = dataset < 0 ? -1 : H5Dwrite(dataset, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data());
+    H5Dclose(dataset);
+    H5Pclose(plist);
+    H5Sclose(space);
+    H5Gclose(group);
+    H5Fclose(file);
+    if(status < 0) {
+        throw std::runtime_error("writing " + f.filename + " failed");
+    }
+}
+
+bool same(const std::string& what, const int16_t* data, const int16_t* reference, std::size_t count) {
+    if(std::memcmp(data, reference, count * sizeof(int16_t)) != 0) {
+        std::cerr << "pool_test: " << what << " differs from HDFFile" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Every kind of read of one file through the pool against HDFFile
+bool readFile(HDFLib::HDFReaderPool& pool, const File& f) {
+    HDFLib::HDFFile file(f.filename);
+    file.open();
+    HDFLib::HDFReaderPool::Info info = pool.readInfo(f.filename);
+    if(info.turns != file.getRows() || info.bunches != file.getColumns() ||
+            info.plane != file.getPlane() || info.beam != file.getBeam()) {
+        std::cerr << "pool_test: readInfo of " << f.filename << " differs from HDFFile" << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    struct Block { std::size_t turn, turns, bunch, bunches; };
+    std::vector<Block> blocks = { { 0, f.turns, 0, f.bunches }, { 100, 300, 5, f.bunches - 10 }, { 127, 2, 15, 2 },
+        { f.turns - 1, 1, f.bunches - 1, 1 } };
+    for(const Block& b : blocks) {
+        std::vector<int16_t> pooled(b.turns * b.bunches), reference(b.turns * b.bunches);
+        pool.readBlock(f.filename, b.turn, b.turns, b.bunch, b.bunches, pooled.data());
+        file.readBlockParallel(b.turn, b.turns, b.bunch, b.bunches, reference.data(), 1);
+        ok = ok && same("readBlock of " + f.filename, pooled.data(), reference.data(), pooled.size());
+    }
+
+    HDFLib::HDFPooledFile pooledFile = pool.open(f.filename);
+    std::vector<int16_t> column(f.turns);
+    for(std::size_t bunch = 0; bunch < f.bunches; bunch += 7) {
+        std::unique_ptr<int16_t> reference = file.getColumnData(bunch);
+        pool.readColumn(f.filename, f.turns, bunch, column.data());
+        ok = ok && same("readColumn of " + f.filename, column.data(), reference.get(), f.turns);
+        std::unique_ptr<int16_t> pooled = pooledFile.getColumnData(bunch);
+        ok = ok && same("HDFPooledFile column of " + f.filename, pooled.get(), reference.get(), f.turns);
+    }
+    file.close();
+    return ok;
+}
+
+// Children of this process, the readers of the pool
+std::vector<pid_t> readers() {
+    std::vector<pid_t> pids;
+    std::ifstream in("/proc/self/task/" + std::to_string(getpid()) + "/children");
+    for(pid_t pid; in >> pid; ) {
+        pids.push_back(pid);
+    }
+    return pids;
+}
+
+// Opening a FIFO blocks until someone writes to it, so the reader that takes the
+// request can be found waiting in open and be killed while it serves the request
+bool killedReader(HDFLib::HDFReaderPool& pool, const std::string& directory, const File& healthy) {
+    std::string fifo = directory + "/pool_test_" + std::to_string(getpid()) + ".fifo.h5";
+    unlink(fifo.c_str());
+    if(mkfifo(fifo.c_str(), 0600) != 0) {
+        std::cerr << "pool_test: creating " << fifo << " failed" << std::endl;
+        return false;
+    }
+    std::atomic<bool> killed { false };
+    std::thread killer([&]() {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while(!killed && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            for(pid_t pid : readers()) {
+                std::ifstream in("/proc/" + std::to_string(pid) + "/wchan");
+                std::string wchan;
+                in >> wchan;
+                if(wchan.find("fifo") != std::string::npos || wchan.find("partner") != std::string::npos) {
+                    killed = kill(pid, SIGKILL) == 0;
+                }
+            }
+        }
+        // a writer that comes and goes lets the reader's open return and the read fail
+        int fd = killed ? -1 : ::open(fifo.c_str(), O_WRONLY | O_NONBLOCK);
+        if(fd >= 0) {
+            close(fd);
+        }
+    });
+    bool reported = false;
+    try {
+        pool.readInfo(fifo);
+    }
+    catch(const std::exception& e) {
+        reported = std::strstr(e.what(), "exited") != nullptr;
+        if(!reported) {
+            std::cerr << "pool_test: unexpected error for a killed reader: " << e.what() << std::endl;
+        }
+    }
+    killer.join();
+    unlink(fifo.c_str());
+    if(!killed) {
+        std::cerr << "pool_test: no reader was found waiting on " << fifo << std::endl;
+        return false;
+    }
+    if(!reported) {
+        std::cerr << "pool_test: the killed reader was not reported" << std::endl;
+        return false;
+    }
+    return readFile(pool, healthy);
+}
+
+int main(int argc, char** argv) {
+    std::string directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path().string();
+    std::string prefix = directory + "/pool_test_" + std::to_string(getpid());
+    std::vector<File> files = {
+        { "B1", "horizontal", 1000, 37, prefix + "_0.h5" },
+        { "B2", "vertical", 512, 130, prefix + "_1.h5" },
+        { "B1", "vertical", 2048, 20, prefix + "_2.h5" },
+    };
+    int failures = 0;
+    auto report = [&](const std::string& what, bool ok) {
+        std::cout << (ok ? "ok     " : "FAILED ") << what << std::endl;
+        failures += ok ? 0 : 1;
+    };
+    auto attempt = [&](const std::string& what, auto check) {
+        bool ok = false;
+        try {
+            ok = check();
+        }
+        catch(const std::exception& e) {
+            std::cerr << "pool_test: " << what << ": " << e.what() << std::endl;
+        }
+        report(what, ok);
+    };
+
+    try {
+        for(std::size_t i = 0; i < files.size(); i++) {
+            writeFile(files[i], i + 1);
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "pool_test: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // the failures below are expected, the readers inherit the quiet error stack
+    H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+    {
+        // slots of 16 kB hold a few bunches only, forked before any thread is started
+        HDFLib::HDFReaderPool pool(2, 16 << 10, 5);
+        attempt("files one after the other", [&]() {
+            bool ok = true;
+            for(const File& f : files) {
+                ok = readFile(pool, f) && ok;
+            }
+            return ok;
+        });
+        attempt("files from threads sharing the pool", [&]() {
+            std::vector<char> results(2 * files.size(), 0);
+            std::vector<std::thread> threads;
+            for(std::size_t i = 0; i < results.size(); i++) {
+                threads.emplace_back([&, i]() {
+                    try {
+                        results[i] = readFile(pool, files[i % files.size()]);
+                    }
+                    catch(const std::exception& e) {
+                        std::cerr << "pool_test: " << e.what() << std::endl;
+                    }
+                });
+            }
+            for(std::thread& thread : threads) {
+                thread.join();
+            }
+            return std::find(results.begin(), results.end(), 0) == results.end();
+        });
+        attempt("missing file reported", [&]() {
+            try {
+                pool.readInfo(prefix + "_missing.h5");
+            }
+            catch(const std::exception&) {
+                return readFile(pool, files[0]);
+            }
+            std::cerr << "pool_test: reading a missing file did not fail" << std::endl;
+            return false;
+        });
+        attempt("killed reader reported", [&]() { return killedReader(pool, directory, files[1]); });
+    }
+
+    for(const File& f : files) {
+        std::filesystem::remove(f.filename);
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+// Round trip of the columnar results store (ResultsStore.hpp).
+//
+//   store_test [directory]
+//
+// Writes rows of several files, fills and bunches, with runs of one bunch split
+// over small blocks and doubles that include NaN, infinities and -0, and reads them
+// back: the file table, every block bit for bit and query for every fill and bunch
+// in the order the rows were written. A store without rows must open empty. Stores
+// with a footer that is cut short, blocks that do not follow each other, an index
+// that points past the rows, and column or block sizes that promise more than the
+// file can hold must be rejected with a runtime_error instead of allocating for
+// them. Exits with 1 if any check fails.
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <random>
+#include <limits>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <unistd.h>
+
+#include "ResultsStore.hpp"
+
+using ResultsStore::Columns;
+
+const std::vector<std::string> PATHS = {
+    "/data/07355_64k_B1H_Q7_20181025_21h17m01s.h5",
+    "/data/07355_64k_B1V_Q7_20181025_21h17m01s.h5",
+    "/data/07400_64k_B2H_Q7_20181101_03h00m00s.h5",
+};
+
+// Rows in the order they are appended, the file ids index PATHS
+Columns makeRows() {
+    std::mt19937_64 random(47);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    const double specials[] = { std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), -0.0, -1 };
+    Columns rows;
+    for(uint32_t file = 0; file < PATHS.size(); file++) {
+        for(uint32_t bunch : { 0u, 5u, 17u, 3563u }) {
+            // a run of one bunch is cut in two by a run of another in the first file
+            std::size_t windows = file == 0 && bunch == 5 ? 37 : 61;
+            for(std::size_t k = 0; k < windows; k++) {
+                rows.file.push_back(file);
+                rows.bunch.push_back(bunch);
+                rows.start.push_back(k * 512);
+                rows.tune.push_back(0.27 + 1e-4 * uniform(random));
+                rows.amplitude.push_back(k % 29 == 3 ? specials[k % 5] : 1e3 * (1 + uniform(random)));
+                rows.phase.push_back(M_PI * uniform(random));
+                rows.significance.push_back(k % 13 == 0 ? -1 : std::abs(uniform(random)));
+            }
+            if(file == 0 && bunch == 17) {
+                for(std::size_t k = 37; k < 61; k++) {
+                    rows.file.push_back(file);
+                    rows.bunch.push_back(5);
+                    rows.start.push_back(k * 512);
+                    rows.tune.push_back(0.31);
+                    rows.amplitude.push_back(k);
+                    rows.phase.push_back(0.5);
+                    rows.significance.push_back(0.25);
+                }
+            }
+        }
+    }
+    return rows;
+}
+
+void writeStore(const std::string& filename, const Columns& rows, std::size_t blockRows) {
+    ResultsStore::Writer writer(filename, blockRows);
+    for(const std::string& path : PATHS) {
+        writer.addFile(path);
+    }
+    for(std::size_t i = 0; i < rows.size(); i++) {
+        writer.append(rows.file[i], rows.bunch[i], rows.start[i],
+            TuneResult { rows.tune[i], rows.amplitude[i], rows.phase[i], rows.significance[i] });
+    }
+    writer.close();
+}
+
+bool sameBits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// Row i of a against row j of b
+bool sameRow(const Columns& a, std::size_t i, const Columns& b, std::size_t j) {
+    return a.file[i] == b.file[j] && a.bunch[i] == b.bunch[j] && a.start[i] == b.start[j] &&
+        sameBits(a.tune[i], b.tune[j]) && sameBits(a.amplitude[i], b.amplitude[j]) &&
+        sameBits(a.phase[i], b.phase[j]) && sameBits(a.significance[i], b.significance[j]);
+}
+
+bool same(const std::string& what, const Columns& value, const Columns& expected) {
+    if(value.size() != expected.size()) {
+        std::cerr << "store_test: " << what << " has " << value.size() << " rows instead of " << expected.size() << std::endl;
+        return false;
+    }
+    for(std::size_t i = 0; i < expected.size(); i++) {
+        if(!sameRow(value, i, expected, i)) {
+            std::cerr << "store_test: " << what << " differs in row " << i << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool roundTrip(const std::string& filename) {
+    Columns rows = makeRows();
+    writeStore(filename, rows, 100);
+    ResultsStore::Reader reader(filename);
+    bool ok = reader.getRows() == rows.size() && reader.getBlocks() == (rows.size() + 99) / 100 &&
+        reader.getFiles().size() == PATHS.size();
+    for(std::size_t f = 0; ok && f < PATHS.size(); f++) {
+        ok = reader.getFiles()[f].path == PATHS[f] && reader.getFiles()[f].fill == ResultsStore::parseFill(PATHS[f]);
+    }
+    if(!ok) {
+        std::cerr << "store_test: the row count, block count or file table differs" << std::endl;
+        return false;
+    }
+
+    Columns all, block;
+    for(std::size_t b = 0; b < reader.getBlocks(); b++) {
+        reader.readBlock(b, block);
+        all.append(block, 0, block.size());
+    }
+    ok = same("readBlock", all, rows);
+
+    for(const std::string& path : PATHS) {
+        uint32_t fill = ResultsStore::parseFill(path);
+        for(uint32_t bunch : { 0u, 5u, 17u, 3563u }) {
+            Columns expected;
+            for(std::size_t i = 0; i < rows.size(); i++) {
+                if(ResultsStore::parseFill(PATHS[rows.file[i]]) == fill && rows.bunch[i] == bunch) {
+                    expected.append(rows, i, 1);
+                }
+            }
+            ok = same("query of fill " + std::to_string(fill) + ", bunch " + std::to_string(bunch),
+                reader.query(fill, bunch), expected) && ok;
+        }
+    }
+    return same("query of an unknown bunch", reader.query(7355, 1), Columns()) && ok;
+}
+
+bool emptyStore(const std::string& filename) {
+    writeStore(filename, Columns(), 100);
+    ResultsStore::Reader reader(filename);
+    return reader.getRows() == 0 && reader.getBlocks() == 0 && reader.getIndex().empty() &&
+        reader.getFiles().size() == PATHS.size();
+}
+
+std::vector<char> readBytes(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// Offsets of the block table and the index in the footer
+struct Layout {
+    uint64_t blocks;
+    uint64_t index;
+};
+
+Layout layout(const std::vector<char>& bytes) {
+    uint64_t offset, count, length;
+    std::memcpy(&offset, bytes.data() + bytes.size() - sizeof(uint64_t) - sizeof(ResultsStore::MAGIC), sizeof(offset));
+    std::memcpy(&count, bytes.data() + offset, sizeof(count));
+    offset += sizeof(count);
+    for(uint64_t f = 0; f < count; f++) {
+        std::memcpy(&length, bytes.data() + offset + sizeof(uint32_t), sizeof(length));
+        offset += sizeof(uint32_t) + sizeof(length) + length;
+    }
+    Layout result;
+    std::memcpy(&count, bytes.data() + offset, sizeof(count));
+    result.blocks = offset + sizeof(count);
+    result.index = result.blocks + count * sizeof(ResultsStore::BlockEntry) + sizeof(count);
+    return result;
+}
+
+void patch(std::vector<char>& bytes, uint64_t offset, uint64_t value) {
+    std::memcpy(bytes.data() + offset, &value, sizeof(value));
+}
+
+// Opening the store and decoding all of its blocks has to fail with a runtime_error
+bool rejected(const std::string& what, const std::string& filename, const std::vector<char>& bytes) {
+    std::ofstream(filename, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size());
+    try {
+        ResultsStore::Reader reader(filename);
+        Columns block;
+        for(std::size_t b = 0; b < reader.getBlocks(); b++) {
+            reader.readBlock(b, block);
+        }
+    }
+    catch(const std::runtime_error&) {
+        return true;
+    }
+    catch(const std::exception& e) {
+        std::cerr << "store_test: " << what << " failed with " << e.what() << " instead of a runtime_error" << std::endl;
+        return false;
+    }
+    std::cerr << "store_test: " << what << " was accepted" << std::endl;
+    return false;
+}
+
+bool corrupt(const std::string& filename) {
+    std::string original = filename + ".orig";
+    writeStore(original, makeRows(), 100);
+    const std::vector<char> bytes = readBytes(original);
+    std::filesystem::remove(original);
+    Layout at = layout(bytes);
+    const uint64_t blockSize = sizeof(ResultsStore::BlockEntry);
+    const uint64_t ROWS = offsetof(ResultsStore::BlockEntry, rows);
+    const uint64_t FIRST_ROW = offsetof(ResultsStore::BlockEntry, firstRow);
+    const uint64_t OFFSET = offsetof(ResultsStore::BlockEntry, offset);
+    bool ok = true;
+
+    std::vector<char> cut(bytes.begin(), bytes.end());
+    cut.erase(cut.end() - 40, cut.end() - 16);
+    ok = rejected("a footer cut short", filename, cut) && ok;
+
+    std::vector<char> gap = bytes;
+    patch(gap, at.blocks + blockSize + FIRST_ROW, 101);
+    ok = rejected("a gap between blocks", filename, gap) && ok;
+
+    std::vector<char> overlap = bytes;
+    patch(overlap, at.blocks + blockSize + FIRST_ROW, 99);
+    ok = rejected("overlapping blocks", filename, overlap) && ok;
+
+    std::vector<char> empty = bytes;
+    patch(empty, at.blocks + ROWS, 0);
+    ok = rejected("a block without rows", filename, empty) && ok;
+
+    std::vector<char> huge = bytes;
+    patch(huge, at.blocks + ROWS, 1ull << 62);
+    patch(huge, at.blocks + blockSize + FIRST_ROW, 1ull << 62);
+    ok = rejected("a block of 2^62 rows", filename, huge) && ok;
+
+    // index entries are fill, bunch, firstRow and rows
+    std::vector<char> past = bytes;
+    patch(past, at.index + 8, makeRows().size() - 5);
+    patch(past, at.index + 16, 6);
+    ok = rejected("an index entry past the rows", filename, past) && ok;
+
+    std::vector<char> wrapped = bytes;
+    patch(wrapped, at.index + 8, 10);
+    patch(wrapped, at.index + 16, UINT64_MAX - 5);
+    ok = rejected("an index entry that wraps", filename, wrapped) && ok;
+
+    // the raw size in front of the first column of the first block
+    uint64_t column;
+    std::memcpy(&column, bytes.data() + at.blocks + OFFSET, sizeof(column));
+    std::vector<char> raw = bytes;
+    patch(raw, column, 1ull << 50);
+    ok = rejected("a column raw size of 2^50 bytes", filename, raw) && ok;
+    patch(raw, column, 100 * 10 + 1);
+    ok = rejected("a column raw size over 10 bytes per row", filename, raw) && ok;
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::string directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path().string();
+    std::string filename = directory + "/store_test_" + std::to_string(getpid()) + ".tres";
+    int failures = 0;
+    auto attempt = [&](const std::string& what, auto check) {
+        bool ok = false;
+        try {
+            ok = check();
+        }
+        catch(const std::exception& e) {
+            std::cerr << "store_test: " << what << ": " << e.what() << std::endl;
+        }
+        std::cout << (ok ? "ok     " : "FAILED ") << what << std::endl;
+        failures += ok ? 0 : 1;
+    };
+
+    attempt("round trip", [&]() { return roundTrip(filename); });
+    attempt("store without rows", [&]() { return emptyStore(filename); });
+    attempt("corrupt stores rejected", [&]() { return corrupt(filename); });
+    std::filesystem::remove(filename);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+// Round trip of the streaming writer of HDFFile (setStreaming, appendRows).
+//
+//   stream_test [directory]
+//
+// Streams turns in batches of random length into a new file, with the chunk rows
+// written on the calling thread and on the background thread of setAsyncFlush, for
+// turn counts that are a multiple of the chunk, that are not and that are less than
+// one chunk. After close the file must read back through HDFFile and H5Dread with
+// exactly the streamed turns. A writer that calls flush and exits without close
+// must leave every appended turn readable with SWMR, and turns appended after a
+// flush must complete the partial chunk row it wrote. Exits with 1 if any check
+// fails.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "hdf5.h"
+#include "HDFLib.h"
+
+const std::size_t BUNCHES = 13;
+const std::size_t CHUNK = 16;
+
+int16_t value(std::size_t turn, std::size_t bunch) {
+    return (int16_t)((turn * 131 + bunch * 7) % 65536);
+}
+
+// Appends turns first to turns - 1 in batches of 1 to 37 turns
+void append(HDFLib::HDFFile& file, std::size_t first, std::size_t turns, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<int16_t> rows;
+    for(std::size_t turn = first; turn < turns; ) {
+        std::size_t count = std::min<std::size_t>(1 + random() % 37, turns - turn);
+        rows.resize(count * BUNCHES);
+        for(std::size_t t = 0; t < count; t++) {
+            for(std::size_t b = 0; b < BUNCHES; b++) {
+                rows[t * BUNCHES + b] = value(turn + t, b);
+            }
+        }
+        file.appendRows(rows.data(), count);
+        turn += count;
+    }
+}
+
+void create(HDFLib::HDFFile& file, bool async) {
+    file.setBunches(BUNCHES);
+    file.setStreaming(true);
+    file.setAsyncFlush(async);
+    file.setCompressionChunks(CHUNK);
+    file.open(HDFLib::CREATE);
+}
+
+bool same(const std::string& what, const int16_t* data, std::size_t turns) {
+    for(std::size_t t = 0; t < turns; t++) {
+        for(std::size_t b = 0; b < BUNCHES; b++) {
+            if(data[t * BUNCHES + b] != value(t, b)) {
+                std::cerr << "stream_test: " << what << " differs in turn " << t << ", bunch " << b << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The dataset through the library, with SWMR so a file whose writer never closed it opens
+bool readLibrary(const std::string& what, const std::string& filename, std::size_t turns) {
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+    if(file < 0) {
+        std::cerr << "stream_test: " << what << ": opening " << filename << " failed" << std::endl;
+        return false;
+    }
+    hid_t dataset = H5Dopen2(file, "/B1/horizontal", H5P_DEFAULT);
+    hid_t space = H5Dget_space(dataset);
+    hsize_t dims[2] = { 0, 0 };
+    H5Sget_simple_extent_dims(space, dims, nullptr);
+    std::vector<int16_t> data(dims[0] * dims[1]);
+    herr_t status = dims[0] == turns && dims[1] == BUNCHES ?
+        H5Dread(dataset, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data()) : -1;
+    H5Sclose(space);
+    H5Dclose(dataset);
+    H5Fclose(file);
+    if(status < 0) {
+        std::cerr << "stream_test: " << what << ": " << dims[0] << " x " << dims[1] << " read instead of "
+            << turns << " x " << BUNCHES << std::endl;
+        return false;
+    }
+    return same(what + " through H5Dread", data.data(), turns);
+}
+
+bool roundTrip(const std::string& filename, bool async, std::size_t turns) {
+    std::filesystem::remove(filename);
+    {
+        HDFLib::HDFFile file(filename);
+        create(file, async);
+        append(file, 0, turns, turns);
+        file.close();
+    }
+    HDFLib::HDFFile file(filename);
+    file.open();
+    if(file.getRows() != turns || file.getColumns() != BUNCHES) {
+        std::cerr << "stream_test: " << file.getRows() << " x " << file.getColumns() << " turns read back instead of "
+            << turns << " x " << BUNCHES << std::endl;
+        return false;
+    }
+    std::unique_ptr<int16_t> data = file.getData();
+    bool ok = same("HDFFile", data.get(), turns);
+    file.close();
+    return ok && readLibrary("closed file", filename, turns);
+}
+
+// A child streams flushed turns and exits without closing, then a second writer
+// appends turns after a flush and closes
+bool flushed(const std::string& filename, bool async) {
+    const std::size_t turns = 5 * CHUNK + 3;
+    std::filesystem::remove(filename);
+    pid_t pid = fork();
+    if(pid == 0) {
+        int status = 0;
+        try {
+            HDFLib::HDFFile file(filename);
+            create(file, async);
+            append(file, 0, turns, 7);
+            file.flush();
+        }
+        catch(const std::exception& e) {
+            std::cerr << "stream_test: " << e.what() << std::endl;
+            status = 1;
+        }
+        // no destructors, the file stays as a writer that died would leave it
+        _exit(status);
+    }
+    int status = -1;
+    if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "stream_test: the writer process failed" << std::endl;
+        return false;
+    }
+    bool ok = readLibrary("file flushed and never closed", filename, turns);
+
+    std::filesystem::remove(filename);
+    {
+        HDFLib::HDFFile file(filename);
+        create(file, async);
+        append(file, 0, turns, 8);
+        file.flush();
+        append(file, turns, 2 * turns, 9);
+        file.close();
+    }
+    return readLibrary("file appended after a flush", filename, 2 * turns) && ok;
+}
+
+int main(int argc, char** argv) {
+    std::string directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path().string();
+    std::string filename = directory + "/stream_test_" + std::to_string(getpid()) + ".h5";
+    int failures = 0;
+    auto attempt = [&](const std::string& what, auto check) {
+        bool ok = false;
+        try {
+            ok = check();
+        }
+        catch(const std::exception& e) {
+            std::cerr << "stream_test: " << what << ": " << e.what() << std::endl;
+        }
+        std::cout << (ok ? "ok     " : "FAILED ") << what << std::endl;
+        failures += ok ? 0 : 1;
+    };
+
+    for(bool async : { false, true }) {
+        std::string mode = async ? "async flush" : "sync flush";
+        for(std::size_t turns : { 10 * CHUNK, 10 * CHUNK + 5, CHUNK - 3 }) {
+            attempt(mode + ", " + std::to_string(turns) + " turns", [&]() { return roundTrip(filename, async, turns); });
+        }
+        attempt(mode + ", flush without close", [&]() { return flushed(filename, async); });
+    }
+    std::filesystem::remove(filename);
+    return failures > 0 ? 1 : 0;
+}
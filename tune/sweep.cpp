@@ -0,0 +1,354 @@
+// Parameter sweeps of the damper model and the tune estimators.
+//
+//   sweep [options] -o results.tsv
+//
+// The grid is the product of the --gain, --delay, --phase, --order and --window
+// lists. Every point tracks the beam of Tracker.hpp with that damper setting and
+// estimates the tune of the analysed bunches from the first --window turns of the
+// pickup signal. Points run on a work stealing pool, each completed point is
+// appended to the output, and running the same command again resumes the sweep.
+// With --shard k/n a process only takes the points i with i % n == k, so several
+// processes or nodes can split a sweep, each with its own output.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <getopt.h>
+
+#include "Tracker.hpp"
+#include "Sweep.hpp"
+#include "CliParse.hpp"
+#include "algos/TuneEstimator.hpp"
+
+struct Options {
+    std::string gains = "0.1";
+    std::string delays = "1";
+    std::string phases = "0.25";
+    std::string orders = "2";
+    std::string windows = "512";
+    std::string estimator = "naff";
+    double tolerance = 1.490116e-8;
+    std::string plane = "horizontal";
+    std::size_t turns = 0;
+    std::string filling = "all";
+    std::string bunches = "all";
+    std::size_t slices = 1;
+    double chromaticity = 0.0;
+    double tuneSpread = 0.0;
+    double amplitude = 1e-4;
+    bool coherent = false;
+    double noise = 0.0;
+    uint64_t seed = 1;
+    std::string output;
+    std::size_t shard = 0;
+    std::size_t shards = 1;
+    unsigned threads = 0;
+};
+
+void printUsage(std::ostream& out) {
+    out << "usage: sweep [options] -o FILE\n"
+        << "  grid, values and start:stop:count ranges:\n"
+        << "  -g, --gain LIST       damper gains (default 0.1)\n"
+        << "  -d, --delay LIST      processing delays in turns (default 1)\n"
+        << "      --phase LIST      additional phase advances (default 0.25)\n"
+        << "      --order LIST      orders of the Hann harmonic window (default 2)\n"
+        << "  -w, --window LIST     turns analysed per bunch (default 512)\n"
+        << "  fixed settings:\n"
+        << "  -e, --estimator E     naff, naff-classic, nafflib, fft, interpolated or hilbert\n"
+        << "                        (default naff)\n"
+        << "      --tolerance X     tune tolerance of the naff and naff-classic estimators\n"
+        << "  -p, --plane P         horizontal or vertical (default horizontal)\n"
+        << "  -t, --turns N         turns tracked (default: the longest window)\n"
+        << "  -f, --filling LIST    filled slots (default all 3564)\n"
+        << "  -b, --bunches LIST    indices of the filled bunches to analyse (default all)\n"
+        << "      --slices N        rigid slices per bunch (default 1)\n"
+        << "      --chroma X        chromaticity Q' (default 0)\n"
+        << "      --spread X        further rms incoherent tune spread (default 0)\n"
+        << "  -a, --amplitude M     initial centroid offset in metres (default 1e-4)\n"
+        << "      --coherent        all bunches start in phase\n"
+        << "      --noise M         rms pickup noise in metres (default 0)\n"
+        << "      --seed N          seed of the phases and noise (default 1)\n"
+        << "  run:\n"
+        << "  -o, --output FILE     results and checkpoint, an existing file is resumed\n"
+        << "      --shard K/N       only run the points i with i % N == K\n"
+        << "  -j, --threads N       threads (default: all cores)\n"
+        << "  -h, --help            show this help\n";
+}
+
+Options parseOptions(int argc, char** argv) {
+    enum { PHASE = 1000, ORDER, TOLERANCE, SLICES, CHROMA, SPREAD, COHERENT, NOISE, SEED, SHARD };
+    static const option longOptions[] = {
+        { "gain", required_argument, nullptr, 'g' },
+        { "delay", required_argument, nullptr, 'd' },
+        { "phase", required_argument, nullptr, PHASE },
+        { "order", required_argument, nullptr, ORDER },
+        { "window", required_argument, nullptr, 'w' },
+        { "estimator", required_argument, nullptr, 'e' },
+        { "tolerance", required_argument, nullptr, TOLERANCE },
+        { "plane", required_argument, nullptr, 'p' },
+        { "turns", required_argument, nullptr, 't' },
+        { "filling", required_argument, nullptr, 'f' },
+        { "bunches", required_argument, nullptr, 'b' },
+        { "slices", required_argument, nullptr, SLICES },
+        { "chroma", required_argument, nullptr, CHROMA },
+        { "spread", required_argument, nullptr, SPREAD },
+        { "amplitude", required_argument, nullptr, 'a' },
+        { "coherent", no_argument, nullptr, COHERENT },
+        { "noise", required_argument, nullptr, NOISE },
+        { "seed", required_argument, nullptr, SEED },
+        { "output", required_argument, nullptr, 'o' },
+        { "shard", required_argument, nullptr, SHARD },
+        { "threads", required_argument, nullptr, 'j' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    Options options;
+    int c;
+    while((c = getopt_long(argc, argv, "g:d:w:e:p:t:f:b:a:o:j:h", longOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'g': options.gains = optarg; break;
+            case 'd': options.delays = optarg; break;
+            case PHASE: options.phases = optarg; break;
+            case ORDER: options.orders = optarg; break;
+            case 'w': options.windows = optarg; break;
+            case 'e': options.estimator = optarg; break;
+            case TOLERANCE: options.tolerance = std::stod(optarg); break;
+            case 'p': options.plane = optarg; break;
+            case 't': options.turns = std::stoul(optarg); break;
+            case 'f': options.filling = optarg; break;
+            case 'b': options.bunches = optarg; break;
+            case SLICES: options.slices = std::stoul(optarg); break;
+            case CHROMA: options.chromaticity = std::stod(optarg); break;
+            case SPREAD: options.tuneSpread = std::stod(optarg); break;
+            case 'a': options.amplitude = std::stod(optarg); break;
+            case COHERENT: options.coherent = true; break;
+            case NOISE: options.noise = std::stod(optarg); break;
+            case SEED: options.seed = std::stoull(optarg); break;
+            case 'o': options.output = optarg; break;
+            case SHARD: {
+                std::string spec = optarg;
+                std::size_t slash = spec.find('/');
+                if(slash == std::string::npos) {
+                    throw std::runtime_error("shard must be K/N");
+                }
+                options.shard = std::stoul(spec.substr(0, slash));
+                options.shards = std::stoul(spec.substr(slash + 1));
+                break;
+            }
+            case 'j': options.threads = std::stoul(optarg); break;
+            case 'h': printUsage(std::cout); exit(0);
+            default: printUsage(std::cerr); exit(2);
+        }
+    }
+    if(optind != argc || options.output.empty()) {
+        printUsage(std::cerr);
+        exit(2);
+    }
+
+    if(options.plane == "h" || options.plane == "H") {
+        options.plane = "horizontal";
+    }
+    else if(options.plane == "v" || options.plane == "V") {
+        options.plane = "vertical";
+    }
+    if(options.plane != "horizontal" && options.plane != "vertical") {
+        throw std::runtime_error("plane must be horizontal or vertical");
+    }
+    if(options.shards == 0 || options.shard >= options.shards) {
+        throw std::runtime_error("shard K/N needs K < N");
+    }
+    if(options.slices == 0) {
+        throw std::runtime_error("slices must be positive");
+    }
+    if(options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return options;
+}
+
+// What a worker keeps between points: the last tracked beam, reused while only the
+// analysis settings change, and its estimators
+struct WorkerState {
+    std::vector<double> key;
+    std::vector<double> rows;
+    std::vector<double> amplitude;
+    std::map<std::pair<std::size_t, double>, std::unique_ptr<TuneEstimator>> estimators;
+};
+
+int main(int argc, char** argv) {
+    Options options;
+    Beam beam;
+    Grid grid;
+    std::vector<std::size_t> analysed;
+    try {
+        options = parseOptions(argc, argv);
+
+        // the tracking parameters come first so neighbouring points share the beam
+        grid.add("gain", parseValues(options.gains));
+        grid.add("delay", parseValues(options.delays));
+        grid.add("phase", parseValues(options.phases));
+        grid.add("order", parseValues(options.orders));
+        grid.add("window", parseValues(options.windows));
+
+        std::vector<double> windows = parseValues(options.windows);
+        std::size_t longest = (std::size_t)*std::max_element(windows.begin(), windows.end());
+        if(*std::min_element(windows.begin(), windows.end()) < 4) {
+            throw std::runtime_error("windows must be at least 4 turns");
+        }
+        for(double delay : parseValues(options.delays)) {
+            if(delay < 0 || delay != std::floor(delay)) {
+                throw std::runtime_error("delays must be whole turns");
+            }
+        }
+        options.turns = std::max(options.turns, longest);
+
+        bool horizontal = options.plane == "horizontal";
+        beam.tune = horizontal ? 64.31 : 59.32;
+        beam.beta = horizontal ? 92.7 : 93.2;
+        if(options.filling != "all") {
+            beam.filled = parseIndices(options.filling, beam.slots);
+            if(beam.filled.empty()) {
+                throw std::runtime_error("nothing selected by " + options.filling);
+            }
+        }
+        beam.slices = options.slices;
+        beam.chromaticity = options.chromaticity;
+        beam.tuneSpread = options.tuneSpread;
+        beam.amplitude = options.amplitude;
+        beam.randomPhase = !options.coherent;
+        beam.noise = options.noise;
+        beam.seed = options.seed;
+    }
+    catch(const std::exception& e) {
+        std::cerr << "sweep: " << e.what() << std::endl;
+        return 2;
+    }
+
+    BunchTracker tracker(beam);
+    std::unique_ptr<Checkpoint> checkpoint;
+    std::vector<std::size_t> todo;
+    try {
+        analysed = parseIndices(options.bunches, tracker.getBunches());
+        if(analysed.empty()) {
+            throw std::runtime_error("nothing selected by " + options.bunches);
+        }
+        // everything that changes the results, so a resume can not mix sweeps
+        std::ostringstream signature;
+        signature.precision(17);
+        signature << grid.describe() << "estimator=" << options.estimator << ";tolerance=" << options.tolerance
+            << ";plane=" << options.plane << ";turns=" << options.turns << ";filling=" << options.filling
+            << ";bunches=" << options.bunches << ";slices=" << options.slices << ";chroma=" << options.chromaticity
+            << ";spread=" << options.tuneSpread << ";amplitude=" << options.amplitude << ";coherent=" << options.coherent
+            << ";noise=" << options.noise << ";seed=" << options.seed << ";shard=" << options.shard << "/" << options.shards;
+        std::string columns;
+        for(const std::string& name : grid.getNames()) {
+            columns += name + "\t";
+        }
+        columns += "growth/turn\tdamping turns\ttune\ttune rms\tsignificance";
+        checkpoint.reset(new Checkpoint(options.output, signature.str(), columns));
+
+        for(std::size_t i : checkpoint->pending(grid.size())) {
+            if(i % options.shards == options.shard) {
+                todo.push_back(i);
+            }
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "sweep: " << e.what() << std::endl;
+        return 2;
+    }
+    fprintf(stderr, "sweep: %zu points, %zu done before, %zu to run on %u threads\n",
+        grid.size(), checkpoint->getDone(), todo.size(), options.threads);
+
+    double floor = 3 * std::max(beam.noise, Damper::Quantizer(16, -1e-3, 1e-3).getStep());
+    floor = std::max(floor, beam.amplitude * std::exp(-3.0));
+
+    // FFTW planning is not thread safe
+    std::mutex planMutex;
+    std::vector<WorkerState> states(options.threads);
+    std::atomic<std::size_t> completed { 0 };
+    std::atomic<std::size_t> failed { 0 };
+    std::mutex progressMutex;
+    auto start = std::chrono::steady_clock::now();
+    auto lastReport = start;
+
+    StealingPool pool(options.threads);
+    pool.run(todo, [&](std::size_t index, unsigned w) {
+        WorkerState& state = states[w];
+        std::vector<double> values = grid.point(index);
+        double gain = values[0], delay = values[1], phase = values[2], order = values[3];
+        std::size_t window = (std::size_t)values[4];
+        char line[512];
+        try {
+            std::vector<double> key = { gain, delay, phase };
+            if(key != state.key) {
+                ScanPoint point;
+                point.gain = gain;
+                point.damper.delay = (int)delay;
+                point.damper.additionalPhase = phase;
+                state.rows.resize(options.turns * tracker.getBunches());
+                state.amplitude.resize(options.turns);
+                tracker.track(point, options.turns, state.rows.data(), state.amplitude.data(), 1);
+                state.key = key;
+            }
+
+            std::unique_ptr<TuneEstimator>& estimator = state.estimators[{ window, order }];
+            if(!estimator) {
+                std::lock_guard<std::mutex> lock(planMutex);
+                estimator = makeEstimator(options.estimator, window, order, options.tolerance);
+            }
+            std::vector<double> column(window);
+            double sum = 0, squares = 0, significance = 0;
+            std::size_t bunches = tracker.getBunches();
+            for(std::size_t b : analysed) {
+                for(std::size_t t = 0; t < window; t++) {
+                    column[t] = state.rows[t * bunches + b];
+                }
+                TuneResult result = estimator->estimate(column.data(), window);
+                sum += result.tune;
+                squares += result.tune * result.tune;
+                significance += result.significance;
+            }
+            double n = analysed.size();
+            double mean = sum / n;
+            double rate = growthRate(state.amplitude.data(), state.amplitude.size(), floor);
+            snprintf(line, sizeof(line), "%.9g\t%.9g\t%.9g\t%.9g\t%zu\t%.6g\t%.6g\t%.12f\t%.6g\t%.6g",
+                gain, delay, phase, order, window, rate, rate < 0 ? -1.0 / rate : INFINITY,
+                mean, std::sqrt(std::max(squares / n - mean * mean, 0.0)), significance / n);
+            checkpoint->record(index, line);
+        }
+        catch(const std::exception& e) {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            std::cerr << "sweep: point " << index << ": " << e.what() << std::endl;
+            failed++;
+            return;
+        }
+
+        std::size_t done = ++completed;
+        std::lock_guard<std::mutex> lock(progressMutex);
+        auto now = std::chrono::steady_clock::now();
+        if(now - lastReport > std::chrono::seconds(10)) {
+            double seconds = std::chrono::duration<double>(now - start).count();
+            fprintf(stderr, "sweep: %zu/%zu points, %.2f points/s, %.0f s left\n", done, todo.size(),
+                done / seconds, (todo.size() - done) * seconds / done);
+            lastReport = now;
+        }
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double seconds = std::max(elapsed.count(), 1e-9);
+    fprintf(stderr, "sweep: %zu points (%zu failed) in %.3f s: %.2f points/s, %u threads\n",
+        completed.load(), failed.load(), seconds, completed / seconds, options.threads);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+// Damper gain and phase scans on the reduced bunch-by-bunch model of Tracker.hpp.
+//
+//   track [options]
+//
+// Every combination of --gain and --phase is one scan point, tracked over --turns
+// turns for all bunches of --filling with the ADT filter bank in the loop. One line
+// per point with the fitted growth rate of the centroid amplitude is printed, and
+// with --output the pickup signal of every point is written as an ADTObsBox file
+// that the tune tools read like measured data:
+//
+//   track -g 0:0.2:11 -o scan_%02zu.h5 && tune scan_*.h5
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+#include <cmath>
+#include <getopt.h>
+
+#include "HDFLib.h"
+#include "Tracker.hpp"
+#include "CliParse.hpp"
+
+struct Options {
+    std::string plane = "horizontal";
+    double tune = 0.0;
+    std::size_t turns = 512;
+    std::string filling = "all";
+    std::size_t slices = 1;
+    double chromaticity = 0.0;
+    double momentumSpread = 1.1e-4;
+    double tuneSpread = 0.0;
+    double amplitude = 1e-4;
+    bool coherent = false;
+    double noise = 0.0;
+    uint64_t seed = 1;
+    std::string gains = "0.1";
+    std::string phases = "0.25";
+    int delay = 1;
+    std::string output;
+    double resolution = 0.0;
+    unsigned threads = 0;
+};
+
+void printUsage(std::ostream& out) {
+    out << "usage: track [options]\n"
+        << "  -p, --plane P         horizontal or vertical, sets tune and beta (default horizontal)\n"
+        << "  -q, --tune Q          betatron tune instead of the one of the plane\n"
+        << "  -t, --turns N         turns per scan point (default 512)\n"
+        << "  -b, --filling LIST    filled slots, e.g. 0-47,100-147 (default all 3564)\n"
+        << "      --slices N        rigid slices per bunch (default 1)\n"
+        << "      --chroma X        chromaticity Q' (default 0)\n"
+        << "      --dpp X           rms momentum spread (default 1.1e-4)\n"
+        << "      --spread X        further rms incoherent tune spread (default 0)\n"
+        << "  -a, --amplitude M     initial centroid offset in metres (default 1e-4)\n"
+        << "      --coherent        all bunches start in phase instead of random phases\n"
+        << "      --noise M         rms pickup noise in metres (default 0)\n"
+        << "      --seed N          seed of the phases and noise (default 1)\n"
+        << "  -g, --gain LIST       damper gains, values and start:stop:count ranges (default 0.1)\n"
+        << "      --phase LIST      additional phase advances of the turn filter (default 0.25)\n"
+        << "      --delay N         processing delay in turns (default 1)\n"
+        << "  -o, --output PATTERN  ADTObsBox file per scan point, one integer conversion\n"
+        << "                        such as %02zu for the point, %% for a percent sign\n"
+        << "      --resolution M    metres per ObsBox count (default: one ADC level)\n"
+        << "  -j, --threads N       threads (default: all cores)\n"
+        << "  -h, --help            show this help\n";
+}
+
+Options parseOptions(int argc, char** argv) {
+    enum { SLICES = 1000, CHROMA, DPP, SPREAD, COHERENT, NOISE, SEED, PHASE, DELAY, RESOLUTION };
+    static const option longOptions[] = {
+        { "plane", required_argument, nullptr, 'p' },
+        { "tune", required_argument, nullptr, 'q' },
+        { "turns", required_argument, nullptr, 't' },
+        { "filling", required_argument, nullptr, 'b' },
+        { "slices", required_argument, nullptr, SLICES },
+        { "chroma", required_argument, nullptr, CHROMA },
+        { "dpp", required_argument, nullptr, DPP },
+        { "spread", required_argument, nullptr, SPREAD },
+        { "amplitude", required_argument, nullptr, 'a' },
+        { "coherent", no_argument, nullptr, COHERENT },
+        { "noise", required_argument, nullptr, NOISE },
+        { "seed", required_argument, nullptr, SEED },
+        { "gain", required_argument, nullptr, 'g' },
+        { "phase", required_argument, nullptr, PHASE },
+        { "delay", required_argument, nullptr, DELAY },
+        { "output", required_argument, nullptr, 'o' },
+        { "resolution", required_argument, nullptr, RESOLUTION },
+        { "threads", required_argument, nullptr, 'j' },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    Options options;
+    int c;
+    while((c = getopt_long(argc, argv, "p:q:t:b:a:g:o:j:h", longOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'p': options.plane = optarg; break;
+            case 'q': options.tune = std::stod(optarg); break;
+            case 't': options.turns = std::stoul(optarg); break;
+            case 'b': options.filling = optarg; break;
+            case SLICES: options.slices = std::stoul(optarg); break;
+            case CHROMA: options.chromaticity = std::stod(optarg); break;
+            case DPP: options.momentumSpread = std::stod(optarg); break;
+            case SPREAD: options.tuneSpread = std::stod(optarg); break;
+            case 'a': options.amplitude = std::stod(optarg); break;
+            case COHERENT: options.coherent = true; break;
+            case NOISE: options.noise = std::stod(optarg); break;
+            case SEED: options.seed = std::stoull(optarg); break;
+            case 'g': options.gains = optarg; break;
+            case PHASE: options.phases = optarg; break;
+            case DELAY: options.delay = std::stoi(optarg); break;
+            case 'o': options.output = optarg; break;
+            case RESOLUTION: options.resolution = std::stod(optarg); break;
+            case 'j': options.threads = std::stoul(optarg); break;
+            case 'h': printUsage(std::cout); exit(0);
+            default: printUsage(std::cerr); exit(2);
+        }
+    }
+    if(optind != argc) {
+        printUsage(std::cerr);
+        exit(2);
+    }
+
+    if(options.plane == "h" || options.plane == "H") {
+        options.plane = "horizontal";
+    }
+    else if(options.plane == "v" || options.plane == "V") {
+        options.plane = "vertical";
+    }
+    if(options.plane != "horizontal" && options.plane != "vertical") {
+        throw std::runtime_error("plane must be horizontal or vertical");
+    }
+    if(options.turns == 0 || options.slices == 0) {
+        throw std::runtime_error("turns and slices must be positive");
+    }
+    if(options.delay < 0) {
+        throw std::runtime_error("delay can not be negative");
+    }
+    if(!options.output.empty()) {
+        outputName(options.output, 0);
+    }
+    if(options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return options;
+}
+
+void writeObsBox(const std::string& filename, const std::string& plane, const std::vector<double>& rows,
+        std::size_t turns, std::size_t bunches, double resolution) {
+    std::vector<int16_t> data(rows.size());
+    for(std::size_t i = 0; i < rows.size(); i++) {
+        double counts = std::round(rows[i] / resolution);
+        data[i] = (int16_t)std::min(std::max(counts, -32768.0), 32767.0);
+    }
+    // HDFFile only creates files that do not exist yet
+    std::filesystem::remove(filename);
+    HDFLib::HDFFile file(filename);
+    file.setPlane(plane);
+    file.setTurns(turns);
+    file.setBunches(bunches);
+    file.setAttributesEnabled(false);
+    file.open(HDFLib::CREATE);
+    file.setData(data.data());
+    file.close();
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    Beam beam;
+    std::vector<ScanPoint> points;
+    try {
+        options = parseOptions(argc, argv);
+
+        // beta functions and collision tunes of LHC.py
+        bool horizontal = options.plane == "horizontal";
+        beam.tune = options.tune != 0.0 ? options.tune : (horizontal ? 64.31 : 59.32);
+        beam.beta = horizontal ? 92.7 : 93.2;
+        if(options.filling != "all") {
+            beam.filled = parseIndices(options.filling, beam.slots);
+            if(beam.filled.empty()) {
+                throw std::runtime_error("no filled slot in " + options.filling);
+            }
+        }
+        beam.slices = options.slices;
+        beam.chromaticity = options.chromaticity;
+        beam.momentumSpread = options.momentumSpread;
+        beam.tuneSpread = options.tuneSpread;
+        beam.amplitude = options.amplitude;
+        beam.randomPhase = !options.coherent;
+        beam.noise = options.noise;
+        beam.seed = options.seed;
+
+        for(double phase : parseValues(options.phases)) {
+            for(double gain : parseValues(options.gains)) {
+                ScanPoint point;
+                point.gain = gain;
+                point.damper.delay = options.delay;
+                point.damper.additionalPhase = phase;
+                points.push_back(point);
+            }
+        }
+        if(points.empty()) {
+            throw std::runtime_error("no scan points");
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "track: " << e.what() << std::endl;
+        return 2;
+    }
+
+    BunchTracker tracker(beam);
+    double resolution = options.resolution > 0 ? options.resolution :
+        Damper::Quantizer(points[0].damper.adcBits, points[0].damper.adcLow, points[0].damper.adcHigh).getStep();
+    // the fit covers three damping times at most and stops at the noise or the ADC
+    // resolution, below the damper only keeps the residual oscillation
+    double floor = std::max(3 * std::max(beam.noise, resolution), beam.amplitude * std::exp(-3.0));
+
+    printf("# point\tgain\tphase\tgrowth/turn\tdamping turns\tfinal amplitude\n");
+    std::size_t failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    scan(tracker, points, options.turns, options.threads,
+        [&](std::size_t i, const std::vector<double>& rows, const std::vector<double>& amplitude) {
+            double rate = growthRate(amplitude.data(), amplitude.size(), floor);
+            printf("%zu\t%.6g\t%.6g\t%.6g\t%.6g\t%.6g\n", i, points[i].gain, points[i].damper.additionalPhase,
+                rate, rate < 0 ? -1.0 / rate : INFINITY, amplitude.back());
+            fflush(stdout);
+            if(options.output.empty()) {
+                return;
+            }
+            std::string filename = outputName(options.output, i);
+            try {
+                writeObsBox(filename, options.plane, rows, options.turns, tracker.getBunches(), resolution);
+            }
+            catch(const std::exception& e) {
+                std::cerr << "track: " << filename << ": " << e.what() << std::endl;
+                failed++;
+            }
+        });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double seconds = std::max(elapsed.count(), 1e-9);
+    fprintf(stderr, "track: %zu points x %zu bunches x %zu turns in %.3f s: %.3g bunch turns/s, %u threads\n",
+        points.size(), tracker.getBunches(), options.turns, seconds,
+        points.size() * tracker.getBunches() * options.turns / seconds, options.threads);
+    return failed > 0 ? 1 : 0;
+}
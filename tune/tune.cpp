@@ -0,0 +1,835 @@
+// Headless tune extraction over ADTObsBox files.
+//
+//   tune [options] <file|directory>...
+//
+// Every selected bunch of every file is cut into windows of --window turns spaced
+// by --hop turns, each window goes through the chosen estimator and one line per
+// window is streamed to the output, either as text or into a binary results store
+// (ResultsStore.hpp). A throughput summary is printed to stderr on exit.
+//
+// With --cache results are kept per file and bunch in a ResultCache, files whose
+// results are all cached for the same settings are never opened. With --sidecar the
+// bunches are taken from bunch major copies of the files (HDFCache.h), which are
+// built on the first run and rebuilt when a file changes. With --readers N the files
+// are decoded by N forked reader processes (HDFReaderPool.h), each with its own copy
+// of the HDF5 library.
+//
+// On machines with several NUMA nodes the bunches of a file are read in one tile per
+// node, placed in that node's memory, and the analysis threads are pinned to the
+// nodes and work on their own tile first (--no-numa turns this off).
+//
+// Built with -DUSE_MPI and started with mpirun on several ranks, rank 0 hands out
+// the files, or with --split N bunch ranges of each file, largest files first, to
+// the other ranks whenever they ask for work. The results are gathered to rank 0 at
+// the end and written in the same order as by a single process:
+//
+//   mpirun -np 5 tune -j 4 -f store -o fill.tres /data/fill_7355
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+#include <getopt.h>
+
+#include "HDFLib.h"
+#include "HDFCache.h"
+#include "HDFReaderPool.h"
+#include "algos/TuneEstimator.hpp"
+#include "ResultsStore.hpp"
+#include "ResultCache.hpp"
+#include "Numa.hpp"
+#include "Arena.hpp"
+#include "CliParse.hpp"
+#ifdef USE_MPI
+#include "Distributed.hpp"
+#endif
+
+struct Options {
+    std::size_t window = 2048;
+    std::size_t hop = 0;
+    std::string plane = "both";
+    std::string bunches = "all";
+    std::string estimator = "naff";
+    double order = 2.0;
+    double tolerance = 1.490116e-8;
+    std::string output = "-";
+    std::string format = "text";
+    unsigned threads = 0;
+    std::string cache;
+    std::size_t cacheSize = 1024;
+    std::string cacheKey = "stat";
+    std::string sidecar;
+    unsigned readers = 0;
+    std::size_t split = 1;
+    bool numa = true;
+    std::string hugePages = "auto";
+    std::vector<std::string> inputs;
+};
+
+void printUsage(std::ostream& out) {
+    out << "usage: tune [options] <file|directory>...\n"
+        << "  -w, --window N        turns per window (default 2048)\n"
+        << "  -s, --hop N           turns between window starts (default: window)\n"
+        << "  -p, --plane P         horizontal, vertical or both (default both)\n"
+        << "  -b, --bunches LIST    bunch indices and ranges, e.g. 0-9,42 (default all)\n"
+        << "  -e, --estimator E     naff, naff-classic, nafflib, fft, interpolated or hilbert\n"
+        << "                        (default naff)\n"
+        << "      --order X         order of the Hann harmonic window (default 2)\n"
+        << "      --tolerance X     tune tolerance of the naff and naff-classic estimators\n"
+        << "  -o, --output FILE     write results to FILE instead of stdout\n"
+        << "  -f, --format F        text or store, the binary results store needs --output\n"
+        << "  -j, --threads N       analysis threads (default: all cores)\n"
+        << "  -c, --cache DIR       reuse results cached in DIR and add new ones\n"
+        << "      --cache-size MB   bound of the cache on disk (default 1024)\n"
+        << "      --cache-key K     identify inputs by stat (path, size, mtime) or content\n"
+        << "      --sidecar DIR     read bunches from bunch major copies of the files kept in DIR,\n"
+        << "                        built on first use and whenever a file changes\n"
+        << "      --readers N       decode the files in N reader processes (default: in threads)\n"
+        << "      --huge-pages M    auto, transparent or off for the per file buffers (default auto)\n"
+        << "      --no-numa         no NUMA placement of the data and pinning of threads\n"
+#ifdef USE_MPI
+        << "      --split N         with MPI, hand out every file as N bunch ranges (default 1)\n"
+#endif
+        << "  -h, --help            show this help\n";
+}
+
+Options parseOptions(int argc, char** argv) {
+    enum { ORDER = 1000, TOLERANCE, CACHE_SIZE, CACHE_KEY, SIDECAR, READERS, SPLIT, NO_NUMA, HUGE_PAGES };
+    static const option longOptions[] = {
+        { "window", required_argument, nullptr, 'w' },
+        { "hop", required_argument, nullptr, 's' },
+        { "plane", required_argument, nullptr, 'p' },
+        { "bunches", required_argument, nullptr, 'b' },
+        { "estimator", required_argument, nullptr, 'e' },
+        { "order", required_argument, nullptr, ORDER },
+        { "tolerance", required_argument, nullptr, TOLERANCE },
+        { "output", required_argument, nullptr, 'o' },
+        { "format", required_argument, nullptr, 'f' },
+        { "threads", required_argument, nullptr, 'j' },
+        { "cache", required_argument, nullptr, 'c' },
+        { "cache-size", required_argument, nullptr, CACHE_SIZE },
+        { "cache-key", required_argument, nullptr, CACHE_KEY },
+        { "sidecar", required_argument, nullptr, SIDECAR },
+        { "readers", required_argument, nullptr, READERS },
+        { "split", required_argument, nullptr, SPLIT },
+        { "no-numa", no_argument, nullptr, NO_NUMA },
+        { "huge-pages", required_argument, nullptr, HUGE_PAGES },
+        { "help", no_argument, nullptr, 'h' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    Options options;
+    int c;
+    while((c = getopt_long(argc, argv, "w:s:p:b:e:o:f:j:c:h", longOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'w': options.window = std::stoul(optarg); break;
+            case 's': options.hop = std::stoul(optarg); break;
+            case 'p': options.plane = optarg; break;
+            case 'b': options.bunches = optarg; break;
+            case 'e': options.estimator = optarg; break;
+            case ORDER: options.order = std::stod(optarg); break;
+            case TOLERANCE: options.tolerance = std::stod(optarg); break;
+            case 'o': options.output = optarg; break;
+            case 'f': options.format = optarg; break;
+            case 'j': options.threads = std::stoul(optarg); break;
+            case 'c': options.cache = optarg; break;
+            case CACHE_SIZE: options.cacheSize = std::stoul(optarg); break;
+            case CACHE_KEY: options.cacheKey = optarg; break;
+            case SIDECAR: options.sidecar = optarg; break;
+            case READERS: options.readers = std::stoul(optarg); break;
+            case SPLIT: options.split = std::stoul(optarg); break;
+            case NO_NUMA: options.numa = false; break;
+            case HUGE_PAGES: options.hugePages = optarg; break;
+            case 'h': printUsage(std::cout); exit(0);
+            default: printUsage(std::cerr); exit(2);
+        }
+    }
+    for(int i = optind; i < argc; i++) {
+        options.inputs.push_back(argv[i]);
+    }
+
+    if(options.plane == "h" || options.plane == "H") {
+        options.plane = "horizontal";
+    }
+    else if(options.plane == "v" || options.plane == "V") {
+        options.plane = "vertical";
+    }
+    if(options.plane != "horizontal" && options.plane != "vertical" && options.plane != "both") {
+        throw std::runtime_error("plane must be horizontal, vertical or both");
+    }
+    if(options.format != "text" && options.format != "store") {
+        throw std::runtime_error("format must be text or store");
+    }
+    if(options.format == "store" && options.output == "-") {
+        throw std::runtime_error("the results store needs an --output file");
+    }
+    if(options.cacheKey != "stat" && options.cacheKey != "content") {
+        throw std::runtime_error("cache key must be stat or content");
+    }
+    if(options.readers > 0 && !options.sidecar.empty()) {
+        throw std::runtime_error("sidecars are built without reader processes");
+    }
+    if(options.window < 4) {
+        throw std::runtime_error("window must be at least 4 turns");
+    }
+    Arena::parseMode(options.hugePages);
+    if(options.split == 0) {
+        throw std::runtime_error("split must be positive");
+    }
+    if(options.hop == 0) {
+        options.hop = options.window;
+    }
+    if(options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if(options.inputs.empty()) {
+        printUsage(std::cerr);
+        exit(2);
+    }
+    return options;
+}
+
+// Files are taken as given, directories are searched recursively for .h5 files
+std::vector<std::string> collectFiles(const std::vector<std::string>& inputs) {
+    std::vector<std::string> files;
+    for(const std::string& input : inputs) {
+        if(std::filesystem::is_directory(input)) {
+            std::vector<std::string> found;
+            for(const auto& entry : std::filesystem::recursive_directory_iterator(input)) {
+                if(entry.is_regular_file() && entry.path().extension() == ".h5") {
+                    found.push_back(entry.path().string());
+                }
+            }
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        else {
+            files.push_back(input);
+        }
+    }
+    return files;
+}
+
+struct Totals {
+    std::size_t files = 0;
+    std::size_t failed = 0;
+    std::size_t skipped = 0;
+    std::size_t bunches = 0;
+    std::size_t windows = 0;
+    std::size_t cached = 0;
+    std::size_t bytes = 0;
+    // bunch data gathered by workers on the node of the tile and on other nodes
+    std::size_t localBytes = 0;
+    std::size_t remoteBytes = 0;
+};
+
+// Columns of a block of bunch data placed on node. Column i starts at data + columns[i]
+// and its turns are stride apart, the width of a turn major block or 1 for a bunch
+// major one. The windows of column i go to targets[i]
+struct Tile {
+    const int16_t* data = nullptr;
+    std::size_t stride = 0;
+    std::size_t node = 0;
+    std::vector<std::size_t> columns;
+    std::vector<TuneResult*> targets;
+    std::atomic<std::size_t> next { 0 };
+};
+
+// Estimates every window of the columns of the tiles, with one worker per estimator.
+// With a topology every worker is pinned to its node and takes the columns of tiles
+// on that node first before it helps with the others.
+void analyseTiles(std::vector<Tile>& tiles, std::size_t turns, std::size_t windows, const Options& options,
+        std::vector<std::unique_ptr<TuneEstimator>>& estimators, const Numa::Topology* topology, Totals& totals) {
+    unsigned workers = estimators.size();
+    std::vector<std::size_t> local(workers, 0), remote(workers, 0);
+    auto worker = [&](unsigned w) {
+        std::size_t node = topology != nullptr ? topology->nodeOf(w, workers) : 0;
+        if(topology != nullptr) {
+            topology->pin(node);
+        }
+        std::vector<Tile*> order;
+        for(Tile& tile : tiles) {
+            if(tile.node == node) {
+                order.push_back(&tile);
+            }
+        }
+        for(Tile& tile : tiles) {
+            if(tile.node != node) {
+                order.push_back(&tile);
+            }
+        }
+
+        std::vector<double> column(turns);
+        for(Tile* tile : order) {
+            for(std::size_t i = tile->next++; i < tile->columns.size(); i = tile->next++) {
+                // gather the bunch once, in a turn major block it is spread over the rows
+                const int16_t* in = tile->data + tile->columns[i];
+                for(std::size_t turn = 0; turn < turns; turn++) {
+                    column[turn] = in[turn * tile->stride];
+                }
+                (tile->node == node ? local : remote)[w] += turns * sizeof(int16_t);
+                for(std::size_t k = 0; k < windows; k++) {
+                    tile->targets[i][k] = estimators[w]->estimate(column.data() + k * options.hop, options.window);
+                }
+            }
+        }
+    };
+    // a pinned main thread would pass its node on to every thread it starts later
+    std::vector<std::thread> threads;
+    for(unsigned w = topology != nullptr ? 0 : 1; w < workers; w++) {
+        threads.emplace_back(worker, w);
+    }
+    if(topology == nullptr) {
+        worker(0);
+    }
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+    for(unsigned w = 0; w < workers; w++) {
+        totals.localBytes += local[w];
+        totals.remoteBytes += remote[w];
+    }
+}
+
+// Estimates every window of the given columns of a turn major block that is width
+// columns wide into rows of windows results, the columns are shared out between the
+// threads of the estimators
+void analyseColumns(const int16_t* data, std::size_t turns, std::size_t width, const std::vector<std::size_t>& columns,
+        std::size_t windows, const Options& options, std::vector<std::unique_ptr<TuneEstimator>>& estimators,
+        TuneResult* results) {
+    std::vector<Tile> tiles(1);
+    tiles[0].data = data;
+    tiles[0].stride = width;
+    tiles[0].columns = columns;
+    for(std::size_t i = 0; i < columns.size(); i++) {
+        tiles[0].targets.push_back(results + i * windows);
+    }
+    Totals totals;
+    analyseTiles(tiles, turns, windows, options, estimators, nullptr, totals);
+}
+
+void writeLine(FILE* out, const std::string& filename, std::size_t bunch, std::size_t start, const TuneResult& r) {
+    char line[512];
+    int length = snprintf(line, sizeof(line), "%s\t%zu\t%zu\t%.12f\t%.6g\t%.6f\t%.6g\n",
+        filename.c_str(), bunch, start, r.tune, r.amplitude, r.phase, r.significance);
+    fwrite(line, 1, std::min<std::size_t>(length, sizeof(line) - 1), out);
+}
+
+// Analyses the selected bunches of one file, bunches are shared out between the
+// threads and the results are written in bunch order once all are done. Bunches
+// found in the cache are not analysed again, and when all are found the file is
+// not even opened.
+void analyseFile(const std::string& filename, const Options& options, const std::string& settings,
+        std::vector<std::unique_ptr<TuneEstimator>>& estimators, const Numa::Topology* topology,
+        std::vector<std::unique_ptr<Arena>>& arenas, HDFLib::HDFReaderPool* pool, FILE* out,
+        ResultsStore::Writer* store, ResultCache* cache, Totals& totals) {
+    for(std::unique_ptr<Arena>& arena : arenas) {
+        arena->reset();
+    }
+    ResultCache::Key key;
+    ResultCache::FileInfo info;
+    bool known = false;
+    if(cache != nullptr) {
+        key = cache->fileKey(filename, settings);
+        known = cache->getInfo(key, info);
+    }
+
+    std::size_t turns = 0, bunches = 0, windows = 0;
+    std::vector<std::size_t> selection;
+    // windows results per selected bunch
+    TuneResult* results = nullptr;
+    // indices into selection that still have to be analysed
+    std::vector<std::size_t> missing;
+    auto select = [&]() {
+        selection = parseIndices(options.bunches, bunches);
+        windows = turns >= options.window ? (turns - options.window) / options.hop + 1 : 0;
+        results = arenas[0]->allocate<TuneResult>(selection.size() * windows);
+        std::uninitialized_fill_n(results, selection.size() * windows, TuneResult());
+    };
+
+    if(known) {
+        if(options.plane != "both" && options.plane != info.plane) {
+            totals.skipped++;
+            return;
+        }
+        turns = info.turns;
+        bunches = info.bunches;
+        select();
+        std::vector<TuneResult> cached;
+        for(std::size_t i = 0; i < selection.size(); i++) {
+            if(!cache->getResults(key, selection[i], cached) || cached.size() != windows) {
+                missing.push_back(i);
+            }
+            else {
+                std::copy(cached.begin(), cached.end(), results + i * windows);
+            }
+        }
+    }
+
+    if(!known || !missing.empty()) {
+        // the sidecar is mapped for as long as its tile is analysed, the file is only
+        // opened here without a sidecar or reader processes
+        HDFLib::HDFFile file(filename);
+        std::unique_ptr<HDFLib::BunchCache<int16_t>> sidecar;
+        HDFLib::HDFReaderPool::Info shape;
+        if(!options.sidecar.empty()) {
+            sidecar.reset(new HDFLib::BunchCache<int16_t>(filename, options.sidecar));
+            sidecar->openOrBuild();
+            shape = { sidecar->getTurns(), sidecar->getBunches(), sidecar->getPlane(), sidecar->getBeam() };
+        }
+        else if(pool != nullptr) {
+            shape = pool->readInfo(filename);
+        }
+        else {
+            file.open();
+            shape = { file.getRows(), file.getColumns(), file.getPlane(), file.getBeam() };
+        }
+        if(!known) {
+            std::string plane = shape.plane;
+            turns = shape.turns;
+            bunches = shape.bunches;
+            if(cache != nullptr) {
+                strncpy(info.plane, plane.c_str(), sizeof(info.plane) - 1);
+                info.turns = turns;
+                info.bunches = bunches;
+                cache->putInfo(key, info);
+            }
+            if(options.plane != "both" && plane != options.plane) {
+                totals.skipped++;
+                return;
+            }
+            select();
+            for(std::size_t i = 0; i < selection.size(); i++) {
+                missing.push_back(i);
+            }
+        }
+        std::vector<std::size_t> columns;
+        for(std::size_t i : missing) {
+            columns.push_back(selection[i]);
+        }
+        std::size_t nodes = topology != nullptr ? topology->getNodes() : 1;
+        // the bunches of a sidecar are contiguous already and are used in place, in one
+        // tile. Otherwise every node reads a share of the columns in proportion to its
+        // workers into the arena of its own memory, without NUMA one tile holds them all.
+        // A tile spans its first to its last column only
+        std::vector<Tile> tiles(sidecar ? 1 : nodes);
+        if(sidecar) {
+            tiles[0].data = sidecar->getBunch(0);
+            tiles[0].stride = 1;
+            for(std::size_t i = 0; i < columns.size(); i++) {
+                tiles[0].columns.push_back(columns[i] * turns);
+                tiles[0].targets.push_back(results + missing[i] * windows);
+            }
+            totals.bytes += turns * columns.size() * sizeof(int16_t);
+        }
+        unsigned workers = estimators.size();
+        std::size_t first = 0, before = 0;
+        for(std::size_t node = 0; !sidecar && node < nodes; node++) {
+            for(unsigned w = 0; w < workers; w++) {
+                before += topology == nullptr || topology->nodeOf(w, workers) == node;
+            }
+            std::size_t last = columns.size() * before / workers;
+            tiles[node].node = node;
+            if(last == first) {
+                continue;
+            }
+            std::size_t low = columns[first];
+            std::size_t width = columns[last - 1] + 1 - low;
+            int16_t* data = arenas[node]->allocate<int16_t>(turns * width);
+            if(pool != nullptr) {
+                pool->readBlock(filename, 0, turns, low, width, data);
+            }
+            else {
+                file.readBlockParallel(0, turns, low, width, data, options.threads);
+            }
+            totals.bytes += turns * width * sizeof(int16_t);
+            // where the kernel actually put the block, if it can be told
+            int placement = Numa::placement(data);
+            if(topology != nullptr && placement >= 0 && topology->find(placement) < nodes) {
+                tiles[node].node = topology->find(placement);
+            }
+            tiles[node].data = data;
+            tiles[node].stride = width;
+            for(std::size_t i = first; i < last; i++) {
+                tiles[node].columns.push_back(columns[i] - low);
+                tiles[node].targets.push_back(results + missing[i] * windows);
+            }
+            first = last;
+        }
+        file.close();
+
+        analyseTiles(tiles, turns, windows, options, estimators, topology, totals);
+
+        if(cache != nullptr) {
+            for(std::size_t i : missing) {
+                cache->putResults(key, selection[i], results + i * windows, windows);
+            }
+        }
+    }
+
+    if(store != nullptr) {
+        uint32_t id = store->addFile(filename);
+        for(std::size_t i = 0; i < selection.size(); i++) {
+            for(std::size_t w = 0; w < windows; w++) {
+                store->append(id, selection[i], w * options.hop, results[i * windows + w]);
+            }
+        }
+    }
+
+    for(std::size_t i = 0; out != nullptr && i < selection.size(); i++) {
+        for(std::size_t w = 0; w < windows; w++) {
+            writeLine(out, filename, selection[i], w * options.hop, results[i * windows + w]);
+        }
+    }
+
+    totals.files++;
+    totals.bunches += selection.size();
+    totals.windows += selection.size() * windows;
+    totals.cached += (selection.size() - missing.size()) * windows;
+}
+
+// Opens the text output with its header line or the results store
+void openOutput(const Options& options, FILE*& out, std::unique_ptr<ResultsStore::Writer>& store) {
+    if(options.format == "store") {
+        store.reset(new ResultsStore::Writer(options.output));
+    }
+    else if(options.output == "-") {
+        out = stdout;
+    }
+    else if((out = fopen(options.output.c_str(), "w")) == nullptr) {
+        throw std::runtime_error("can not open " + options.output + " for writing");
+    }
+    if(out != nullptr) {
+        fprintf(out, "# file\tbunch\tstart\ttune\tamplitude\tphase\tsignificance\n");
+    }
+}
+
+#ifdef USE_MPI
+// One window of one bunch as the workers send it to the master
+struct Row {
+    uint32_t file;
+    uint32_t bunch;
+    uint64_t start;
+    TuneResult result;
+};
+
+// Outcome of a file, the parts of a file are combined with the maximum
+enum FileStatus : uint8_t { UNSEEN = 0, SKIPPED, ANALYSED, FAILED };
+
+// Analyses part of options.split equal parts of the selected bunches of a file and
+// only reads the columns that part needs
+FileStatus analysePart(const std::string& filename, uint32_t id, std::size_t part, const Options& options,
+        std::vector<std::unique_ptr<TuneEstimator>>& estimators, Arena& arena, std::vector<Row>& rows, Totals& totals) {
+    arena.reset();
+    HDFLib::HDFFile file(filename);
+    file.open();
+    if(options.plane != "both" && file.getPlane() != options.plane) {
+        return SKIPPED;
+    }
+    std::size_t turns = file.getRows();
+    std::size_t bunches = file.getColumns();
+    std::vector<std::size_t> selection = parseIndices(options.bunches, bunches);
+    std::size_t windows = turns >= options.window ? (turns - options.window) / options.hop + 1 : 0;
+    std::size_t first = selection.size() * part / options.split;
+    std::size_t last = selection.size() * (part + 1) / options.split;
+    if(first == last) {
+        return ANALYSED;
+    }
+
+    std::size_t low = selection[first];
+    std::size_t width = selection[last - 1] + 1 - low;
+    int16_t* data = arena.allocate<int16_t>(turns * width);
+    file.readBlockParallel(0, turns, low, width, data, options.threads);
+    file.close();
+
+    std::vector<std::size_t> columns;
+    for(std::size_t i = first; i < last; i++) {
+        columns.push_back(selection[i] - low);
+    }
+    TuneResult* results = arena.allocate<TuneResult>(columns.size() * windows);
+    analyseColumns(data, turns, width, columns, windows, options, estimators, results);
+    for(std::size_t i = 0; i < columns.size(); i++) {
+        for(std::size_t w = 0; w < windows; w++) {
+            rows.push_back({ id, (uint32_t)selection[first + i], w * options.hop, results[i * windows + w] });
+        }
+    }
+    totals.bytes += turns * width * sizeof(int16_t);
+    return ANALYSED;
+}
+
+// Master and worker ranks of an MPI run, every rank takes the same options
+int runDistributed(const Options& options, const Distributed::Session& session) {
+    std::vector<std::string> files = collectFiles(options.inputs);
+    FILE* out = nullptr;
+    std::unique_ptr<ResultsStore::Writer> store;
+    std::vector<std::unique_ptr<TuneEstimator>> estimators;
+    bool ok = true;
+    try {
+        if(!options.cache.empty()) {
+            throw std::runtime_error("the cache can not be shared between MPI ranks");
+        }
+        if(!options.sidecar.empty() || options.readers > 0) {
+            throw std::runtime_error("sidecars and reader processes are not used with MPI");
+        }
+        if(files.size() * options.split > (std::size_t)INT64_MAX) {
+            throw std::runtime_error("too many work units");
+        }
+        if(session.isMaster()) {
+            openOutput(options, out, store);
+        }
+        else {
+            for(unsigned t = 0; t < options.threads; t++) {
+                estimators.push_back(makeEstimator(options.estimator, options.window, options.order, options.tolerance));
+            }
+        }
+    }
+    catch(const std::exception& e) {
+        // errors of the options are the same on all ranks and only reported once
+        if(session.isMaster() || (options.cache.empty() && options.sidecar.empty() && options.readers == 0)) {
+            std::cerr << "tune: " << e.what() << std::endl;
+        }
+        ok = false;
+    }
+    // a rank that fails to start would leave the others waiting for it
+    if(!Distributed::agree(ok)) {
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> status(files.size(), UNSEEN);
+    std::vector<Row> rows;
+    Totals totals;
+    if(session.isMaster()) {
+        // the largest files go first so the last ones to finish are small
+        std::vector<uintmax_t> sizes(files.size());
+        for(std::size_t f = 0; f < files.size(); f++) {
+            std::error_code error;
+            sizes[f] = std::filesystem::file_size(files[f], error);
+        }
+        std::vector<int64_t> units(files.size() * options.split);
+        for(std::size_t u = 0; u < units.size(); u++) {
+            units[u] = u;
+        }
+        std::stable_sort(units.begin(), units.end(), [&](int64_t a, int64_t b) {
+            return sizes[a / options.split] > sizes[b / options.split];
+        });
+        Distributed::serve(units, session.getSize() - 1);
+    }
+    else {
+        Arena arena(64 << 20, Arena::parseMode(options.hugePages));
+        for(int64_t unit = Distributed::request(); unit >= 0; unit = Distributed::request()) {
+            std::size_t f = unit / options.split;
+            try {
+                status[f] = std::max<uint8_t>(status[f],
+                    analysePart(files[f], f, unit % options.split, options, estimators, arena, rows, totals));
+            }
+            catch(const std::exception& e) {
+                std::cerr << "tune: " << files[f] << ": " << e.what() << std::endl;
+                status[f] = FAILED;
+            }
+        }
+    }
+
+    rows = Distributed::gather(rows);
+    Distributed::maximum(status);
+    std::vector<uint64_t> bytes = { totals.bytes };
+    Distributed::sum(bytes);
+    if(!session.isMaster()) {
+        return 0;
+    }
+
+    // the order of a single process: by file, bunch and window
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.file != b.file ? a.file < b.file : a.bunch != b.bunch ? a.bunch < b.bunch : a.start < b.start;
+    });
+    std::size_t row = 0;
+    for(std::size_t f = 0; f < files.size(); f++) {
+        std::size_t end = row;
+        while(end < rows.size() && rows[end].file == f) {
+            end++;
+        }
+        if(status[f] == ANALYSED) {
+            uint32_t id = store ? store->addFile(files[f]) : 0;
+            for(std::size_t r = row; r < end; r++) {
+                if(r == row || rows[r].bunch != rows[r - 1].bunch) {
+                    totals.bunches++;
+                }
+                if(store) {
+                    store->append(id, rows[r].bunch, rows[r].start, rows[r].result);
+                }
+                else {
+                    writeLine(out, files[f], rows[r].bunch, rows[r].start, rows[r].result);
+                }
+            }
+            totals.files++;
+            totals.windows += end - row;
+        }
+        totals.skipped += status[f] == SKIPPED;
+        totals.failed += status[f] == FAILED;
+        row = end;
+    }
+    totals.bytes = bytes[0];
+
+    try {
+        if(store) {
+            store->close();
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "tune: " << e.what() << std::endl;
+        totals.failed++;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if(out != nullptr && out != stdout) {
+        fclose(out);
+    }
+
+    double seconds = std::max(elapsed.count(), 1e-9);
+    fprintf(stderr, "tune: %zu files (%zu skipped, %zu failed), %zu bunches, %zu windows in %.3f s: "
+        "%.1f windows/s, %.1f MB/s of raw data, %d ranks x %u threads, estimator %s\n",
+        totals.files, totals.skipped, totals.failed, totals.bunches, totals.windows, seconds,
+        totals.windows / seconds, totals.bytes / 1e6 / seconds, session.getSize() - 1, options.threads,
+        options.estimator.c_str());
+    return totals.failed > 0 ? 1 : 0;
+}
+#endif
+
+int main(int argc, char** argv) {
+#ifdef USE_MPI
+    Distributed::Session session(argc, argv);
+#endif
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "tune: " << e.what() << std::endl;
+        return 2;
+    }
+#ifdef USE_MPI
+    if(session.getSize() > 1) {
+        return runDistributed(options, session);
+    }
+#endif
+
+    // the readers are forked before any thread is started or output is opened
+    std::unique_ptr<HDFLib::HDFReaderPool> pool;
+    try {
+        if(options.readers > 0) {
+            pool.reset(new HDFLib::HDFReaderPool(options.readers));
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "tune: " << e.what() << std::endl;
+        return 2;
+    }
+
+    FILE* out = nullptr;
+    std::unique_ptr<ResultsStore::Writer> store;
+    try {
+        openOutput(options, out, store);
+    }
+    catch(const std::exception& e) {
+        std::cerr << "tune: " << e.what() << std::endl;
+        return 2;
+    }
+
+    // FFTW planning is not thread safe, so every estimator is created up front
+    std::vector<std::unique_ptr<TuneEstimator>> estimators;
+    try {
+        for(unsigned t = 0; t < options.threads; t++) {
+            estimators.push_back(makeEstimator(options.estimator, options.window, options.order, options.tolerance));
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "tune: " << e.what() << std::endl;
+        return 2;
+    }
+
+    std::unique_ptr<ResultCache> cache;
+    std::string settings = estimators[0]->getName() + ";" + estimators[0]->getParameters() +
+        ";window=" + std::to_string(options.window) + ";hop=" + std::to_string(options.hop);
+    try {
+        if(!options.cache.empty()) {
+            cache.reset(new ResultCache(options.cache, options.cacheSize << 20,
+                options.cacheKey == "content" ? ResultCache::Identity::CONTENT : ResultCache::Identity::STAT));
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "tune: " << e.what() << std::endl;
+        return 2;
+    }
+
+    // placement only matters with more than one node
+    std::unique_ptr<Numa::Topology> topology;
+    if(options.numa) {
+        Numa::Topology detected = Numa::Topology::detect();
+        if(detected.getNodes() > 1) {
+            topology.reset(new Numa::Topology(detected));
+        }
+    }
+    // per file buffers, one arena on every node
+    std::vector<std::unique_ptr<Arena>> arenas;
+    for(std::size_t node = 0; node < (topology ? topology->getNodes() : 1); node++) {
+        arenas.emplace_back(new Arena(64 << 20, Arena::parseMode(options.hugePages), topology.get(), node));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Totals totals;
+    for(const std::string& filename : collectFiles(options.inputs)) {
+        try {
+            analyseFile(filename, options, settings, estimators, topology.get(), arenas, pool.get(), out, store.get(),
+                cache.get(), totals);
+        }
+        catch(const std::exception& e) {
+            std::cerr << "tune: " << filename << ": " << e.what() << std::endl;
+            totals.failed++;
+        }
+        if(out != nullptr) {
+            fflush(out);
+        }
+    }
+
+    try {
+        if(store) {
+            store->close();
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "tune: " << e.what() << std::endl;
+        totals.failed++;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if(out != nullptr && out != stdout) {
+        fclose(out);
+    }
+
+    double seconds = std::max(elapsed.count(), 1e-9);
+    fprintf(stderr, "tune: %zu files (%zu skipped, %zu failed), %zu bunches, %zu windows (%zu cached) in %.3f s: "
+        "%.1f windows/s, %.1f MB/s of raw data, %u threads, estimator %s\n",
+        totals.files, totals.skipped, totals.failed, totals.bunches, totals.windows, totals.cached, seconds,
+        totals.windows / seconds, totals.bytes / 1e6 / seconds, options.threads, options.estimator.c_str());
+    std::size_t reserved = 0, explicitPages = 0;
+    for(const std::unique_ptr<Arena>& arena : arenas) {
+        reserved += arena->getReserved();
+        explicitPages += arena->getExplicit();
+    }
+    fprintf(stderr, "tune: %.1f MB of per file buffers, %.1f MB on explicit and %.1f MB on transparent huge pages\n",
+        reserved / 1e6, explicitPages / 1e6, Arena::transparentBytes() / 1e6);
+    if(topology) {
+        std::size_t gathered = totals.localBytes + totals.remoteBytes;
+        fprintf(stderr, "tune: %zu NUMA nodes, %.1f MB of bunch data gathered, %.1f%% across nodes\n",
+            topology->getNodes(), gathered / 1e6, gathered > 0 ? 100.0 * totals.remoteBytes / gathered : 0.0);
+    }
+    return totals.failed > 0 ? 1 : 0;
+}